@@ -1,13 +1,19 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <csignal>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 typedef void (*sighandler_t)(int sig);
 
-#include "cereal/services.h"
+#include "cereal/messaging/bridge_services.h"
+#include "common/timing.h"
+#include "common/util.h"
 #include "msgq/impl_msgq.h"
 #include "msgq/impl_zmq.h"
 
@@ -21,43 +27,23 @@ void sigpipe_handler(int sig) {
   std::cout << "SIGPIPE received" << std::endl;
 }
 
-static std::vector<std::string> get_services(std::string whitelist_str, bool zmq_to_msgq) {
-  std::vector<std::string> service_list;
-  for (const auto& it : services) {
-    std::string name = it.second.name;
-    bool in_whitelist = whitelist_str.find(name) != std::string::npos;
-    if (name == "plusFrame" || name == "uiLayoutState" || (zmq_to_msgq && !in_whitelist)) {
-      continue;
-    }
-    service_list.push_back(name);
-  }
-  return service_list;
-}
-
-int main(int argc, char** argv) {
-  signal(SIGPIPE, (sighandler_t)sigpipe_handler);
-  signal(SIGINT, (sighandler_t)set_do_exit);
-  signal(SIGTERM, (sighandler_t)set_do_exit);
-
-  bool zmq_to_msgq = argc > 2;
-  std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
-  std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : "";
+struct ServiceStats {
+  std::string name;
+  std::atomic<uint64_t> msgs = 0, bytes = 0;
+  // failed sends. messages overwritten in the msgq ring before the bridge read them are never seen, so not counted
+  std::atomic<uint64_t> drops = 0;
+};
 
-  Poller *poller;
-  Context *pub_context;
-  Context *sub_context;
-  if (zmq_to_msgq) {  // republishes zmq debugging messages as msgq
-    poller = new ZMQPoller();
-    pub_context = new MSGQContext();
-    sub_context = new ZMQContext();
+static void bridge_thread(std::vector<ServiceStats *> stats, bool zmq_to_msgq, std::string ip, Context *pub_context, Context *sub_context) {
+  std::unique_ptr<Poller> poller;
+  if (zmq_to_msgq) {
+    poller = std::make_unique<ZMQPoller>();
   } else {
-    poller = new MSGQPoller();
-    pub_context = new ZMQContext();
-    sub_context = new MSGQContext();
+    poller = std::make_unique<MSGQPoller>();
   }
 
-  std::map<SubSocket*, PubSocket*> sub2pub;
-  for (auto endpoint : get_services(whitelist_str, zmq_to_msgq)) {
+  std::map<SubSocket*, std::pair<PubSocket*, ServiceStats*>> sub2pub;
+  for (auto s : stats) {
     PubSocket * pub_sock;
     SubSocket * sub_sock;
     if (zmq_to_msgq) {
@@ -67,26 +53,104 @@ int main(int argc, char** argv) {
       pub_sock = new ZMQPubSocket();
       sub_sock = new MSGQSubSocket();
     }
-    pub_sock->connect(pub_context, endpoint);
-    sub_sock->connect(sub_context, endpoint, ip, false);
+    pub_sock->connect(pub_context, s->name);
+    sub_sock->connect(sub_context, s->name, ip, false);
 
     poller->registerSocket(sub_sock);
-    sub2pub[sub_sock] = pub_sock;
+    sub2pub[sub_sock] = {pub_sock, s};
   }
 
   while (!do_exit) {
     for (auto sub_sock : poller->poll(100)) {
       Message * msg = sub_sock->receive();
       if (msg == NULL) continue;
+
+      auto [pub_sock, s] = sub2pub[sub_sock];
       int ret;
       do {
-        ret = sub2pub[sub_sock]->sendMessage(msg);
+        ret = pub_sock->sendMessage(msg);
       } while (ret == -1 && errno == EINTR && !do_exit);
-      assert(ret >= 0 || do_exit);
+
+      if (ret >= 0) {
+        s->msgs += 1;
+        s->bytes += msg->getSize();
+      } else if (!do_exit) {
+        s->drops += 1;
+      }
       delete msg;
 
       if (do_exit) break;
     }
   }
+
+  for (auto &[sub_sock, pub] : sub2pub) {
+    delete sub_sock;
+    delete pub.first;
+  }
+}
+
+static void print_stats(const std::vector<std::unique_ptr<ServiceStats>> &stats, std::map<std::string, uint64_t> &prev_bytes, double dt) {
+  for (auto &s : stats) {
+    uint64_t bytes = s->bytes;
+    if (bytes == prev_bytes[s->name] && s->drops == 0) continue;
+
+    std::cout << s->name << ": " << s->msgs << " msgs, " << (bytes - prev_bytes[s->name]) / dt / 1024 << " KB/s, "
+              << s->drops << " drops" << std::endl;
+    prev_bytes[s->name] = bytes;
+  }
+}
+
+// usage:
+//   bridge                        msgq -> zmq for all services, or the comma separated list in BRIDGE_WHITELIST
+//   bridge <ip> <whitelist>       zmq from <ip> -> msgq for a comma separated list of services
+// BRIDGE_THREADS shards services across worker threads, BRIDGE_STATS prints per-service stats every N seconds.
+int main(int argc, char** argv) {
+  signal(SIGPIPE, (sighandler_t)sigpipe_handler);
+  signal(SIGINT, (sighandler_t)set_do_exit);
+  signal(SIGTERM, (sighandler_t)set_do_exit);
+
+  bool zmq_to_msgq = argc > 2;
+  std::string ip = zmq_to_msgq ? argv[1] : "127.0.0.1";
+  std::string whitelist_str = zmq_to_msgq ? std::string(argv[2]) : util::getenv("BRIDGE_WHITELIST");
+  const int num_threads = std::max(1, util::getenv("BRIDGE_THREADS", 1));
+  const int stats_interval = util::getenv("BRIDGE_STATS", 0);
+
+  Context *pub_context;
+  Context *sub_context;
+  if (zmq_to_msgq) {  // republishes zmq debugging messages as msgq
+    pub_context = new MSGQContext();
+    sub_context = new ZMQContext();
+  } else {
+    pub_context = new ZMQContext();
+    sub_context = new MSGQContext();
+  }
+
+  std::vector<std::unique_ptr<ServiceStats>> stats;
+  std::vector<std::thread> threads;
+  for (auto &names : shard_services(get_services(parse_whitelist(whitelist_str), zmq_to_msgq), num_threads)) {
+    std::vector<ServiceStats *> shard;
+    for (auto &name : names) {
+      shard.push_back(stats.emplace_back(std::make_unique<ServiceStats>()).get());
+      shard.back()->name = name;
+    }
+    if (!shard.empty()) {
+      threads.emplace_back(bridge_thread, shard, zmq_to_msgq, ip, pub_context, sub_context);
+    }
+  }
+
+  std::map<std::string, uint64_t> prev_bytes;
+  double last_stats_time = millis_since_boot();
+  while (!do_exit) {
+    util::sleep_for(100);
+    double cur_time = millis_since_boot();
+    if (stats_interval > 0 && cur_time - last_stats_time >= stats_interval * 1000) {
+      print_stats(stats, prev_bytes, (cur_time - last_stats_time) / 1000.);
+      last_stats_time = cur_time;
+    }
+  }
+
+  for (auto &t : threads) t.join();
+  delete pub_context;
+  delete sub_context;
   return 0;
 }
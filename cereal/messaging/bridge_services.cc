@@ -0,0 +1,37 @@
+#include "cereal/messaging/bridge_services.h"
+
+#include <algorithm>
+#include <sstream>
+
+std::set<std::string> parse_whitelist(const std::string &whitelist_str) {
+  std::set<std::string> whitelist;
+  std::istringstream ss(whitelist_str);
+  for (std::string name; std::getline(ss, name, ',');) {
+    const size_t begin = name.find_first_not_of(" \t\n");
+    if (begin == std::string::npos) continue;
+    whitelist.insert(name.substr(begin, name.find_last_not_of(" \t\n") + 1 - begin));
+  }
+  return whitelist;
+}
+
+std::vector<service> get_services(const std::set<std::string> &whitelist, bool zmq_to_msgq) {
+  std::vector<service> service_list;
+  for (const auto& it : services) {
+    const std::string &name = it.second.name;
+    bool in_whitelist = whitelist.count(name) > 0;
+    if (name == "plusFrame" || name == "uiLayoutState" || ((zmq_to_msgq || !whitelist.empty()) && !in_whitelist)) {
+      continue;
+    }
+    service_list.push_back(it.second);
+  }
+  return service_list;
+}
+
+std::vector<std::vector<std::string>> shard_services(std::vector<service> service_list, int num_threads) {
+  std::stable_sort(service_list.begin(), service_list.end(), [](auto &a, auto &b) { return a.frequency > b.frequency; });
+  std::vector<std::vector<std::string>> shards(std::max(1, num_threads));
+  for (size_t i = 0; i < service_list.size(); ++i) {
+    shards[i % shards.size()].push_back(service_list[i].name);
+  }
+  return shards;
+}
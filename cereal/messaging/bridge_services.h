@@ -0,0 +1,14 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cereal/services.h"
+
+// comma separated service names, surrounding whitespace is ignored
+std::set<std::string> parse_whitelist(const std::string &whitelist_str);
+// the services to bridge. zmq -> msgq only bridges whitelisted services, msgq -> zmq all of them if the whitelist is empty
+std::vector<service> get_services(const std::set<std::string> &whitelist, bool zmq_to_msgq);
+// busiest services first, dealt out round-robin so each of the num_threads shards gets a similar load
+std::vector<std::vector<std::string>> shard_services(std::vector<service> service_list, int num_threads);
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
 #include <map>
 #include <string>
 #include <vector>
@@ -22,9 +26,17 @@ public:
   inline bool allValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, false); }
   inline bool allAliveAndValid(const std::vector<const char *> &service_list = {}) { return all_(service_list, true, true); }
   void drain();
+  // When enabled (default), word-aligned payloads are read in place from the received Message, which is
+  // kept alive until the next message on that service replaces it, instead of being copied again into an
+  // aligned buffer. Unaligned payloads are still copied. This is not a read from shared memory: the
+  // transport's receive() has already copied the payload into the heap allocated Message.
+  inline void setZeroCopy(bool enable) { zero_copy_ = enable; }
+  // Opt-in for latency-critical loops: spin on non-blocking polls for up to spin_us before blocking in Poller::poll.
+  inline void setSpinWait(int spin_us) { spin_us_ = spin_us; }
   ~SubMaster();
 
   uint64_t frame = 0;
+  uint64_t bytes_copied = 0;  // payload bytes copied into aligned buffers, on top of the copy made by receive()
   bool updated(const char *name) const;
   bool alive(const char *name) const;
   bool valid(const char *name) const;
@@ -32,17 +44,81 @@ public:
   uint64_t rcv_time(const char *name) const;
   cereal::Event::Reader &operator[](const char *name) const;
 
+  // Resolve a service name once, then index the per-service state directly in hot loops.
+  struct Handle { uint32_t idx; };
+  Handle handle(const char *name) const;
+  bool updated(Handle h) const;
+  bool alive(Handle h) const;
+  bool valid(Handle h) const;
+  uint64_t rcv_frame(Handle h) const;
+  uint64_t rcv_time(Handle h) const;
+  cereal::Event::Reader &operator[](Handle h) const;
+
+  // Publish-to-receive latency of the last message on a service, from its logMonoTime.
+  uint64_t rcv_latency(const char *name) const;
+  uint64_t rcv_latency(Handle h) const;
+
+  // Latency from the oldest polled message being published to update() receiving it,
+  // over the last WAKEUP_SAMPLES updates that received a polled message.
+  struct LatencyStats { size_t count; double p50_us; double p99_us; };
+  LatencyStats wakeupLatency() const;
+  static constexpr size_t WAKEUP_SAMPLES = 1024;
+
 private:
+  struct SubMessage;
+  std::vector<SubSocket *> poll_(int timeout);
   bool all_(const std::vector<const char *> &service_list, bool valid, bool alive);
+  void update_msgs_(uint64_t current_time, const std::vector<std::pair<SubMessage *, cereal::Event::Reader>> &messages);
   Poller *poller_ = nullptr;
-  struct SubMessage;
+  bool zero_copy_ = true;
+  int spin_us_ = 0;
+  std::vector<uint64_t> wakeup_ns_;
+  size_t wakeup_count_ = 0;
+  std::vector<SubMessage *> subs_;
   std::map<SubSocket *, SubMessage *> messages_;
-  std::map<std::string, SubMessage *> services_;
+  std::map<std::string, uint32_t, std::less<>> services_;
+};
+
+// Zeroed first segment and serialization buffer shared by successive MessageBuilders on one thread,
+// so a publisher building one message per frame stops allocating once the message size has settled.
+// MallocMessageBuilder zeroes the used part of a caller-provided segment when it is destroyed.
+// Only one MessageBuilder may use an arena at a time.
+class MessageArena {
+public:
+  explicit MessageArena(size_t words = 1024) { resize(words); }
+
+private:
+  friend class MessageBuilder;
+  kj::ArrayPtr<capnp::word> segment() {
+    if (grow_words_ > segment_.size()) resize(grow_words_);
+    return segment_;
+  }
+  void resize(size_t words) {
+    segment_ = kj::heapArray<capnp::word>(words);
+    memset(segment_.begin(), 0, words * sizeof(capnp::word));
+  }
+
+  kj::Array<capnp::word> segment_;
+  kj::Array<capnp::word> out_;
+  size_t grow_words_ = 0;
 };
 
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  explicit MessageBuilder(MessageArena &arena) : capnp::MallocMessageBuilder(arena.segment()), arena_(&arena) {}
+
+  ~MessageBuilder() {
+    if (arena_) {
+      // the message spilled into malloc'd segments, give the next builder a first segment that fits it
+      auto segments = getSegmentsForOutput();
+      if (segments.size() > 1) {
+        size_t words = 0;
+        for (auto &seg : segments) words += seg.size();
+        arena_->grow_words_ = words + words / 4;
+      }
+    }
+  }
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -52,8 +128,18 @@ public:
   }
 
   kj::ArrayPtr<capnp::byte> toBytes() {
-    heapArray_ = capnp::messageToFlatArray(*this);
-    return heapArray_.asBytes();
+    if (arena_ == nullptr) {
+      heapArray_ = capnp::messageToFlatArray(*this);
+      return heapArray_.asBytes();
+    }
+
+    size_t size = getSerializedSize();
+    if (arena_->out_.size() * sizeof(capnp::word) < size) {
+      arena_->out_ = kj::heapArray<capnp::word>(size / sizeof(capnp::word) * 2);
+    }
+    auto out = arena_->out_.asBytes();
+    serializeToBuffer(out.begin(), out.size());
+    return out.slice(0, size);
   }
 
   size_t getSerializedSize() {
@@ -70,17 +156,44 @@ public:
 
 private:
   kj::Array<capnp::word> heapArray_;
+  MessageArena *arena_ = nullptr;
 };
 
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
+  inline int send(const char *name, capnp::byte *data, size_t size) { return socket(name)->send((char *)data, size); }
   int send(const char *name, MessageBuilder &msg);
   ~PubMaster();
 
+  struct Handle { uint32_t idx; };
+  Handle handle(const char *name) const;
+  inline int send(Handle h, capnp::byte *data, size_t size) { return socks_[h.idx]->send((char *)data, size); }
+  int send(Handle h, MessageBuilder &msg);
+
+  // Serialize all messages first, then publish them back to back. Returns -1 if any send failed.
+  inline int sendMany(std::initializer_list<std::pair<const char *, MessageBuilder *>> msgs) { return sendMany_(msgs); }
+  inline int sendMany(std::initializer_list<std::pair<Handle, MessageBuilder *>> msgs) { return sendMany_(msgs); }
+
 private:
-  std::map<std::string, PubSocket *> sockets_;
+  template <class Key>
+  int sendMany_(std::initializer_list<std::pair<Key, MessageBuilder *>> msgs) {
+    KJ_STACK_ARRAY(kj::ArrayPtr<capnp::byte>, bytes, msgs.size(), 8, 32);
+    size_t i = 0;
+    for (auto &kv : msgs) bytes[i++] = kv.second->toBytes();
+
+    int ret = 0;
+    i = 0;
+    for (auto &kv : msgs) {
+      if (send(kv.first, bytes[i].begin(), bytes[i].size()) < 0) ret = -1;
+      ++i;
+    }
+    return ret;
+  }
+
+  PubSocket *socket(const char *name) const;
+  std::vector<PubSocket *> socks_;
+  std::map<std::string, uint32_t, std::less<>> sockets_;
 };
 
 class AlignedBuffer {
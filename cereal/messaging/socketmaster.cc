@@ -1,5 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <stdexcept>
 #include <string>
 #include <mutex>
 
@@ -35,12 +37,30 @@ struct SubMaster::SubMessage {
   SubSocket *socket = nullptr;
   int freq = 0;
   bool updated = false, alive = false, valid = true, ignore_alive;
-  uint64_t rcv_time = 0, rcv_frame = 0;
+  uint64_t rcv_time = 0, rcv_frame = 0, rcv_latency = 0;
   void *allocated_msg_reader = nullptr;
   bool is_polled = false;
   capnp::FlatArrayMessageReader *msg_reader = nullptr;
   AlignedBuffer aligned_buf;
+  Message *msg = nullptr;  // backing storage of msg_reader when read in place
   cereal::Event::Reader event;
+
+  kj::ArrayPtr<const capnp::word> take(Message *new_msg, bool zero_copy, uint64_t &bytes_copied) {
+    delete msg;
+    msg = nullptr;
+
+    const char *data = new_msg->getData();
+    const size_t size = new_msg->getSize();
+    if (zero_copy && reinterpret_cast<uintptr_t>(data) % alignof(capnp::word) == 0 && size % sizeof(capnp::word) == 0) {
+      msg = new_msg;
+      return kj::ArrayPtr<const capnp::word>(reinterpret_cast<const capnp::word *>(data), size / sizeof(capnp::word));
+    }
+
+    bytes_copied += size;
+    auto words = aligned_buf.align(new_msg);
+    delete new_msg;
+    return words;
+  }
 };
 
 SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::vector<const char *> &poll,
@@ -63,14 +83,15 @@ SubMaster::SubMaster(const std::vector<const char *> &service_list, const std::v
       .is_polled = is_polled};
     m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader({});
     messages_[socket] = m;
-    services_[name] = m;
+    services_[name] = subs_.size();
+    subs_.push_back(m);
   }
 }
 
 void SubMaster::update(int timeout) {
-  for (auto &kv : messages_) kv.second->updated = false;
+  for (auto m : subs_) m->updated = false;
 
-  auto sockets = poller_->poll(timeout);
+  auto sockets = poll_(timeout);
 
   // add non-polled sockets for non-blocking receive
   for (auto &kv : messages_) {
@@ -81,7 +102,9 @@ void SubMaster::update(int timeout) {
 
   uint64_t current_time = nanos_since_boot();
 
-  std::vector<std::pair<std::string, cereal::Event::Reader>> messages;
+  std::vector<std::pair<SubMessage *, cereal::Event::Reader>> messages;
+  messages.reserve(sockets.size());
+  uint64_t wakeup_latency = 0;
 
   for (auto s : sockets) {
     Message *msg = s->receive(true);
@@ -92,23 +115,59 @@ void SubMaster::update(int timeout) {
     m->msg_reader->~FlatArrayMessageReader();
     capnp::ReaderOptions options;
     options.traversalLimitInWords = kj::maxValue; // Don't limit
-    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->aligned_buf.align(msg), options);
-    delete msg;
-    messages.push_back({m->name, m->msg_reader->getRoot<cereal::Event>()});
+    m->msg_reader = new (m->allocated_msg_reader) capnp::FlatArrayMessageReader(m->take(msg, zero_copy_, bytes_copied), options);
+    messages.push_back({m, m->msg_reader->getRoot<cereal::Event>()});
+
+    // logMonoTime is stamped by the publisher right before sending. Replayed messages carry
+    // their original timestamps, so only count ones that look like they were just published.
+    uint64_t log_mono_time = messages.back().second.getLogMonoTime();
+    bool fresh = log_mono_time <= current_time && current_time - log_mono_time < 1e9;
+    m->rcv_latency = fresh ? current_time - log_mono_time : 0;
+    if (fresh && m->is_polled) wakeup_latency = std::max(wakeup_latency, m->rcv_latency);
+  }
+
+  if (wakeup_latency > 0) {
+    if (wakeup_ns_.empty()) wakeup_ns_.resize(WAKEUP_SAMPLES);
+    wakeup_ns_[wakeup_count_++ % WAKEUP_SAMPLES] = wakeup_latency;
   }
 
-  update_msgs(current_time, messages);
+  update_msgs_(current_time, messages);
 }
 
-void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
-  if (++frame == UINT64_MAX) frame = 1;
+std::vector<SubSocket *> SubMaster::poll_(int timeout) {
+  if (spin_us_ > 0) {
+    // never spin past the timeout, and only block for what is left of it
+    const uint64_t spin_ns = (timeout >= 0 ? std::min<uint64_t>(spin_us_, timeout * 1000ULL) : spin_us_) * 1000ULL;
+    const uint64_t spin_start = nanos_since_boot();
+    uint64_t now = spin_start;
+    do {
+      auto sockets = poller_->poll(0);
+      if (!sockets.empty()) return sockets;
+      now = nanos_since_boot();
+    } while (now < spin_start + spin_ns);
+
+    if (timeout > 0) timeout = std::max(0, timeout - (int)((now - spin_start) / 1000000));
+  }
+  return poller_->poll(timeout);
+}
 
+void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<std::string, cereal::Event::Reader>> &messages){
+  std::vector<std::pair<SubMessage *, cereal::Event::Reader>> msgs;
+  msgs.reserve(messages.size());
   for (auto &kv : messages) {
     auto m_find = services_.find(kv.first);
-    if (m_find == services_.end()){
-      continue;
+    if (m_find != services_.end()) {
+      msgs.push_back({subs_[m_find->second], kv.second});
     }
-    SubMessage *m = m_find->second;
+  }
+  update_msgs_(current_time, msgs);
+}
+
+void SubMaster::update_msgs_(uint64_t current_time, const std::vector<std::pair<SubMessage *, cereal::Event::Reader>> &messages) {
+  if (++frame == UINT64_MAX) frame = 1;
+
+  for (auto &kv : messages) {
+    SubMessage *m = kv.first;
     m->event = kv.second;
     m->updated = true;
     m->rcv_time = current_time;
@@ -118,8 +177,7 @@ void SubMaster::update_msgs(uint64_t current_time, const std::vector<std::pair<s
   }
 
   if (!SIMULATION) {
-    for (auto &kv : messages_) {
-      SubMessage *m = kv.second;
+    for (auto m : subs_) {
       m->alive = (m->freq <= (1e-5) || ((current_time - m->rcv_time) * (1e-9)) < (10.0 / m->freq));
     }
   }
@@ -149,28 +207,76 @@ void SubMaster::drain() {
   }
 }
 
+SubMaster::Handle SubMaster::handle(const char *name) const {
+  auto it = services_.find(name);
+  if (it == services_.end()) throw std::out_of_range(name);
+  return {it->second};
+}
+
 bool SubMaster::updated(const char *name) const {
-  return services_.at(name)->updated;
+  return updated(handle(name));
 }
 
 bool SubMaster::alive(const char *name) const {
-  return services_.at(name)->alive;
+  return alive(handle(name));
 }
 
 bool SubMaster::valid(const char *name) const {
-  return services_.at(name)->valid;
+  return valid(handle(name));
 }
 
 uint64_t SubMaster::rcv_frame(const char *name) const {
-  return services_.at(name)->rcv_frame;
+  return rcv_frame(handle(name));
 }
 
 uint64_t SubMaster::rcv_time(const char *name) const {
-  return services_.at(name)->rcv_time;
+  return rcv_time(handle(name));
 }
 
 cereal::Event::Reader &SubMaster::operator[](const char *name) const {
-  return services_.at(name)->event;
+  return (*this)[handle(name)];
+}
+
+bool SubMaster::updated(Handle h) const {
+  return subs_[h.idx]->updated;
+}
+
+bool SubMaster::alive(Handle h) const {
+  return subs_[h.idx]->alive;
+}
+
+bool SubMaster::valid(Handle h) const {
+  return subs_[h.idx]->valid;
+}
+
+uint64_t SubMaster::rcv_frame(Handle h) const {
+  return subs_[h.idx]->rcv_frame;
+}
+
+uint64_t SubMaster::rcv_time(Handle h) const {
+  return subs_[h.idx]->rcv_time;
+}
+
+cereal::Event::Reader &SubMaster::operator[](Handle h) const {
+  return subs_[h.idx]->event;
+}
+
+uint64_t SubMaster::rcv_latency(const char *name) const {
+  return rcv_latency(handle(name));
+}
+
+uint64_t SubMaster::rcv_latency(Handle h) const {
+  return subs_[h.idx]->rcv_latency;
+}
+
+SubMaster::LatencyStats SubMaster::wakeupLatency() const {
+  std::vector<uint64_t> samples(wakeup_ns_.begin(), wakeup_ns_.begin() + std::min(wakeup_count_, wakeup_ns_.size()));
+  if (samples.empty()) return {};
+
+  std::sort(samples.begin(), samples.end());
+  return {.count = samples.size(),
+          .p50_us = samples[samples.size() / 2] / 1e3,
+          .p99_us = samples[samples.size() * 99 / 100] / 1e3};
 }
 
 SubMaster::~SubMaster() {
@@ -179,6 +285,7 @@ SubMaster::~SubMaster() {
     SubMessage *m = kv.second;
     m->msg_reader->~FlatArrayMessageReader();
     free(m->allocated_msg_reader);
+    delete m->msg;
     delete m->socket;
     delete m;
   }
@@ -189,15 +296,30 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
     assert(services.count(name) > 0);
     PubSocket *socket = PubSocket::create(message_context.context(), name);
     assert(socket);
-    sockets_[name] = socket;
+    sockets_[name] = socks_.size();
+    socks_.push_back(socket);
   }
 }
 
+PubMaster::Handle PubMaster::handle(const char *name) const {
+  auto it = sockets_.find(name);
+  if (it == sockets_.end()) throw std::out_of_range(name);
+  return {it->second};
+}
+
+PubSocket *PubMaster::socket(const char *name) const {
+  return socks_[handle(name).idx];
+}
+
 int PubMaster::send(const char *name, MessageBuilder &msg) {
+  return send(handle(name), msg);
+}
+
+int PubMaster::send(Handle h, MessageBuilder &msg) {
   auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  return send(h, bytes.begin(), bytes.size());
 }
 
 PubMaster::~PubMaster() {
-  for (auto s : sockets_) delete s.second;
+  for (auto s : socks_) delete s;
 }
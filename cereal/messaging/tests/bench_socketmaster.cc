@@ -0,0 +1,161 @@
+// Micro-benchmarks for the SubMaster/PubMaster hot paths.
+// Requires a working msgq setup (e.g. /dev/shm), run with no other publishers on the benchmarked services.
+//
+// usage: bench_socketmaster [iterations]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+static void print_stats(const char *name, std::vector<uint64_t> &ns, uint64_t bytes_copied) {
+  std::sort(ns.begin(), ns.end());
+  double sum = 0;
+  for (auto v : ns) sum += v;
+  printf("%-40s avg %8.2f us  p50 %8.2f us  p99 %8.2f us  copied %8.1f KB/update\n", name,
+         sum / ns.size() / 1e3, ns[ns.size() / 2] / 1e3, ns[ns.size() * 99 / 100] / 1e3,
+         (double)bytes_copied / ns.size() / 1024.0);
+}
+
+static void bench_receive(size_t payload_size, bool zero_copy, int iterations) {
+  const char *service = "roadEncodeData";
+  PubMaster pm({service});
+  SubMaster sm({service});
+  sm.setZeroCopy(zero_copy);
+
+  std::vector<capnp::byte> payload(payload_size, 0x5a);
+  std::vector<uint64_t> ns;
+  ns.reserve(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    MessageBuilder msg;
+    auto edata = msg.initEvent().initRoadEncodeData();
+    edata.setData(kj::arrayPtr(payload.data(), payload.size()));
+    pm.send(service, msg);
+
+    uint64_t start = nanos_since_boot();
+    sm.update(100);
+    uint64_t end = nanos_since_boot();
+    if (sm.updated(service)) {
+      ns.push_back(end - start);
+    }
+  }
+
+  if (ns.empty()) {
+    printf("no messages received on %s\n", service);
+    return;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "receive %zu KB (%s)", payload_size / 1024, zero_copy ? "zero-copy" : "copy");
+  print_stats(name, ns, sm.bytes_copied);
+}
+
+static void bench_lookup(int iterations) {
+  const std::vector<const char *> service_list = {"carState", "carControl", "controlsState", "modelV2", "liveParameters",
+                                                  "liveTorqueParameters", "longitudinalPlan", "radarState", "deviceState",
+                                                  "pandaStates", "liveCalibration", "driverMonitoringState", "onroadEvents"};
+  SubMaster sm(service_list);
+  const int calls = 50;  // roughly what a control loop does per cycle
+  volatile uint64_t sink = 0;
+
+  std::vector<uint64_t> ns;
+  ns.reserve(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t start = nanos_since_boot();
+    for (int j = 0; j < calls; ++j) {
+      const char *name = service_list[j % service_list.size()];
+      sink += sm.updated(name) + sm.alive(name) + sm.valid(name) + sm.rcv_frame(name);
+    }
+    ns.push_back((nanos_since_boot() - start) / (calls * 4));
+  }
+  print_stats("lookup by name (per call)", ns, 0);
+
+  std::vector<SubMaster::Handle> handles;
+  for (auto name : service_list) handles.push_back(sm.handle(name));
+  ns.clear();
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t start = nanos_since_boot();
+    for (int j = 0; j < calls; ++j) {
+      auto h = handles[j % handles.size()];
+      sink += sm.updated(h) + sm.alive(h) + sm.valid(h) + sm.rcv_frame(h);
+    }
+    ns.push_back((nanos_since_boot() - start) / (calls * 4));
+  }
+  print_stats("lookup by handle (per call)", ns, 0);
+}
+
+static void bench_publish(bool use_arena, int iterations) {
+  PubMaster pm({"can"});
+  MessageArena arena;
+  uint8_t dat[64] = {};
+
+  std::vector<uint64_t> ns;
+  ns.reserve(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t start = nanos_since_boot();
+    std::optional<MessageBuilder> msg;
+    if (use_arena) {
+      msg.emplace(arena);
+    } else {
+      msg.emplace();
+    }
+    auto can_data = msg->initEvent().initCan(200);  // a busy 10ms window on three buses
+    for (int j = 0; j < 200; ++j) {
+      can_data[j].setAddress(j);
+      can_data[j].setDat(kj::arrayPtr(dat, j % 2 ? 8 : 64));
+      can_data[j].setSrc(j % 3);
+    }
+    pm.send("can", *msg);
+    msg.reset();
+    ns.push_back(nanos_since_boot() - start);
+  }
+  print_stats(use_arena ? "build+publish can (arena)" : "build+publish can (malloc)", ns, 0);
+}
+
+static void bench_wakeup(int spin_us, int iterations) {
+  std::atomic<bool> exit = false;
+  std::thread publisher([&]() {
+    PubMaster pm({"carState"});
+    while (!exit) {
+      MessageBuilder msg;
+      msg.initEvent().initCarState();
+      pm.send("carState", msg);
+      util::sleep_for(10);
+    }
+  });
+
+  SubMaster sm({"carState"});
+  sm.setSpinWait(spin_us);
+  for (int i = 0; i < iterations; ++i) {
+    sm.update(100);
+  }
+  exit = true;
+  publisher.join();
+
+  auto stats = sm.wakeupLatency();
+  char name[64];
+  snprintf(name, sizeof(name), "wakeup carState (spin %d us)", spin_us);
+  printf("%-40s p50 %8.2f us  p99 %8.2f us  (%zu samples)\n", name, stats.p50_us, stats.p99_us, stats.count);
+}
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+
+  bench_lookup(iterations);
+  bench_publish(false, iterations);
+  bench_publish(true, iterations);
+  bench_wakeup(0, iterations);
+  bench_wakeup(10000, iterations);  // one publish period
+
+  for (size_t kb : {1, 64, 512, 2048}) {
+    bench_receive(kb * 1024, false, iterations);
+    bench_receive(kb * 1024, true, iterations);
+  }
+  return 0;
+}
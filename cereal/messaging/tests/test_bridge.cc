@@ -0,0 +1,37 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+#include "cereal/messaging/bridge_services.h"
+
+TEST_CASE("parse_whitelist") {
+  REQUIRE(parse_whitelist("").empty());
+  REQUIRE(parse_whitelist("carState, modelV2 ,,\tcan") == std::set<std::string>{"can", "carState", "modelV2"});
+  // exact names, not substrings
+  REQUIRE(get_services(parse_whitelist("carState"), true).size() == 1);
+}
+
+TEST_CASE("get_services") {
+  auto names = [](const std::vector<service> &list) {
+    std::set<std::string> s;
+    for (auto &serv : list) s.insert(serv.name);
+    return s;
+  };
+  // zmq -> msgq only bridges the whitelist, msgq -> zmq everything without one
+  REQUIRE(get_services({}, true).empty());
+  REQUIRE(names(get_services({"carState", "modelV2"}, true)) == std::set<std::string>{"carState", "modelV2"});
+  REQUIRE(names(get_services({"carState", "modelV2"}, false)) == std::set<std::string>{"carState", "modelV2"});
+  auto all = names(get_services({}, false));
+  REQUIRE(all.size() == services.size() - services.count("plusFrame") - services.count("uiLayoutState"));
+  REQUIRE(all.count("plusFrame") == 0);
+  REQUIRE(all.count("uiLayoutState") == 0);
+}
+
+TEST_CASE("shard_services") {
+  const std::vector<service> list = {{"a", true, 1, -1}, {"b", true, 100, -1}, {"c", true, 20, -1}, {"d", true, 20, -1}, {"e", true, 5, -1}};
+  REQUIRE(shard_services(list, 1) == std::vector<std::vector<std::string>>{{"b", "c", "d", "e", "a"}});
+  // busiest first, round-robin
+  REQUIRE(shard_services(list, 2) == std::vector<std::vector<std::string>>{{"b", "d", "a"}, {"c", "e"}});
+  REQUIRE(shard_services(list, 0).size() == 1);
+  auto shards = shard_services(list, 8);
+  REQUIRE(shards.size() == 8);
+  REQUIRE(shards[5].empty());
+}
@@ -2,14 +2,24 @@
 
 #include <dirent.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <climits>
 #include <csignal>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
-#include "common/queue.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
 
@@ -366,19 +376,143 @@ std::unordered_map<std::string, uint32_t> keys = {
     // }} PFEIFER - MAPD
 };
 
+// values written by something other than Params, e.g. a shell, are picked up after this long
+constexpr double PARAMS_CACHE_MAX_AGE_MS = 1000;
+constexpr uint32_t PARAMS_VERSIONS_MAGIC = 0x50524d56;  // "VMRP"
+constexpr int PARAMS_VERSION_SLOTS = 1024;
+
+// mapped from a file next to the lock file by every process using the directory
+struct ParamsVersions {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t dir_ino;  // the versions are reset when the key directory is recreated
+  std::atomic<uint32_t> slots[PARAMS_VERSION_SLOTS];
+};
+
+inline uint32_t fnv1a(const std::string &key) {
+  uint32_t hash = 2166136261u;
+  for (char c : key) hash = (hash ^ (uint8_t)c) * 16777619u;
+  return hash;
+}
+
 } // namespace
 
+// Every key has a version in shared memory, bumped by put() and remove() once the file is in place.
+// A process keeps returning the value it read until the version changes, so reading an unchanged
+// value is a few memory loads. Keys are hashed into the slots, a collision only costs an extra read.
+// Blocking reads wait on the version with a futex.
+class ParamsCache {
+public:
+  static ParamsCache *get(const std::string &params_path, const std::string &prefix) {
+    static std::mutex lock;
+    static std::map<std::string, std::unique_ptr<ParamsCache>> caches;
+
+    const std::string key_path = params_path + prefix;
+    struct stat st;
+    if (stat(key_path.c_str(), &st) != 0) return nullptr;
+
+    // a recreated directory gets a new cache, Params created before keep using the old one
+    std::lock_guard lk(lock);
+    auto &cache = caches[key_path + ":" + std::to_string(st.st_ino)];
+    if (!cache) {
+      cache.reset(new ParamsCache(params_path, prefix, st.st_ino));
+    }
+    return cache->versions_ ? cache.get() : nullptr;
+  }
+
+  std::string read(const std::string &key) {
+    const uint32_t version = slot(key).load(std::memory_order_acquire);
+    const double now = millis_since_boot();
+    {
+      std::lock_guard lk(lock_);
+      auto it = values_.find(key);
+      if (it != values_.end() && it->second.version == version && now - it->second.read_ms < PARAMS_CACHE_MAX_AGE_MS) {
+        return it->second.value;
+      }
+    }
+
+    std::string value = util::read_file(key_path_ + "/" + key);
+    std::lock_guard lk(lock_);
+    values_[key] = {version, now, value};
+    return value;
+  }
+
+  void changed(const std::string &key) {
+    auto &version = slot(key);
+    version.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)&version, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+  inline uint32_t version(const std::string &key) { return slot(key).load(std::memory_order_acquire); }
+
+  // returns when the version differs from the given one, on a signal or after the timeout
+  void wait(const std::string &key, uint32_t version, int timeout_ms) {
+#ifdef __linux__
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, (uint32_t *)&slot(key), FUTEX_WAIT, version, &timeout, nullptr, 0);
+#else
+    util::sleep_for(timeout_ms);
+#endif
+  }
+
+private:
+  struct Entry {
+    uint32_t version;
+    double read_ms;
+    std::string value;
+  };
+
+  ParamsCache(const std::string &params_path, const std::string &prefix, uint64_t dir_ino) : key_path_(params_path + prefix) {
+    const std::string file = params_path + "/.versions_" + prefix.substr(1);
+    FileLock file_lock(params_path + "/.lock");
+    int fd = HANDLE_EINTR(open(file.c_str(), O_RDWR | O_CREAT, 0664));
+    if (fd < 0) {
+      LOGW("params cache disabled, failed to open %s, errno=%d", file.c_str(), errno);
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (st.st_size >= sizeof(ParamsVersions) || ftruncate(fd, sizeof(ParamsVersions)) == 0)) {
+      void *mem = mmap(nullptr, sizeof(ParamsVersions), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (mem != MAP_FAILED) {
+        versions_ = (ParamsVersions *)mem;
+      }
+    }
+    close(fd);
+    if (!versions_) {
+      LOGW("params cache disabled, failed to map %s, errno=%d", file.c_str(), errno);
+      return;
+    }
+
+    // new versions for everything, so nothing read from the old directory stays cached
+    if (versions_->magic != PARAMS_VERSIONS_MAGIC || versions_->dir_ino != dir_ino) {
+      for (auto &slot : versions_->slots) slot.fetch_add(1);
+      versions_->dir_ino = dir_ino;
+      versions_->magic = PARAMS_VERSIONS_MAGIC;
+    }
+  }
+
+  inline std::atomic<uint32_t> &slot(const std::string &key) { return versions_->slots[fnv1a(key) % PARAMS_VERSION_SLOTS]; }
+
+  const std::string key_path_;
+  ParamsVersions *versions_ = nullptr;
+  std::mutex lock_;
+  std::unordered_map<std::string, Entry> values_;
+};
 
 Params::Params(const std::string &path) {
   params_prefix = "/" + util::getenv("OPENPILOT_PREFIX", "d");
   params_path = ensure_params_path(params_prefix, path);
+  cache = ParamsCache::get(params_path, params_prefix);
 }
 
 Params::~Params() {
   if (future.valid()) {
     future.wait();
   }
-  assert(queue.empty());
+  assert(pending.empty());
 }
 
 std::vector<std::string> Params::allKeys() const {
@@ -404,9 +538,35 @@ int Params::put(const char* key, const char* value, size_t value_size) {
   // 3) fsync() the temp file
   // 4) rename the temp file to the real name
   // 5) fsync() the containing directory
-  std::string tmp_path = params_path + "/.tmp_value_XXXXXX";
+  std::string tmp_path;
+  int result = writeTmpFile(value, value_size, tmp_path);
+  if (result == 0) {
+    FileLock file_lock(params_path + "/.lock");
+
+    // Move temp into place.
+    if ((result = rename(tmp_path.c_str(), getParamPath(key).c_str())) == 0) {
+      if (cache) cache->changed(key);
+
+      // fsync parent directory
+      result = fsync_dir(getParamPath());
+      ++fsyncs;
+    }
+  }
+
+  if (result != 0 && !tmp_path.empty()) {
+    ::unlink(tmp_path.c_str());
+  }
+  return result;
+}
+
+// steps 1-3 of put(), tmp_path is empty if the file couldn't be created
+int Params::writeTmpFile(const char *value, size_t value_size, std::string &tmp_path) {
+  tmp_path = params_path + "/.tmp_value_XXXXXX";
   int tmp_fd = mkstemp((char*)tmp_path.c_str());
-  if (tmp_fd < 0) return -1;
+  if (tmp_fd < 0) {
+    tmp_path.clear();
+    return -1;
+  }
 
   int result = -1;
   do {
@@ -418,21 +578,11 @@ int Params::put(const char* key, const char* value, size_t value_size) {
     }
 
     // fsync to force persist the changes.
-    if ((result = fsync(tmp_fd)) < 0) break;
-
-    FileLock file_lock(params_path + "/.lock");
-
-    // Move temp into place.
-    if ((result = rename(tmp_path.c_str(), getParamPath(key).c_str())) < 0) break;
-
-    // fsync parent directory
-    result = fsync_dir(getParamPath());
+    result = fsync(tmp_fd);
+    ++fsyncs;
   } while (false);
 
   close(tmp_fd);
-  if (result != 0) {
-    ::unlink(tmp_path.c_str());
-  }
   return result;
 }
 
@@ -442,12 +592,13 @@ int Params::remove(const std::string &key) {
   if (result != 0) {
     return result;
   }
+  if (cache) cache->changed(key);
   return fsync_dir(getParamPath());
 }
 
 std::string Params::get(const std::string &key, bool block) {
   if (!block) {
-    return util::read_file(getParamPath(key));
+    return cache ? cache->read(key) : util::read_file(getParamPath(key));
   } else {
     // blocking read until successful
     params_do_exit = 0;
@@ -456,10 +607,16 @@ std::string Params::get(const std::string &key, bool block) {
 
     std::string value;
     while (!params_do_exit) {
-      if (value = util::read_file(getParamPath(key)); !value.empty()) {
+      const uint32_t version = cache ? cache->version(key) : 0;
+      if (value = cache ? cache->read(key) : util::read_file(getParamPath(key)); !value.empty()) {
         break;
       }
-      util::sleep_for(100);  // 0.1 s
+      // wakes up when the value is written, the timeout catches signals and other writers
+      if (cache) {
+        cache->wait(key, version, 100);
+      } else {
+        util::sleep_for(100);  // 0.1 s
+      }
     }
 
     std::signal(SIGINT, prev_handler_sigint);
@@ -485,6 +642,7 @@ void Params::clearAll(ParamKeyType key_type) {
         auto it = keys.find(de->d_name);
         if (it == keys.end() || (it->second & key_type)) {
           unlink(getParamPath(de->d_name).c_str());
+          if (cache) cache->changed(de->d_name);
         }
       }
     }
@@ -495,18 +653,63 @@ void Params::clearAll(ParamKeyType key_type) {
 }
 
 void Params::putNonBlocking(const std::string &key, const std::string &val) {
-   queue.push(std::make_pair(key, val));
-  // start thread on demand
-  if (!future.valid() || future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+  // the writer that stopped may still be returning, it's joined after unlocking
+  std::future<void> stopped;
+  std::lock_guard lk(pending_lock);
+  ++queued;
+  auto [it, inserted] = pending.insert_or_assign(key, val);
+  if (!inserted) ++coalesced;
+
+  // start thread on demand. it only stops with the lock held and nothing pending, so no value is left behind
+  if (!writer_running) {
+    writer_running = true;
+    stopped = std::move(future);
     future = std::async(std::launch::async, &Params::asyncWriteThread, this);
   }
 }
 
+ParamsWriteStats Params::writeStats() const {
+  return {queued, written, coalesced, batches, fsyncs};
+}
+
 void Params::asyncWriteThread() {
-  // TODO: write the latest one if a key has multiple values in the queue.
-  std::pair<std::string, std::string> p;
-  while (queue.try_pop(p, 0)) {
-    // Params::put is Thread-Safe
-    put(p.first, p.second);
+  // everything queued while a batch is written goes into the next batch
+  while (true) {
+    std::map<std::string, std::string> batch;
+    {
+      std::lock_guard lk(pending_lock);
+      if (pending.empty()) {
+        writer_running = false;
+        return;
+      }
+      batch.swap(pending);
+    }
+
+    // the values are persisted first, then moved into place together
+    std::vector<std::pair<const std::string *, std::string>> tmp_files;
+    for (const auto &[key, value] : batch) {
+      std::string tmp_path;
+      if (writeTmpFile(value.data(), value.size(), tmp_path) == 0) {
+        tmp_files.push_back({&key, tmp_path});
+      } else {
+        LOGE("Failed to write param %s, errno=%d", key.c_str(), errno);
+        if (!tmp_path.empty()) ::unlink(tmp_path.c_str());
+      }
+    }
+    if (tmp_files.empty()) continue;
+
+    FileLock file_lock(params_path + "/.lock");
+    for (const auto &[key, tmp_path] : tmp_files) {
+      if (rename(tmp_path.c_str(), getParamPath(*key).c_str()) == 0) {
+        if (cache) cache->changed(*key);
+        ++written;
+      } else {
+        LOGE("Failed to write param %s, errno=%d", key->c_str(), errno);
+        ::unlink(tmp_path.c_str());
+      }
+    }
+    fsync_dir(getParamPath());
+    ++fsyncs;
+    ++batches;
   }
 }
@@ -1,14 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <future>
 #include <map>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
 
-#include "common/queue.h"
-
 enum ParamKeyType {
   PERSISTENT = 0x02,
   CLEAR_ON_MANAGER_START = 0x04,
@@ -20,6 +20,16 @@ enum ParamKeyType {
   ALL = 0xFFFFFFFF
 };
 
+class ParamsCache;
+
+struct ParamsWriteStats {
+  uint64_t queued = 0;     // putNonBlocking calls
+  uint64_t written = 0;    // values written by the async writer
+  uint64_t coalesced = 0;  // values replaced by a newer one before they were written, i.e. writes saved
+  uint64_t batches = 0;    // groups of values written under one lock with one directory fsync
+  uint64_t fsyncs = 0;     // of values and directories, by put() and the async writer
+};
+
 class Params {
 public:
   explicit Params(const std::string &path = {});
@@ -39,7 +49,8 @@ public:
   int remove(const std::string &key);
   void clearAll(ParamKeyType type);
 
-  // helpers for reading values
+  // helpers for reading values. values are cached per process until they're written again,
+  // blocking reads wake up as soon as the value is written
   std::string get(const std::string &key, bool block = false);
   inline bool getBool(const std::string &key, bool block = false) {
     return get(key, block) == "1";
@@ -54,18 +65,28 @@ public:
   inline int putBool(const std::string &key, bool val) {
     return put(key.c_str(), val ? "1" : "0", 1);
   }
+  // only the latest value of a key is written, values queued together are written as a batch.
+  // a batch is moved into place in key order, so the values of different keys may appear in another
+  // order than they were queued in
   void putNonBlocking(const std::string &key, const std::string &val);
   inline void putBoolNonBlocking(const std::string &key, bool val) {
     putNonBlocking(key, val ? "1" : "0");
   }
+  ParamsWriteStats writeStats() const;
 
 private:
+  int writeTmpFile(const char *value, size_t value_size, std::string &tmp_path);
   void asyncWriteThread();
 
   std::string params_path;
   std::string params_prefix;
+  // shared by all Params of the process on the same directory, nullptr if the directory can't be cached
+  ParamsCache *cache = nullptr;
 
-  // for nonblocking write
+  // for nonblocking write, the latest value of each key that isn't written yet
   std::future<void> future;
-  SafeQueue<std::pair<std::string, std::string>> queue;
+  std::mutex pending_lock;
+  std::map<std::string, std::string> pending;
+  bool writer_running = false;
+  std::atomic<uint64_t> queued = 0, written = 0, coalesced = 0, batches = 0, fsyncs = 0;
 };
@@ -4,17 +4,120 @@
 
 #include "common/swaglog.h"
 
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstring>
 #include <limits>
 #include <mutex>
+#include <new>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <zmq.h>
 #include <stdarg.h>
 #include "third_party/json11/json11.hpp"
+#include "common/util.h"
 #include "common/version.h"
 #include "system/hardware/hw.h"
 
+namespace {
+
+// Single producer, single consumer ring of length prefixed log lines, one per logging thread.
+// Records wrap around the end of the buffer.
+class LogRing {
+public:
+  static constexpr size_t CAPACITY = 64 * 1024;
+
+  // false if there is no room right now
+  bool push(const std::string &line) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const uint32_t size = line.size();
+    if (tail + sizeof(size) + size - head_.load(std::memory_order_acquire) > CAPACITY) return false;
+
+    copyIn(tail, &size, sizeof(size));
+    copyIn(tail + sizeof(size), line.data(), size);
+    tail_.store(tail + sizeof(size) + size, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(std::string &line) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+
+    uint32_t size;
+    copyOut(head, &size, sizeof(size));
+    line.resize(size);
+    copyOut(head + sizeof(size), line.data(), size);
+    head_.store(head + sizeof(size) + size, std::memory_order_release);
+    return true;
+  }
+
+  inline size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+
+  std::atomic<bool> closed = false;  // the thread exited, the ring is freed once it's drained
+
+private:
+  void copyIn(size_t pos, const void *src, size_t size) {
+    const size_t offset = pos % CAPACITY, first = std::min(size, CAPACITY - offset);
+    memcpy(buf_ + offset, src, first);
+    memcpy(buf_, (const char *)src + first, size - first);
+  }
+  void copyOut(size_t pos, void *dst, size_t size) const {
+    const size_t offset = pos % CAPACITY, first = std::min(size, CAPACITY - offset);
+    memcpy(dst, buf_ + offset, first);
+    memcpy((char *)dst + first, buf_, size - first);
+  }
+
+  char buf_[CAPACITY];
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) std::atomic<size_t> tail_ = 0;
+};
+
+// same escaping as json11
+void append_json_string(std::string &out, const char *s) {
+  out += '"';
+  for (const char *p = s; *p; ++p) {
+    const uint8_t ch = *p;
+    if (ch == '\\') {
+      out += "\\\\";
+    } else if (ch == '"') {
+      out += "\\\"";
+    } else if (ch == '\b') {
+      out += "\\b";
+    } else if (ch == '\f') {
+      out += "\\f";
+    } else if (ch == '\n') {
+      out += "\\n";
+    } else if (ch == '\r') {
+      out += "\\r";
+    } else if (ch == '\t') {
+      out += "\\t";
+    } else if (ch <= 0x1f) {
+      char buf[8];
+      snprintf(buf, sizeof buf, "\\u%04x", ch);
+      out += buf;
+    } else if (ch == 0xe2 && (uint8_t)p[1] == 0x80 && ((uint8_t)p[2] == 0xa8 || (uint8_t)p[2] == 0xa9)) {
+      out += (uint8_t)p[2] == 0xa8 ? "\\u2028" : "\\u2029";
+      p += 2;
+    } else {
+      out += *p;
+    }
+  }
+  out += '"';
+}
+
+}  // namespace
+
+// Log lines are formatted by the calling thread into thread local buffers and queued in the thread's ring,
+// a background thread sends them every SEND_INTERVAL_MS. The caller sends warnings and errors itself, after
+// the lines it queued before, and also sends if its ring is full, after exit() started, or in a forked child.
+// Queued debug and info lines are lost if the process crashes before they're sent.
 class SwaglogState {
 public:
   SwaglogState() {
@@ -37,7 +140,7 @@ public:
       }
     }
 
-    ctx_j = json11::Json::object{};
+    json11::Json::object ctx_j = json11::Json::object{};
     if (char* dongle_id = getenv("DONGLE_ID")) {
       ctx_j["dongle_id"] = dongle_id;
     }
@@ -56,83 +159,230 @@ public:
     ctx_j["version"] = COMMA_VERSION;
     ctx_j["dirty"] = !getenv("CLEAN");
     ctx_j["device"] = Hardware::get_name();
+    // the context never changes, it's serialized once
+    ctx_s = ((json11::Json)ctx_j).dump();
+
+    if (!getenv("SWAGLOG_SYNC")) {
+      threaded = true;
+      sender = std::thread(&SwaglogState::senderThread, this);
+      pthread_atfork(nullptr, nullptr, [] {
+        // the child has no sender thread, and the parent's may have held any of the locks at the fork
+        SwaglogState &s = instance();
+        s.threaded = false;
+        new (&s.lock) std::mutex();
+        new (&s.rings_lock) std::mutex();
+        new (&s.wake_lock) std::mutex();
+        new (&s.wake) std::condition_variable();
+        new (&s.sender) std::thread();
+      });
+      std::atexit([] { instance().stop(); });
+    }
   }
 
-  ~SwaglogState() {
-    zmq_close(sock);
-    zmq_ctx_destroy(zctx);
+  // never destroyed, so threads can log while the process exits
+  static SwaglogState &instance() {
+    static SwaglogState *s = new SwaglogState();
+    return *s;
   }
 
-  void log(int levelnum, const char* filename, int lineno, const char* func, const char* msg, const std::string& log_s) {
-    std::lock_guard lk(lock);
+  void log(int levelnum, const char* filename, const char* msg, const std::string& log_s) {
     if (levelnum >= print_level) {
       printf("%s: %s\n", filename, msg);
     }
-    zmq_send(sock, log_s.data(), log_s.length(), ZMQ_NOBLOCK);
+
+    if (threaded) {
+      thread_local RingHolder holder;
+      if (!holder.ring) {
+        holder.ring = new LogRing();
+        std::lock_guard lk(rings_lock);
+        rings.push_back(holder.ring);
+      }
+      // warnings and errors are sent right away, the process may crash next
+      if (levelnum < CLOUDLOG_WARNING && holder.ring->push(log_s)) {
+        // the sender drains the rings periodically, it's only woken up if the ring fills up
+        if (holder.ring->size() > LogRing::CAPACITY / 2 && sender_sleeping.exchange(false)) {
+          std::lock_guard lk(wake_lock);
+          wake.notify_one();
+        }
+        return;
+      }
+
+      // after the lines this thread queued before
+      std::lock_guard lk(lock);
+      sendRing(holder.ring);
+      send(log_s);
+      return;
+    }
+
+    std::lock_guard lk(lock);
+    send(log_s);
+  }
+
+  std::string ctx_s;
+  int print_level;
+
+private:
+  static constexpr int SEND_INTERVAL_MS = 20;
+
+  struct RingHolder {
+    LogRing *ring = nullptr;
+    ~RingHolder() {
+      if (ring) ring->closed = true;
+      ring = nullptr;
+    }
+  };
+
+  // with lock held. the logging thread drains its own ring too, so the rings are only popped under it
+  void sendRing(LogRing *ring) {
+    while (ring->pop(ring_line)) {
+      send(ring_line);
+    }
+  }
+
+  // with lock held
+  void send(const std::string &line) {
+    if (sock) {
+      zmq_send(sock, line.data(), line.length(), ZMQ_NOBLOCK);
+    }
+  }
+
+  void senderThread() {
+    util::set_thread_name("swaglog");
+    std::vector<LogRing *> current;
+    while (true) {
+      {
+        std::lock_guard lk(rings_lock);
+        current = rings;
+      }
+
+      for (LogRing *ring : current) {
+        const bool closed = ring->closed;
+        {
+          std::lock_guard lk(lock);
+          sendRing(ring);
+        }
+        if (closed) {
+          std::lock_guard lk(rings_lock);
+          rings.erase(std::find(rings.begin(), rings.end(), ring));
+          delete ring;
+        }
+      }
+      if (exiting) break;
+
+      std::unique_lock lk(wake_lock);
+      sender_sleeping = true;
+      if (!exiting) wake.wait_for(lk, std::chrono::milliseconds(SEND_INTERVAL_MS));
+      sender_sleeping = false;
+    }
+  }
+
+  void stop() {
+    // lines queued from now on are sent right away, the sender drains the rings once more
+    threaded = false;
+    {
+      std::lock_guard lk(wake_lock);
+      exiting = true;
+      wake.notify_one();
+    }
+    if (sender.joinable()) sender.join();
+
+    std::lock_guard lk(lock);
+    zmq_close(sock);
+    zmq_ctx_destroy(zctx);
+    sock = nullptr;
   }
 
-  std::mutex lock;
+  std::mutex lock;  // for the socket, and popping the rings
+  std::string ring_line;
   void* zctx = nullptr;
   void* sock = nullptr;
-  int print_level;
-  json11::Json::object ctx_j;
+
+  std::atomic<bool> threaded = false;
+  std::thread sender;
+  std::mutex rings_lock;
+  std::vector<LogRing *> rings;
+  std::mutex wake_lock;
+  std::condition_variable wake;
+  std::atomic<bool> sender_sleeping = false;
+  std::atomic<bool> exiting = false;
 };
 
 bool LOG_TIMESTAMPS = getenv("LOG_TIMESTAMPS");
 uint32_t NO_FRAME_ID = std::numeric_limits<uint32_t>::max();
 
-static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
-                            char* msg_buf, const json11::Json::object &msg_j={}) {
-  static SwaglogState s;
-
-  json11::Json::object log_j = json11::Json::object {
-    {"ctx", s.ctx_j},
-    {"levelnum", levelnum},
-    {"filename", filename},
-    {"lineno", lineno},
-    {"funcname", func},
-    {"created", seconds_since_epoch()}
-  };
-  if (msg_j.empty()) {
-    log_j["msg"] = msg_buf;
-  } else {
-    log_j["msg"] = msg_j;
+// the message is formatted into a thread local buffer, which only grows for longer messages
+static const char *format_msg(const char *fmt, va_list args) {
+  thread_local std::vector<char> msg_buf(1024);
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int ret = vsnprintf(msg_buf.data(), msg_buf.size(), fmt, args);
+  if (ret >= (int)msg_buf.size()) {
+    msg_buf.resize(ret + 1);
+    ret = vsnprintf(msg_buf.data(), msg_buf.size(), fmt, args_copy);
   }
+  va_end(args_copy);
+  return ret > 0 ? msg_buf.data() : nullptr;
+}
+
+// builds the same JSON as json11 would, with the keys in order. msg_json is a JSON value, otherwise msg is a string
+static void cloudlog_common(int levelnum, const char* filename, int lineno, const char* func,
+                            const char* msg, const char *msg_json = nullptr) {
+  SwaglogState &s = SwaglogState::instance();
 
-  std::string log_s;
+  thread_local std::string log_s;
+  char buf[64];
+  log_s.clear();
   log_s += (char)levelnum;
-  ((json11::Json)log_j).dump(log_s);
-  s.log(levelnum, filename, lineno, func, msg_buf, log_s);
+  // seconds since epoch, formatting the integer parts is much cheaper than a double
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  snprintf(buf, sizeof(buf), "{\"created\": %lld.%09ld, \"ctx\": ", (long long)t.tv_sec, (long)t.tv_nsec);
+  log_s += buf;
+  log_s += s.ctx_s;
+  log_s += ", \"filename\": ";
+  append_json_string(log_s, filename);
+  log_s += ", \"funcname\": ";
+  append_json_string(log_s, func);
+  snprintf(buf, sizeof(buf), ", \"levelnum\": %d, \"lineno\": %d, \"msg\": ", levelnum, lineno);
+  log_s += buf;
+  if (msg_json) {
+    log_s += msg_json;
+  } else {
+    append_json_string(log_s, msg);
+  }
+  log_s += '}';
 
-  free(msg_buf);
+  s.log(levelnum, filename, msg, log_s);
 }
 
 void cloudlog_e(int levelnum, const char* filename, int lineno, const char* func,
                 const char* fmt, ...) {
   va_list args;
   va_start(args, fmt);
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
+  const char *msg = format_msg(fmt, args);
   va_end(args);
-  if (ret <= 0 || !msg_buf) return;
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf);
+  if (!msg) return;
+  cloudlog_common(levelnum, filename, lineno, func, msg);
 }
 
 void cloudlog_t_common(int levelnum, const char* filename, int lineno, const char* func,
                        uint32_t frame_id, const char* fmt, va_list args) {
   if (!LOG_TIMESTAMPS) return;
-  char* msg_buf = nullptr;
-  int ret = vasprintf(&msg_buf, fmt, args);
-  if (ret <= 0 || !msg_buf) return;
-  json11::Json::object tspt_j = json11::Json::object{
-    {"event", msg_buf},
-    {"time", std::to_string(nanos_since_boot())}
-  };
+  const char *msg = format_msg(fmt, args);
+  if (!msg) return;
+
+  // {"timestamp": {"event": msg, "frame_id": "id", "time": "ns"}}
+  thread_local std::string tspt_s;
+  char buf[64];
+  tspt_s = "{\"timestamp\": {\"event\": ";
+  append_json_string(tspt_s, msg);
   if (frame_id < NO_FRAME_ID) {
-    tspt_j["frame_id"] = std::to_string(frame_id);
+    snprintf(buf, sizeof(buf), ", \"frame_id\": \"%u\"", frame_id);
+    tspt_s += buf;
   }
-  tspt_j = json11::Json::object{{"timestamp", tspt_j}};
-  cloudlog_common(levelnum, filename, lineno, func, msg_buf, tspt_j);
+  snprintf(buf, sizeof(buf), ", \"time\": \"%" PRIu64 "\"}}", nanos_since_boot());
+  tspt_s += buf;
+  cloudlog_common(levelnum, filename, lineno, func, msg, tspt_s.c_str());
 }
 
 
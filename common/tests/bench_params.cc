@@ -0,0 +1,76 @@
+// Benchmarks reading params through the cache against reading the files, and how fast a blocking
+// get wakes up after a put.
+//
+// usage: bench_params [iterations]
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/params.h"
+#include "common/timing.h"
+#include "common/util.h"
+
+static const std::vector<std::string> KEYS = {
+  "IsMetric", "IsOnroad", "IsOffroad", "DisengageOnAccelerator", "AlwaysOnDM", "DisableLogging", "DisableUpdates",
+  "DisablePowerDown", "TurnVisionControl", "VisionCurveLaneless", "VwCCOnly", "ControlsReady",
+};
+
+static std::string param_path;
+
+static void bench_get_bool(Params &params, int iterations) {
+  for (int i = 0; i < KEYS.size(); ++i) {
+    params.putBool(KEYS[i], i % 2);
+  }
+
+  auto run = [&](const char *name, auto get) {
+    int count = 0;
+    const double start = millis_since_boot();
+    for (int i = 0; i < iterations; ++i) {
+      for (const auto &key : KEYS) count += get(key);
+    }
+    const double ms = millis_since_boot() - start;
+    const double reads = (double)iterations * KEYS.size();
+    printf("%-24s %10.0f reads/s  %8.3f us/read  (%d true)\n", name, reads / ms * 1000, ms * 1000 / reads, count);
+  };
+  run("getBool (cache)", [&](const std::string &key) { return params.getBool(key); });
+  run("getBool (new Params)", [&](const std::string &key) { return Params(param_path).getBool(key); });
+  run("read_file", [&](const std::string &key) { return util::read_file(params.getParamPath(key)) == "1"; });
+}
+
+static void bench_wake(Params &params, int iterations) {
+  const std::string key = "CarVin";
+  std::vector<double> latency;
+  for (int i = 0; i < iterations; ++i) {
+    params.remove(key);
+    std::atomic<double> woken = 0;
+    std::thread waiter([&]() {
+      Params(param_path).get(key, true);
+      woken = millis_since_boot();
+    });
+    util::sleep_for(5);
+    const double put = millis_since_boot();
+    params.put(key, "vin");
+    waiter.join();
+    latency.push_back(woken - put);
+  }
+
+  std::sort(latency.begin(), latency.end());
+  printf("%-24s p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", "blocking get wake", latency[latency.size() / 2],
+         latency[latency.size() * 99 / 100], latency.back());
+}
+
+int main(int argc, char *argv[]) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+  char tmp_path[] = "/tmp/bench_params_XXXXXX";
+  param_path = mkdtemp(tmp_path);
+
+  Params params(param_path);
+  bench_get_bool(params, iterations);
+  bench_wake(params, std::max(10, iterations / 100));
+  return 0;
+}
@@ -0,0 +1,80 @@
+// Benchmarks the cost of a log line for the calling thread, with several threads logging at once.
+// Binds the swaglog socket itself, so don't run it next to logmessaged.
+// Run with SWAGLOG_SYNC=1 to compare against sending from the calling thread.
+//
+// usage: bench_swaglog [lines per thread]
+
+#include <zmq.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "common/swaglog.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "system/hardware/hw.h"
+
+static void bench(int num_threads, int lines) {
+  std::vector<std::vector<uint64_t>> latency(num_threads);
+  std::vector<std::thread> threads;
+  const uint64_t start = nanos_since_boot();
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      latency[t].reserve(lines);
+      for (int i = 0; i < lines; ++i) {
+        const uint64_t begin = nanos_since_boot();
+        LOGD("thread %d line %d value %.3f", t, i, i * 0.5);
+        latency[t].push_back(nanos_since_boot() - begin);
+        // about 1 kHz per thread, so the sender keeps up like it would in a real process
+        if (i % 10 == 0) util::sleep_for(10);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  const double seconds = (nanos_since_boot() - start) / 1e9;
+
+  std::vector<uint64_t> all;
+  for (auto &l : latency) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  double sum = 0;
+  for (auto v : all) sum += v;
+  printf("%2d threads: %8.0f ns/line  p50 %8.0f ns  p99 %8.0f ns  max %8.0f ns  (%.0f lines/s)\n", num_threads, sum / all.size(),
+         (double)all[all.size() / 2], (double)all[all.size() * 99 / 100], (double)all.back(), all.size() / seconds);
+}
+
+int main(int argc, char *argv[]) {
+  const int lines = argc > 1 ? atoi(argv[1]) : 5000;
+
+  void *zctx = zmq_ctx_new();
+  void *sock = zmq_socket(zctx, ZMQ_PULL);
+  zmq_bind(sock, Path::swaglog_ipc().c_str());
+  std::atomic<bool> exit = false;
+  std::atomic<uint64_t> received = 0;
+  std::thread receiver([&]() {
+    char buf[4096];
+    while (!exit) {
+      if (zmq_recv(sock, buf, sizeof(buf), ZMQ_DONTWAIT) > 0) {
+        ++received;
+      } else {
+        util::sleep_for(1);
+      }
+    }
+  });
+
+  printf("%s\n", getenv("SWAGLOG_SYNC") ? "sending from the calling thread" : "sending from the background thread");
+  for (int threads : {1, 4, 8}) {
+    bench(threads, lines);
+  }
+
+  util::sleep_for(500);
+  exit = true;
+  receiver.join();
+  printf("received %llu lines\n", (unsigned long long)received.load());
+  zmq_close(sock);
+  zmq_ctx_destroy(zctx);
+  return 0;
+}
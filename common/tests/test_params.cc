@@ -1,6 +1,11 @@
+#include <sys/wait.h>
+
+#include <thread>
+
 #include "catch2/catch.hpp"
 #define private public
 #include "common/params.h"
+#include "common/timing.h"
 #include "common/util.h"
 
 TEST_CASE("params_nonblocking_put") {
@@ -25,3 +30,96 @@ TEST_CASE("params_nonblocking_put") {
     REQUIRE(p.get(name) == "1");
   }
 }
+
+TEST_CASE("params_nonblocking_put_coalescing") {
+  char tmp_path[] = "/tmp/asyncWriter_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  const int num_threads = 4, puts = 1000;
+  // every thread has its own keys, and all of them write the shared one
+  const std::vector<std::string> own_keys = {"CarParams", "CarVin", "DongleId", "IsMetric"};
+  const std::string shared_key = "CarBatteryCapacity";
+
+  {
+    Params params(param_path);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+        for (int i = 0; i < puts; ++i) {
+          params.putNonBlocking(own_keys[t], std::to_string(i));
+          params.putNonBlocking(shared_key, std::to_string(t) + ":" + std::to_string(i));
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+    // the destructor waits for the writer
+  }
+
+  Params p(param_path);
+  for (int t = 0; t < num_threads; ++t) {
+    REQUIRE(p.get(own_keys[t]) == std::to_string(puts - 1));
+  }
+  const std::string shared = p.get(shared_key);
+  REQUIRE(shared.substr(shared.find(':') + 1) == std::to_string(puts - 1));
+}
+
+TEST_CASE("params_nonblocking_put_stats") {
+  char tmp_path[] = "/tmp/asyncWriter_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  const int num_threads = 4, puts = 1000;
+  Params params(param_path);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < puts; ++i) params.putNonBlocking("LastGPSPosition", std::to_string(i));
+    });
+  }
+  for (auto &t : threads) t.join();
+  params.future.wait();
+
+  auto stats = params.writeStats();
+  INFO("written " << stats.written << " coalesced " << stats.coalesced << " batches " << stats.batches << " fsyncs " << stats.fsyncs);
+  REQUIRE(stats.queued == num_threads * puts);
+  REQUIRE(stats.written + stats.coalesced == stats.queued);
+  REQUIRE(stats.coalesced > 0);
+  // one fsync per value and one per batch for the directory
+  REQUIRE(stats.fsyncs == stats.written + stats.batches);
+  REQUIRE(params.get("LastGPSPosition") == std::to_string(puts - 1));
+}
+
+TEST_CASE("params_cache") {
+  char tmp_path[] = "/tmp/paramsCache_XXXXXX";
+  const std::string param_path = mkdtemp(tmp_path);
+  Params writer(param_path), reader(param_path);
+  REQUIRE(reader.cache != nullptr);
+
+  SECTION("writes are seen right away") {
+    REQUIRE(reader.get("IsMetric").empty());
+    for (int i = 0; i < 10; ++i) {
+      REQUIRE(writer.putBool("IsMetric", i % 2) == 0);
+      REQUIRE(reader.getBool("IsMetric") == i % 2);
+    }
+    REQUIRE(writer.remove("IsMetric") == 0);
+    REQUIRE(reader.get("IsMetric").empty());
+  }
+  SECTION("writes from another process") {
+    REQUIRE(reader.get("CarVin").empty());
+    pid_t pid = fork();
+    if (pid == 0) {
+      util::sleep_for(20);
+      Params(param_path).put("CarVin", "vin");
+      _exit(0);
+    }
+    double start = millis_since_boot();
+    REQUIRE(reader.get("CarVin", true) == "vin");
+    // woken up by the write, not the 100 ms timeout
+    REQUIRE(millis_since_boot() - start < 90);
+    waitpid(pid, nullptr, 0);
+  }
+  SECTION("files written directly are picked up") {
+    REQUIRE(writer.put("DongleId", "a") == 0);
+    REQUIRE(reader.get("DongleId") == "a");
+    REQUIRE(util::write_file(writer.getParamPath("DongleId").c_str(), "b", 1, O_WRONLY | O_TRUNC) == 0);
+    util::sleep_for(1100);
+    REQUIRE(reader.get("DongleId") == "b");
+  }
+}
@@ -1,6 +1,7 @@
 #include <zmq.h>
 
 #include <iostream>
+#include <thread>
 
 #include "catch2/catch.hpp"
 #include "common/swaglog.h"
@@ -15,7 +16,7 @@ int LINE_NO = 0;
 
 void log_thread(int thread_id, int msg_cnt) {
   for (int i = 0; i < msg_cnt; ++i) {
-    LOGD("%d", thread_id);
+    LOGD("%d \"quoted\"\n\t", thread_id);
     LINE_NO = __LINE__ - 1;
     usleep(1);
   }
@@ -58,6 +59,7 @@ void recv_log(int thread_cnt, int thread_msg_cnt) {
     std::string device = Hardware::get_name();
     REQUIRE(ctx["device"].string_value() == device);
 
+    REQUIRE_THAT(msg["msg"].string_value(), Catch::EndsWith(" \"quoted\"\n\t"));
     int thread_id = atoi(msg["msg"].string_value().c_str());
     REQUIRE((thread_id >= 0 && thread_id < thread_cnt));
     thread_msgs[thread_id]++;
@@ -86,3 +88,49 @@ TEST_CASE("swaglog") {
 
   recv_log(thread_cnt, thread_msg_cnt);
 }
+
+TEST_CASE("swaglog keeps a thread's lines in order") {
+  void *zctx = zmq_ctx_new();
+  void *sock = zmq_socket(zctx, ZMQ_PULL);
+  zmq_bind(sock, Path::swaglog_ipc().c_str());
+
+  // more than the thread's ring holds, with warnings and errors in between that are sent right away
+  const int line_cnt = 5000;
+  std::thread log([&]() {
+    const std::string padding(200, 'x');
+    for (int i = 0; i < line_cnt; ++i) {
+      if (i % 100 == 99) {
+        LOGE("ordered %d", i);
+      } else if (i % 100 == 49) {
+        LOGW("ordered %d", i);
+      } else {
+        LOGD("ordered %d %s", i, padding.c_str());
+      }
+    }
+  });
+
+  int last = -1, received = 0;
+  char buf[4096];
+  for (auto start = std::chrono::steady_clock::now(); last < line_cnt - 1 && std::chrono::steady_clock::now() < start + std::chrono::seconds{2};) {
+    const int size = zmq_recv(sock, buf, sizeof(buf) - 1, ZMQ_DONTWAIT);
+    if (size <= 0) continue;
+
+    buf[size] = '\0';
+    std::string err;
+    auto msg = json11::Json::parse(buf + 1, err);
+    const std::string text = msg["msg"].string_value();
+    if (text.rfind("ordered ", 0) != 0) continue;
+
+    const int i = atoi(text.c_str() + 8);
+    REQUIRE(i > last);
+    const int levelnum = i % 100 == 99 ? CLOUDLOG_ERROR : (i % 100 == 49 ? CLOUDLOG_WARNING : CLOUDLOG_DEBUG);
+    REQUIRE(msg["levelnum"].int_value() == levelnum);
+    last = i;
+    ++received;
+  }
+  log.join();
+  REQUIRE(received > 0);
+
+  zmq_close(sock);
+  zmq_ctx_destroy(zctx);
+}
@@ -745,6 +745,7 @@ int Localizer::locationd_thread() {
 
   SubMaster sm(service_list, {}, nullptr, {gps_location_socket});
   PubMaster pm({"liveLocationKalman", "livePose"});
+  MessageArena location_arena, pose_arena;
 
   uint64_t cnt = 0;
   bool filterInitialized = false;
@@ -778,15 +779,11 @@ int Localizer::locationd_thread() {
         this->ttff = std::max(1e-3, (sm[trigger_msg].getLogMonoTime() * 1e-9) - this->first_valid_log_time);
       }
 
-      MessageBuilder location_msg_builder, pose_msg_builder;
+      MessageBuilder location_msg_builder(location_arena), pose_msg_builder(pose_arena);
       this->build_location_message(location_msg_builder, inputsOK, sensorsOK, gpsOK, filterInitialized);
       this->build_pose_message(pose_msg_builder, location_msg_builder, inputsOK, sensorsOK, filterInitialized);
 
-      kj::ArrayPtr<capnp::byte> location_bytes = location_msg_builder.toBytes();
-      pm.send("liveLocationKalman", location_bytes.begin(), location_bytes.size());
-
-      kj::ArrayPtr<capnp::byte> pose_bytes = pose_msg_builder.toBytes();
-      pm.send("livePose", pose_bytes.begin(), pose_bytes.size());
+      pm.sendMany({{"liveLocationKalman", &location_msg_builder}, {"livePose", &pose_msg_builder}});
 
       if (cnt % 1200 == 0 && gpsOK) {  // once a minute
         VectorXd posGeo = this->get_position_geodetic();
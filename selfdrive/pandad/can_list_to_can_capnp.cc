@@ -11,7 +11,7 @@ void can_list_to_can_capnp_cpp(const std::vector<can_frame> &can_list, std::stri
   for (auto it = can_list.begin(); it != can_list.end(); it++, j++) {
     auto c = canData[j];
     c.setAddress(it->address);
-    c.setDat(kj::arrayPtr((uint8_t*)it->dat.data(), it->dat.size()));
+    c.setDat(kj::arrayPtr(it->dat, it->len));
     c.setSrc(it->src);
   }
   const uint64_t msg_size = capnp::computeSerializedSizeInWords(msg) * sizeof(capnp::word);
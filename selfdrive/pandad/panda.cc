@@ -11,17 +11,21 @@
 #include "common/util.h"
 
 Panda::Panda(std::string serial, uint32_t bus_offset) : bus_offset(bus_offset) {
-  // try USB first, then SPI
-  try {
-    handle = std::make_unique<PandaUsbHandle>(serial);
-    LOGW("connected to %s over USB", serial.c_str());
-  } catch (std::exception &e) {
+  if (PandaSimHandle::enabled()) {
+    handle = std::make_unique<PandaSimHandle>(serial);
+  } else {
+    // try USB first, then SPI
+    try {
+      handle = std::make_unique<PandaUsbHandle>(serial);
+      LOGW("connected to %s over USB", serial.c_str());
+    } catch (std::exception &e) {
 #ifndef __APPLE__
-    handle = std::make_unique<PandaSpiHandle>(serial);
-    LOGW("connected to %s over SPI", serial.c_str());
+      handle = std::make_unique<PandaSpiHandle>(serial);
+      LOGW("connected to %s over SPI", serial.c_str());
 #else
-    throw e;
+      throw e;
 #endif
+    }
   }
 
   hw_type = get_hw_type();
@@ -41,6 +45,10 @@ std::string Panda::hw_serial() {
 }
 
 std::vector<std::string> Panda::list(bool usb_only) {
+  if (PandaSimHandle::enabled()) {
+    return PandaSimHandle::list();
+  }
+
   std::vector<std::string> serials = PandaUsbHandle::list();
 
 #ifndef __APPLE__
@@ -266,7 +274,8 @@ bool Panda::unpack_can_buffer(uint8_t *data, uint32_t &size, std::vector<can_fra
       canData.src += CAN_RETURNED_BUS_OFFSET;
     }
 
-    canData.dat.assign((char *)&data[pos + sizeof(can_header)], data_len);
+    canData.len = data_len;
+    memcpy(canData.dat, &data[pos + sizeof(can_header)], data_len);
 
     pos += sizeof(can_header) + data_len;
   }
@@ -36,10 +36,12 @@ struct __attribute__((packed)) can_header {
   uint8_t checksum : 8;
 };
 
+// fixed size so receiving into a reused std::vector doesn't allocate
 struct can_frame {
-  long address;
-  std::string dat;
-  long src;
+  uint32_t address;
+  uint16_t src;
+  uint8_t len;
+  uint8_t dat[64];  // largest CAN FD payload
 };
 
 
@@ -2,7 +2,9 @@
 
 #include <atomic>
 #include <cstdint>
+#include <functional>
 #include <mutex>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -91,3 +93,66 @@ private:
   uint32_t xfer_count = 0;
 };
 #endif
+
+struct PandaSimStats {
+  std::atomic<uint64_t> rx_frames = 0;   // queued for pandad
+  std::atomic<uint64_t> rx_dropped = 0;  // queue overflowed because pandad didn't read in time
+  std::atomic<uint64_t> tx_frames = 0;
+  std::atomic<uint64_t> tx_dropped = 0;  // injected transmit timeouts
+  std::atomic<uint64_t> faults = 0;      // injected checksum and usb errors
+};
+
+// Emulates pandas in-process, so pandad can run and be benchmarked without hardware. Enabled by
+// setting PANDAD_SIM to the number of pandas, see sim.cc for the other options.
+class PandaSimHandle : public PandaCommsHandle {
+public:
+  PandaSimHandle(std::string serial);
+  ~PandaSimHandle();
+  int control_write(uint8_t request, uint16_t param1, uint16_t param2, unsigned int timeout=TIMEOUT);
+  int control_read(uint8_t request, uint16_t param1, uint16_t param2, unsigned char *data, uint16_t length, unsigned int timeout=TIMEOUT);
+  int bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT);
+  int bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout=TIMEOUT);
+  void cleanup();
+
+  static bool enabled();
+  static std::vector<std::string> list();
+
+  // summed over all simulated pandas
+  inline static PandaSimStats stats;
+  // called for every frame pandad writes, with the time of the write
+  inline static std::function<void(uint32_t address, uint8_t bus, const uint8_t *dat, uint8_t len, uint64_t nanos)> on_tx;
+
+private:
+  struct TraceFrame {
+    uint64_t mono_time;
+    uint32_t address;
+    uint8_t bus;
+    uint8_t len;
+    uint8_t dat[64];
+  };
+
+  void loadTrace(const std::string &path);
+  void generate(uint64_t now);
+  void queueFrame(uint32_t address, uint8_t bus, const uint8_t *dat, uint8_t len, bool returned);
+
+  int index = 0;
+  bool canfd = false;
+  double rate = 0;
+  uint64_t start_time = 0;
+  uint64_t generated = 0;
+  uint64_t disconnect_time = 0;
+
+  std::vector<TraceFrame> trace;
+  size_t trace_pos = 0;
+  uint64_t trace_offset = 0;
+
+  std::string fw_signature;
+
+  std::mutex lock;
+  std::string rx_queue;
+  std::mt19937 rng;
+  uint16_t safety_model = 0, safety_param = 0, alternative_experience = 0, fan_speed = 0;
+  bool loopback = false, power_save = false;
+  uint32_t rx_overflows = 0;
+  uint32_t can_rx_cnt[3] = {}, can_tx_cnt[3] = {};
+};
@@ -201,10 +201,13 @@ void can_recv_thread(std::vector<Panda *> pandas) {
   util::set_thread_name("pandad_can_recv");
 
   PubMaster pm({"can"});
+  MessageArena arena(16 * 1024);
 
   // run at 100Hz
   RateKeeper rk("pandad_can_recv", 100);
+  // frames are fixed size and the vector keeps its capacity, so once warmed up a cycle doesn't allocate
   std::vector<can_frame> raw_can_data;
+  raw_can_data.reserve(256);
 
   while (!do_exit && check_all_connected(pandas)) {
     bool comms_healthy = true;
@@ -213,14 +216,15 @@ void can_recv_thread(std::vector<Panda *> pandas) {
       comms_healthy &= panda->can_receive(raw_can_data);
     }
 
-    MessageBuilder msg;
+    MessageBuilder msg(arena);
     auto evt = msg.initEvent();
     evt.setValid(comms_healthy);
     auto canData = evt.initCan(raw_can_data.size());
     for (uint i = 0; i<raw_can_data.size(); i++) {
-      canData[i].setAddress(raw_can_data[i].address);
-      canData[i].setDat(kj::arrayPtr((uint8_t*)raw_can_data[i].dat.data(), raw_can_data[i].dat.size()));
-      canData[i].setSrc(raw_can_data[i].src);
+      const can_frame &frame = raw_can_data[i];
+      canData[i].setAddress(frame.address);
+      canData[i].setDat(kj::arrayPtr(frame.dat, frame.len));
+      canData[i].setSrc(frame.src);
     }
     pm.send("can", msg);
 
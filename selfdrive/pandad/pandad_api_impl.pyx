@@ -4,13 +4,15 @@ from cython.operator cimport dereference as deref, preincrement as preinc
 from libcpp.vector cimport vector
 from libcpp.string cimport string
 from libcpp cimport bool
-from libc.stdint cimport uint8_t, uint32_t, uint64_t
+from libc.stdint cimport uint8_t, uint16_t, uint32_t, uint64_t
+from libc.string cimport memcpy
 
 cdef extern from "panda.h":
   cdef struct can_frame:
-    long address
-    string dat
-    long src
+    uint32_t address
+    uint16_t src
+    uint8_t len
+    uint8_t dat[64]
 
 cdef extern from "opendbc/can/common.h":
   cdef struct CanFrame:
@@ -29,13 +31,18 @@ cdef extern from "can_list_to_can_capnp.cc":
 def can_list_to_can_capnp(can_msgs, msgtype='can', valid=True):
   cdef can_frame *f
   cdef vector[can_frame] can_list
+  cdef bytes dat
 
   can_list.reserve(len(can_msgs))
   for can_msg in can_msgs:
+    dat = bytes(can_msg[1])
+    if len(dat) > sizeof(f.dat):
+      raise ValueError(f"CAN data too long: {len(dat)} bytes")
     f = &(can_list.emplace_back())
     f.address = can_msg[0]
-    f.dat = can_msg[1]
     f.src = can_msg[2]
+    f.len = len(dat)
+    memcpy(f.dat, <const char *>dat, f.len)
 
   cdef string out
   can_list_to_can_capnp_cpp(can_list, out, msgtype == 'sendcan', valid)
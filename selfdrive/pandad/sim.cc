@@ -0,0 +1,348 @@
+#include <zstd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "cereal/gen/cpp/log.capnp.h"
+#include "common/swaglog.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "selfdrive/pandad/panda.h"
+
+// Options, read from the environment:
+//   PANDAD_SIM                    number of pandas, named sim0, sim1, ...
+//   PANDAD_SIM_TRACE              rlog (raw or .zst) whose can messages are replayed in a loop, buses 0-3 go to sim0, 4-7 to sim1, ...
+//   PANDAD_SIM_RATE               frames/s per panda without a trace, default 3000
+//   PANDAD_SIM_CANFD              1 for red pandas sending 64 byte frames
+//   PANDAD_SIM_IGNITION           0 to run with the ignition off
+//   PANDAD_SIM_CHECKSUM_ERR_PROB  probability of a received frame having a bad checksum
+//   PANDAD_SIM_USB_ERR_PROB       probability of a bulk read overflowing, which makes the comms unhealthy
+//   PANDAD_SIM_TX_TIMEOUT_PROB    probability of a bulk write timing out, which drops its frames
+//   PANDAD_SIM_DISCONNECT         seconds until the pandas disconnect
+// pandad also checks the firmware, which passes if it's built, otherwise set BOARDD_SKIP_FW_CHECK.
+
+// received CAN data the panda buffers for the host
+constexpr size_t SIM_RX_QUEUE_SIZE = 0x1000 * (sizeof(can_header) + 8);
+
+struct SimFaults {
+  float checksum_err_prob;
+  float usb_err_prob;
+  float tx_timeout_prob;
+};
+
+static const SimFaults &sim_faults() {
+  static const SimFaults faults = {
+    util::getenv("PANDAD_SIM_CHECKSUM_ERR_PROB", 0.0f),
+    util::getenv("PANDAD_SIM_USB_ERR_PROB", 0.0f),
+    util::getenv("PANDAD_SIM_TX_TIMEOUT_PROB", 0.0f),
+  };
+  return faults;
+}
+
+static uint8_t len_to_dlc(uint8_t len) {
+  uint8_t dlc = 0;
+  while (dlc < std::size(dlc_to_len) - 1 && dlc_to_len[dlc] < len) ++dlc;
+  return dlc;
+}
+
+static std::string decompress_zst(const std::string &in) {
+  std::string out;
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  assert(dctx != nullptr);
+  std::string buf(ZSTD_DStreamOutSize(), '\0');
+  ZSTD_inBuffer input = {in.data(), in.size(), 0};
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output = {buf.data(), buf.size(), 0};
+    if (ZSTD_isError(ZSTD_decompressStream(dctx, &output, &input))) {
+      LOGE("failed to decompress trace");
+      break;
+    }
+    out.append(buf.data(), output.pos);
+  }
+  ZSTD_freeDCtx(dctx);
+  return out;
+}
+
+PandaSimHandle::PandaSimHandle(std::string serial) : PandaCommsHandle(serial) {
+  hw_serial = serial.empty() ? "sim0" : serial;
+  index = util::starts_with(hw_serial, "sim") ? atoi(hw_serial.c_str() + 3) : -1;
+  if (index < 0 || index >= util::getenv("PANDAD_SIM", 0)) {
+    throw std::runtime_error("Error connecting to panda");
+  }
+
+  canfd = util::getenv("PANDAD_SIM_CANFD", 0) != 0;
+  rate = util::getenv("PANDAD_SIM_RATE", 3000.0f);
+  rng.seed(index);
+  start_time = nanos_since_boot();
+  if (float seconds = util::getenv("PANDAD_SIM_DISCONNECT", 0.0f); seconds > 0) {
+    disconnect_time = start_time + seconds * 1e9;
+  }
+  if (std::string path = util::getenv("PANDAD_SIM_TRACE"); !path.empty()) {
+    loadTrace(path);
+  }
+
+  // report the firmware that's built, if any
+  std::string fw = util::read_file(std::string("../../panda/board/obj/") + (canfd ? "panda_h7.bin.signed" : "panda.bin.signed"));
+  fw_signature = fw.size() >= 128 ? fw.substr(fw.size() - 128) : std::string(128, '\0');
+  LOGW("simulating panda %s, %s", hw_serial.c_str(), trace.empty() ? util::string_format("%.0f frames/s", rate).c_str() : "replaying trace");
+}
+
+PandaSimHandle::~PandaSimHandle() {
+  connected = false;
+}
+
+void PandaSimHandle::cleanup() {}
+
+std::vector<std::string> PandaSimHandle::list() {
+  std::vector<std::string> serials;
+  for (int i = 0; i < util::getenv("PANDAD_SIM", 0); ++i) {
+    serials.push_back("sim" + std::to_string(i));
+  }
+  return serials;
+}
+
+bool PandaSimHandle::enabled() {
+  return util::getenv("PANDAD_SIM", 0) > 0;
+}
+
+void PandaSimHandle::loadTrace(const std::string &path) {
+  std::string data = util::read_file(path);
+  if (util::ends_with(path, ".zst")) {
+    data = decompress_zst(data);
+  }
+
+  kj::Array<capnp::word> buf = kj::heapArray<capnp::word>(data.size() / sizeof(capnp::word));
+  memcpy(buf.begin(), data.data(), buf.size() * sizeof(capnp::word));
+  kj::ArrayPtr<const capnp::word> words = buf;
+  try {
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      if (event.which() == cereal::Event::CAN) {
+        for (auto c : event.getCan()) {
+          // this panda's buses, which also skips frames the pandas returned or rejected
+          auto dat = c.getDat();
+          if (c.getSrc() / PANDA_BUS_OFFSET != index || dat.size() > 64) continue;
+
+          TraceFrame &f = trace.emplace_back();
+          f.mono_time = event.getLogMonoTime();
+          f.address = c.getAddress();
+          f.bus = c.getSrc() % PANDA_BUS_OFFSET;
+          f.len = dat.size();
+          memcpy(f.dat, dat.begin(), dat.size());
+        }
+      }
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } catch (const kj::Exception &e) {
+    LOGW("failed to read trace %s: %s", path.c_str(), e.getDescription().cStr());
+  }
+
+  std::stable_sort(trace.begin(), trace.end(), [](auto &a, auto &b) { return a.mono_time < b.mono_time; });
+  if (trace.empty()) {
+    LOGW("no CAN frames for panda %d in %s, generating them instead", index, path.c_str());
+  }
+}
+
+void PandaSimHandle::generate(uint64_t now) {
+  if (!trace.empty()) {
+    // replay with the timing of the trace, looping at the end
+    while (start_time + trace_offset + (trace[trace_pos].mono_time - trace[0].mono_time) <= now) {
+      const TraceFrame &f = trace[trace_pos];
+      queueFrame(f.address, f.bus, f.dat, f.len, false);
+      if (++trace_pos == trace.size()) {
+        trace_pos = 0;
+        trace_offset += trace.back().mono_time - trace[0].mono_time + 10'000'000;
+      }
+    }
+    return;
+  }
+
+  // round robin over 100 addresses on three buses, with a counter in the data
+  const uint64_t due = (now - start_time) * (rate / 1e9);
+  const uint64_t max_frames = SIM_RX_QUEUE_SIZE / sizeof(can_header);
+  if (due - generated > max_frames) {
+    // pandad stalled for long enough to overflow the queue anyway
+    stats.rx_dropped += due - generated - max_frames;
+    rx_overflows += due - generated - max_frames;
+    generated = due - max_frames;
+  }
+  uint8_t dat[64] = {};
+  for (; generated < due; ++generated) {
+    memcpy(dat, &generated, sizeof(generated));
+    queueFrame(0x100 + generated % 100, generated % 3, dat, canfd ? 64 : 8, false);
+  }
+}
+
+void PandaSimHandle::queueFrame(uint32_t address, uint8_t bus, const uint8_t *dat, uint8_t len, bool returned) {
+  const size_t size = sizeof(can_header) + len;
+  if (rx_queue.size() + size > SIM_RX_QUEUE_SIZE) {
+    ++rx_overflows;
+    ++stats.rx_dropped;
+    return;
+  }
+
+  uint8_t buf[sizeof(can_header) + 64];
+  can_header header = {};
+  header.addr = address;
+  header.extended = address >= 0x800;
+  header.bus = bus;
+  header.returned = returned;
+  header.data_len_code = len_to_dlc(len);
+  memcpy(buf, &header, sizeof(header));
+  memcpy(&buf[sizeof(header)], dat, len);
+
+  uint8_t checksum = 0;
+  for (size_t i = 0; i < size; ++i) checksum ^= buf[i];
+  if (sim_faults().checksum_err_prob > 0 && std::uniform_real_distribution<float>()(rng) < sim_faults().checksum_err_prob) {
+    checksum ^= 0xff;
+    ++stats.faults;
+  }
+  ((can_header *)buf)->checksum = checksum;
+  rx_queue.append((char *)buf, size);
+
+  if (!returned) {
+    ++stats.rx_frames;
+    if (bus < std::size(can_rx_cnt)) ++can_rx_cnt[bus];
+  }
+}
+
+int PandaSimHandle::bulk_read(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+  if (!connected || endpoint != 0x81) {
+    return 0;
+  }
+
+  const uint64_t now = nanos_since_boot();
+  if (disconnect_time > 0 && now >= disconnect_time) {
+    LOGE("simulated panda %s disconnected", hw_serial.c_str());
+    connected = false;
+    return 0;
+  }
+
+  std::lock_guard lk(lock);
+  if (sim_faults().usb_err_prob > 0 && std::uniform_real_distribution<float>()(rng) < sim_faults().usb_err_prob) {
+    LOGE_100("simulated overflow on panda %s", hw_serial.c_str());
+    comms_healthy = false;
+    ++stats.faults;
+    return 0;
+  }
+
+  generate(now);
+  // like USB, a transfer can end in the middle of a frame
+  const int n = std::min<size_t>(length, rx_queue.size());
+  memcpy(data, rx_queue.data(), n);
+  rx_queue.erase(0, n);
+  return n;
+}
+
+int PandaSimHandle::bulk_write(unsigned char endpoint, unsigned char* data, int length, unsigned int timeout) {
+  if (!connected) {
+    return 0;
+  }
+
+  const uint64_t now = nanos_since_boot();
+  std::lock_guard lk(lock);
+  const bool timed_out = sim_faults().tx_timeout_prob > 0 && std::uniform_real_distribution<float>()(rng) < sim_faults().tx_timeout_prob;
+  if (timed_out) {
+    LOGW("Transmit buffer full");
+    ++stats.faults;
+  }
+
+  int pos = 0;
+  while (pos + (int)sizeof(can_header) <= length) {
+    can_header header;
+    memcpy(&header, &data[pos], sizeof(header));
+    const uint8_t len = dlc_to_len[header.data_len_code];
+    if (pos + (int)sizeof(header) + len > length) break;
+
+    const uint8_t *dat = &data[pos + sizeof(header)];
+    pos += sizeof(header) + len;
+    if (timed_out) {
+      ++stats.tx_dropped;
+      continue;
+    }
+
+    ++stats.tx_frames;
+    if (header.bus < std::size(can_tx_cnt)) ++can_tx_cnt[header.bus];
+    if (on_tx) on_tx(header.addr, header.bus, dat, len, now);
+
+    // the panda returns what it sent on the bus, and receives it too in loopback mode
+    queueFrame(header.addr, header.bus, dat, len, true);
+    if (loopback) queueFrame(header.addr, header.bus, dat, len, false);
+  }
+  return timed_out ? 0 : pos;
+}
+
+int PandaSimHandle::control_write(uint8_t request, uint16_t param1, uint16_t param2, unsigned int timeout) {
+  if (!connected) {
+    return -1;
+  }
+
+  std::lock_guard lk(lock);
+  switch (request) {
+    case 0xdc: safety_model = param1; safety_param = param2; break;
+    case 0xdf: alternative_experience = param1; break;
+    case 0xe5: loopback = param1; break;
+    case 0xe7: power_save = param1; break;
+    case 0xb1: fan_speed = param1; break;
+    case 0xc0: rx_queue.clear(); break;  // reset communications
+  }
+  return 0;
+}
+
+int PandaSimHandle::control_read(uint8_t request, uint16_t param1, uint16_t param2, unsigned char *data, uint16_t length, unsigned int timeout) {
+  if (!connected) {
+    return -1;
+  }
+
+  auto copy = [&](const void *src, size_t size) {
+    size = std::min<size_t>(size, length);
+    memcpy(data, src, size);
+    return (int)size;
+  };
+
+  std::lock_guard lk(lock);
+  switch (request) {
+    case 0xc1: {
+      const uint8_t hw_type = (uint8_t)(canfd ? cereal::PandaState::PandaType::RED_PANDA : cereal::PandaState::PandaType::DOS);
+      return copy(&hw_type, sizeof(hw_type));
+    }
+    case 0xd0:
+      return copy(hw_serial.c_str(), hw_serial.size() + 1);
+    case 0xb2: {
+      const uint16_t rpm = fan_speed * 65;
+      return copy(&rpm, sizeof(rpm));
+    }
+    case 0xd3:
+    case 0xd4:
+      return copy(fw_signature.data() + (request == 0xd3 ? 0 : 64), 64);
+    case 0xd2: {
+      health_t health = {};
+      health.uptime_pkt = (nanos_since_boot() - start_time) / 1e9;
+      health.voltage_pkt = 12000;
+      health.ignition_line_pkt = util::getenv("PANDAD_SIM_IGNITION", 1) != 0;
+      health.safety_mode_pkt = safety_model;
+      health.safety_param_pkt = safety_param;
+      health.alternative_experience_pkt = alternative_experience;
+      health.power_save_enabled_pkt = power_save;
+      health.rx_buffer_overflow_pkt = rx_overflows;
+      health.car_harness_status_pkt = 1;
+      health.fan_power = fan_speed;
+      return copy(&health, sizeof(health));
+    }
+    case 0xc2: {
+      can_health_t can_health = {};
+      if (param1 < std::size(can_rx_cnt)) {
+        can_health.total_rx_cnt = can_rx_cnt[param1];
+        can_health.total_tx_cnt = can_tx_cnt[param1];
+        can_health.can_speed = 5000;
+        can_health.can_data_speed = canfd ? 20000 : 5000;
+        can_health.canfd_enabled = canfd;
+      }
+      return copy(&can_health, sizeof(can_health));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Runs pandad end to end against simulated pandas, while publishing sendcan and receiving can.
+// Reports can throughput, the latency from publishing sendcan to the panda bulk write, and drops.
+// The PANDAD_SIM_* options in sim.cc set the bus load and faults, e.g.
+//   PANDAD_SIM=2 PANDAD_SIM_RATE=8000 PANDAD_SIM_CHECKSUM_ERR_PROB=1e-5 bench_pandad 20
+//
+// usage: bench_pandad [seconds] [sendcan frames per message]
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "selfdrive/pandad/pandad.h"
+
+extern ExitHandler do_exit;
+
+int main(int argc, char *argv[]) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 10;
+  const int sendcan_frames = argc > 2 ? atoi(argv[2]) : 10;
+  setenv("PANDAD_SIM", "1", 0);
+  setenv("BOARDD_SKIP_FW_CHECK", "1", 0);
+
+  // the bench stamps each sendcan frame with the time it's published
+  std::mutex latency_lock;
+  std::vector<uint64_t> latency;
+  PandaSimHandle::on_tx = [&](uint32_t address, uint8_t bus, const uint8_t *dat, uint8_t len, uint64_t nanos) {
+    if (len < sizeof(uint64_t)) return;
+    uint64_t sent;
+    memcpy(&sent, dat, sizeof(sent));
+    std::lock_guard lk(latency_lock);
+    latency.push_back(nanos - sent);
+  };
+
+  std::unique_ptr<Context> context(Context::create());
+  std::unique_ptr<SubSocket> can_sock(SubSocket::create(context.get(), "can"));
+  assert(can_sock != nullptr);
+  can_sock->setTimeout(100);
+  PubMaster pm({"sendcan"});
+
+  std::thread pandad(pandad_main_thread, std::vector<std::string>{});
+
+  std::atomic<bool> exit = false;
+  std::atomic<uint64_t> can_msgs = 0, can_frames = 0, returned_frames = 0, invalid_msgs = 0;
+  std::thread receiver([&]() {
+    AlignedBuffer aligned_buf;
+    while (!exit) {
+      std::unique_ptr<Message> msg(can_sock->receive());
+      if (!msg) continue;
+
+      capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg.get()));
+      auto event = cmsg.getRoot<cereal::Event>();
+      ++can_msgs;
+      invalid_msgs += !event.getValid();
+      for (auto c : event.getCan()) {
+        ++(c.getSrc() >= CAN_RETURNED_BUS_OFFSET ? returned_frames : can_frames);
+      }
+    }
+  });
+
+  // sendcan at 100Hz, like controlsd
+  uint64_t sendcan_sent = 0;
+  const double start = millis_since_boot();
+  while (millis_since_boot() - start < seconds * 1000 && !do_exit) {
+    MessageBuilder msg;
+    auto can_list = msg.initEvent().initSendcan(sendcan_frames);
+    const uint64_t now = nanos_since_boot();
+    for (int i = 0; i < sendcan_frames; ++i) {
+      can_list[i].setAddress(0x200 + i);
+      can_list[i].setSrc(0);
+      can_list[i].setDat(kj::arrayPtr((const uint8_t *)&now, sizeof(now)));
+    }
+    pm.send("sendcan", msg);
+    sendcan_sent += sendcan_frames;
+    util::sleep_for(10);
+  }
+  const double elapsed = (millis_since_boot() - start) / 1000.0;
+
+  // let pandad drain what's in flight
+  util::sleep_for(200);
+  do_exit = true;
+  pandad.join();
+  exit = true;
+  receiver.join();
+
+  auto &stats = PandaSimHandle::stats;
+  printf("can:     %8.0f msgs/s  %10.0f frames/s  (%llu returned frames, %llu invalid msgs)\n", can_msgs / elapsed, can_frames / elapsed,
+         (unsigned long long)returned_frames.load(), (unsigned long long)invalid_msgs.load());
+  printf("panda:   %10llu frames queued  %llu dropped by the panda  %llu faults injected\n",
+         (unsigned long long)stats.rx_frames.load(), (unsigned long long)stats.rx_dropped.load(), (unsigned long long)stats.faults.load());
+  printf("sendcan: %10llu frames sent  %llu written  %llu dropped\n", (unsigned long long)sendcan_sent,
+         (unsigned long long)stats.tx_frames.load(), (unsigned long long)(sendcan_sent - stats.tx_frames));
+
+  std::lock_guard lk(latency_lock);
+  if (!latency.empty()) {
+    std::sort(latency.begin(), latency.end());
+    printf("sendcan to bulk_write: p50 %.1f us  p99 %.1f us  max %.1f us\n", latency[latency.size() / 2] / 1e3,
+           latency[latency.size() * 99 / 100] / 1e3, latency.back() / 1e3);
+  }
+  return 0;
+}
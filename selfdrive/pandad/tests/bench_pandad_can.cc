@@ -0,0 +1,98 @@
+// Benchmarks the pandad CAN receive path: unpacking synthetic bulk reads into frames and
+// building the can event from them, like can_recv_thread does every cycle.
+//
+// usage: bench_pandad_can [cycles]
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+#include "common/timing.h"
+#include "selfdrive/pandad/panda.h"
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct PandaBench : public Panda {
+  PandaBench() : Panda(0) {}
+  void bench(const char *name, int frames_per_cycle, uint8_t data_len, int cycles);
+};
+
+void PandaBench::bench(const char *name, int frames_per_cycle, uint8_t data_len, int cycles) {
+  // the bulk read a panda would return for one cycle
+  std::string bulk;
+  {
+    MessageBuilder msg;
+    auto can_list = msg.initEvent().initSendcan(frames_per_cycle);
+    std::string dat(data_len, '\xab');
+    for (int i = 0; i < frames_per_cycle; ++i) {
+      can_list[i].setAddress(0x100 + i);
+      can_list[i].setSrc(i % 3);
+      can_list[i].setDat(kj::arrayPtr((uint8_t *)dat.data(), dat.size()));
+    }
+    pack_can_buffer(can_list.asReader(), [&](uint8_t *chunk, size_t size) { bulk.append((char *)chunk, size); });
+  }
+  assert(bulk.size() <= RECV_SIZE);
+
+  MessageArena arena(16 * 1024);
+  std::vector<can_frame> frames;
+  frames.reserve(256);
+  uint64_t total_frames = 0, total_bytes = 0;
+
+  auto cycle = [&]() {
+    frames.clear();
+    memcpy(&receive_buffer[receive_buffer_size], bulk.data(), bulk.size());
+    receive_buffer_size += bulk.size();
+    bool ret = unpack_can_buffer(receive_buffer, receive_buffer_size, frames);
+    assert(ret && frames.size() == frames_per_cycle);
+
+    MessageBuilder msg(arena);
+    auto canData = msg.initEvent().initCan(frames.size());
+    for (uint i = 0; i < frames.size(); i++) {
+      canData[i].setAddress(frames[i].address);
+      canData[i].setDat(kj::arrayPtr(frames[i].dat, frames[i].len));
+      canData[i].setSrc(frames[i].src);
+    }
+    total_bytes += msg.toBytes().size();
+    total_frames += frames.size();
+  };
+
+  // warm up, so the arena and frame vector have grown to size
+  for (int i = 0; i < 10; ++i) cycle();
+
+  total_frames = total_bytes = 0;
+  const uint64_t allocs_start = allocations;
+  const double start = millis_since_boot();
+  for (int i = 0; i < cycles; ++i) cycle();
+  const double seconds = (millis_since_boot() - start) / 1000.0;
+
+  printf("%-12s %4d frames/cycle: %10.0f frames/s  %6.2f us/cycle  %.2f allocations/cycle  (%.0f bytes/event)\n",
+         name, frames_per_cycle, total_frames / seconds, seconds * 1e6 / cycles,
+         double(allocations - allocs_start) / cycles, double(total_bytes) / cycles);
+}
+
+int main(int argc, char *argv[]) {
+  const int cycles = argc > 1 ? atoi(argv[1]) : 20000;
+
+  PandaBench panda;
+  for (int frames : {50, 200, 800}) {
+    panda.bench("CAN 2.0", frames, 8, cycles);
+  }
+  for (int frames : {50, 200}) {
+    panda.bench("CAN FD", frames, 64, cycles);
+  }
+  return 0;
+}
@@ -945,12 +945,13 @@ void CameraState::set_camera_exposure(float grey_frac) {
 
 void CameraState::run() {
   util::set_thread_name(publish_name);
+  MessageArena arena;
 
   for (uint32_t cnt = 0; !do_exit; ++cnt) {
     // Acquire the buffer; continue if acquisition fails
     if (!buf.acquire()) continue;
 
-    MessageBuilder msg;
+    MessageBuilder msg(arena);
     auto framed = (msg.initEvent().*init_camera_state)();
     fill_frame_data(framed, buf.cur_frame_data, this);
 
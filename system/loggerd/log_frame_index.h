@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// rlog.zst and qlog.zst end with an index of their zstd frames, so readers can decompress only the
+// frames covering a time range or a set of services. Every frame starts at a message boundary.
+// The index is stored in a zstd skippable frame, which standard decoders ignore:
+//   u32 skippable magic, u32 size, LogFrameIndexEntry[count], LogFrameIndexFooter
+// all integers are little endian. Readers find the footer in the last bytes of the file.
+constexpr uint32_t LOG_FRAME_INDEX_SKIPPABLE_MAGIC = 0x184D2A5E;
+constexpr uint32_t LOG_FRAME_INDEX_MAGIC = 0x58444952;  // "RIDX"
+constexpr uint32_t LOG_FRAME_INDEX_VERSION = 1;
+
+struct LogFrameIndexEntry {
+  uint64_t offset;  // of the compressed frame in the file
+  uint32_t compressed_size;
+  uint32_t uncompressed_size;
+  uint64_t begin_mono_time;
+  uint64_t end_mono_time;
+  uint64_t which[4];  // bitmap of the cereal::Event::Which in the frame, bit 255 is set for anything above
+
+  inline void add(uint16_t w) { w = w < 255 ? w : 255; which[w / 64] |= 1ull << (w % 64); }
+  inline bool has(uint16_t w) const { w = w < 255 ? w : 255; return (which[w / 64] >> (w % 64)) & 1; }
+};
+static_assert(sizeof(LogFrameIndexEntry) == 64);
+
+struct LogFrameIndexFooter {
+  uint32_t count;
+  uint32_t entry_size;
+  uint32_t version;
+  uint32_t magic;
+};
+
+// parses the index from the tail of a log. returns false without an index, or if the tail is too short
+// to hold it, in which case required_size is the number of bytes to read from the end of the file
+inline bool parseLogFrameIndex(const std::string &tail, std::vector<LogFrameIndexEntry> &entries, size_t *required_size = nullptr) {
+  LogFrameIndexFooter footer;
+  if (tail.size() < sizeof(footer)) return false;
+
+  memcpy(&footer, tail.data() + tail.size() - sizeof(footer), sizeof(footer));
+  if (footer.magic != LOG_FRAME_INDEX_MAGIC || footer.version != LOG_FRAME_INDEX_VERSION ||
+      footer.entry_size != sizeof(LogFrameIndexEntry) || footer.count == 0) {
+    return false;
+  }
+  const size_t size = footer.count * sizeof(LogFrameIndexEntry) + sizeof(footer);
+  if (tail.size() < size) {
+    if (required_size) *required_size = size;
+    return false;
+  }
+
+  entries.resize(footer.count);
+  memcpy(entries.data(), tail.data() + tail.size() - size, footer.count * sizeof(LogFrameIndexEntry));
+  return true;
+}
@@ -1,5 +1,7 @@
 #include "system/loggerd/logger.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <map>
 #include <vector>
@@ -9,6 +11,7 @@
 
 #include "common/params.h"
 #include "common/swaglog.h"
+#include "common/timing.h"
 #include "common/version.h"
 
 // ***** log metadata *****
@@ -135,6 +138,166 @@ std::string logger_get_identifier(std::string key) {
   return util::string_format("%08x--%s", cnt, ss.str().c_str());
 }
 
+// ***** background writer *****
+
+LogQueue::LogQueue(size_t capacity) : buf_(capacity / sizeof(Record)), capacity_(buf_.size() * sizeof(Record)) {}
+
+bool LogQueue::push(uint32_t op, const void *data, size_t size) {
+  const size_t record_size = recordSize(size);
+  assert(record_size <= capacity_ / 2);
+
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  const size_t offset = tail % capacity_;
+  const size_t pad = capacity_ - offset < record_size ? capacity_ - offset : 0;
+  if (tail + pad + record_size - head_.load(std::memory_order_acquire) > capacity_) return false;
+
+  uint8_t *base = (uint8_t *)buf_.data();
+  if (pad > 0) {
+    ((Record *)(base + offset))->op = SKIP;
+  }
+  Record *record = (Record *)(base + (offset + pad) % capacity_);
+  record->size = size;
+  record->op = op;
+  record->queued_ns = nanos_since_boot();
+  if (size > 0) memcpy(record + 1, data, size);
+  tail_.store(tail + pad + record_size, std::memory_order_release);
+  return true;
+}
+
+const LogQueue::Record *LogQueue::front() {
+  size_t head = head_.load(std::memory_order_relaxed);
+  while (head != tail_.load(std::memory_order_acquire)) {
+    const Record *record = (const Record *)((uint8_t *)buf_.data() + head % capacity_);
+    if (record->op != SKIP) return record;
+
+    head += capacity_ - head % capacity_;
+    head_.store(head, std::memory_order_release);
+  }
+  return nullptr;
+}
+
+void LogQueue::pop() {
+  const size_t head = head_.load(std::memory_order_relaxed);
+  const Record *record = (const Record *)((uint8_t *)buf_.data() + head % capacity_);
+  head_.store(head + recordSize(record->size), std::memory_order_release);
+}
+
+LogWriter::LogWriter(size_t queue_size) : queue_(queue_size) {
+  thread_ = std::thread(&LogWriter::writerThread, this);
+}
+
+LogWriter::~LogWriter() {
+  exit_ = true;
+  thread_.join();
+}
+
+void LogWriter::open(const std::string &segment_path) {
+  push(LogQueue::OPEN, segment_path.data(), segment_path.size());
+}
+
+void LogWriter::write(const uint8_t *data, size_t size, bool in_qlog) {
+  push(LogQueue::WRITE_RLOG | (in_qlog ? LogQueue::WRITE_QLOG : 0), data, size);
+}
+
+void LogWriter::close(const std::string &lock_file) {
+  push(LogQueue::CLOSE, lock_file.data(), lock_file.size());
+}
+
+void LogWriter::flush() {
+  const int flushes = flushes_;
+  push(LogQueue::FLUSH, nullptr, 0);
+  while (flushes_ == flushes) {
+    util::sleep_for(1);
+  }
+}
+
+void LogWriter::push(uint32_t op, const void *data, size_t size) {
+  if (!queue_.push(op, data, size)) {
+    // never drop a message, wait for the disk to catch up instead
+    if (full_waits_++ % 100 == 0) {
+      LOGW("log queue full, %zu bytes queued", queue_.size());
+    }
+    while (!queue_.push(op, data, size)) {
+      util::sleep_for(1);
+    }
+  }
+  max_queue_bytes_ = std::max(max_queue_bytes_.load(), queue_.size());
+}
+
+LogWriterStats LogWriter::stats() const {
+  LogWriterStats stats;
+  stats.queue_bytes = queue_.size();
+  stats.max_queue_bytes = max_queue_bytes_;
+  stats.bytes_in = bytes_in_;
+  stats.bytes_out = bytes_out_;
+  stats.avg_latency_ms = written_ > 0 ? latency_ns_ / 1e6 / written_ : 0;
+  stats.max_latency_ms = max_latency_ns_ / 1e6;
+  stats.full_waits = full_waits_;
+  return stats;
+}
+
+// the frame index needs the time and type of every message, unreadable ones keep the previous time
+static void event_info(const uint8_t *data, size_t size, uint64_t &mono_time, uint16_t &which) {
+  try {
+    capnp::FlatArrayMessageReader reader(kj::arrayPtr((const capnp::word *)data, size / sizeof(capnp::word)));
+    auto event = reader.getRoot<cereal::Event>();
+    mono_time = event.getLogMonoTime();
+    which = (uint16_t)event.which();
+  } catch (const kj::Exception &e) {
+    which = UINT16_MAX;
+  }
+}
+
+void LogWriter::writerThread() {
+  util::set_thread_name("loggerd_writer");
+
+  uint64_t mono_time = 0;
+  uint16_t which = 0;
+  while (true) {
+    // check for exit before the queue, so nothing queued before the exit is left behind
+    const bool exiting = exit_;
+    const LogQueue::Record *record = queue_.front();
+    if (!record) {
+      if (exiting) break;
+      util::sleep_for(5);
+      continue;
+    }
+
+    if (record->op == LogQueue::OPEN) {
+      const std::string segment_path((const char *)record->data(), record->size);
+      rlog_.reset(new ZstdFileWriter(segment_path + "/rlog.zst"));
+      // the qlog is small and read whole, cutting it every second would only cost compression
+      qlog_.reset(new ZstdFileWriter(segment_path + "/qlog.zst", 0));
+    } else if (record->op == LogQueue::CLOSE) {
+      rlog_.reset();
+      qlog_.reset();
+      std::remove(std::string((const char *)record->data(), record->size).c_str());
+    } else if (record->op == LogQueue::FLUSH) {
+      if (rlog_) bytes_out_ += rlog_->flush() + qlog_->flush();
+      ++flushes_;
+    } else {
+      event_info(record->data(), record->size, mono_time, which);
+      size_t out = rlog_->write(record->data(), record->size, mono_time, which);
+      bytes_in_ += record->size;
+      if (record->op & LogQueue::WRITE_QLOG) {
+        out += qlog_->write(record->data(), record->size, mono_time, which);
+        bytes_in_ += record->size;
+      }
+      bytes_out_ += out;
+
+      const uint64_t latency = nanos_since_boot() - record->queued_ns;
+      latency_ns_ += latency;
+      max_latency_ns_ = std::max(max_latency_ns_.load(), latency);
+      ++written_;
+    }
+    queue_.pop();
+  }
+  rlog_.reset();
+  qlog_.reset();
+}
+
+// ***** logger *****
+
 static void log_sentinel(LoggerState *log, SentinelType type, int exit_signal = 0) {
   MessageBuilder msg;
   auto sen = msg.initEvent().initSentinel();
@@ -150,28 +313,26 @@ LoggerState::LoggerState(const std::string &log_root) {
 }
 
 LoggerState::~LoggerState() {
-  if (rlog) {
+  if (part >= 0) {
     log_sentinel(this, SentinelType::END_OF_ROUTE, exit_signal);
-    std::remove(lock_file.c_str());
+    writer.close(lock_file);
   }
 }
 
 bool LoggerState::next() {
-  if (rlog) {
+  if (part >= 0) {
     log_sentinel(this, SentinelType::END_OF_SEGMENT);
-    std::remove(lock_file.c_str());
+    writer.close(lock_file);
   }
 
   segment_path = route_path + "--" + std::to_string(++part);
   bool ret = util::create_directories(segment_path, 0775);
   assert(ret == true);
 
-  const std::string rlog_path = segment_path + "/rlog";
-  lock_file = rlog_path + ".lock";
+  lock_file = segment_path + "/rlog.lock";
   std::ofstream{lock_file};
 
-  rlog.reset(new RawFile(rlog_path));
-  qlog.reset(new RawFile(segment_path + "/qlog"));
+  writer.open(segment_path);
 
   // log init data & sentinel type.
   write(init_data.asBytes(), true);
@@ -180,6 +341,5 @@ bool LoggerState::next() {
 }
 
 void LoggerState::write(uint8_t* data, size_t size, bool in_qlog) {
-  rlog->write(data, size);
-  if (in_qlog) qlog->write(data, size);
+  writer.write(data, size, in_qlog);
 }
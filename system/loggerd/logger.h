@@ -1,12 +1,19 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "cereal/messaging/messaging.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
+#include "system/loggerd/zstd_writer.h"
+
+// about 30 s of rlog and qlog at the normal log bandwidth
+constexpr size_t LOG_QUEUE_SIZE = 64 * 1024 * 1024;
 
 class RawFile {
  public:
@@ -29,6 +36,76 @@ class RawFile {
   FILE* file = nullptr;
 };
 
+// Single producer, single consumer queue of variable sized records in a ring buffer.
+// A record that doesn't fit before the end of the buffer starts over at the beginning.
+class LogQueue {
+public:
+  enum Op : uint32_t { WRITE_RLOG = 1, WRITE_QLOG = 2, OPEN = 4, CLOSE = 8, FLUSH = 16, SKIP = 32 };
+  struct Record {
+    uint32_t size;
+    uint32_t op;
+    uint64_t queued_ns;
+    inline const uint8_t *data() const { return (const uint8_t *)(this + 1); }
+  };
+
+  LogQueue(size_t capacity);
+  // false if there is no room for the record right now
+  bool push(uint32_t op, const void *data, size_t size);
+  // the oldest record, valid until pop(). nullptr if the queue is empty
+  const Record *front();
+  void pop();
+  inline size_t size() const { return tail_ - head_; }
+  inline size_t capacity() const { return capacity_; }
+
+private:
+  static inline size_t recordSize(size_t size) { return sizeof(Record) + ((size + sizeof(Record) - 1) & ~(sizeof(Record) - 1)); }
+
+  std::vector<Record> buf_;  // in units of a record header, so records stay aligned
+  const size_t capacity_;
+  alignas(64) std::atomic<size_t> head_ = 0;  // advanced by the consumer
+  alignas(64) std::atomic<size_t> tail_ = 0;  // advanced by the producer
+};
+
+struct LogWriterStats {
+  size_t queue_bytes = 0;       // queued and not written yet
+  size_t max_queue_bytes = 0;
+  uint64_t bytes_in = 0;        // uncompressed, rlog and qlog
+  uint64_t bytes_out = 0;       // compressed, written to the files
+  double avg_latency_ms = 0;    // from queueing a message until it's written
+  double max_latency_ms = 0;
+  uint64_t full_waits = 0;      // writes that waited for room in the queue
+};
+
+// Compresses and writes the rlog and qlog on a dedicated thread. Messages are copied into a bounded
+// lock-free queue, so the poll loop never waits for the disk unless the queue is full.
+class LogWriter {
+public:
+  LogWriter(size_t queue_size = LOG_QUEUE_SIZE);
+  // writes everything that is queued
+  ~LogWriter();
+  void open(const std::string &segment_path);
+  void write(const uint8_t *data, size_t size, bool in_qlog);
+  // the lock file is removed once the logs are complete
+  void close(const std::string &lock_file);
+  // waits until everything queued is written to the files
+  void flush();
+  LogWriterStats stats() const;
+
+private:
+  void push(uint32_t op, const void *data, size_t size);
+  void writerThread();
+
+  LogQueue queue_;
+  std::thread thread_;
+  std::atomic<bool> exit_ = false;
+  std::atomic<int> flushes_ = 0;
+  std::atomic<uint64_t> bytes_in_ = 0, bytes_out_ = 0, written_ = 0, latency_ns_ = 0, max_latency_ns_ = 0;
+  std::atomic<uint64_t> full_waits_ = 0;
+  std::atomic<size_t> max_queue_bytes_ = 0;
+  // only used by the writer thread
+  std::unique_ptr<ZstdFileWriter> rlog_, qlog_;
+};
+
 typedef cereal::Sentinel::SentinelType SentinelType;
 
 
@@ -43,12 +120,14 @@ public:
   inline const std::string& routeName() const { return route_name; }
   inline void write(kj::ArrayPtr<kj::byte> bytes, bool in_qlog) { write(bytes.begin(), bytes.size(), in_qlog); }
   inline void setExitSignal(int signal) { exit_signal = signal; }
+  inline LogWriterStats stats() const { return writer.stats(); }
+  inline void flush() { writer.flush(); }
 
 protected:
   int part = -1, exit_signal = 0;
   std::string route_path, route_name, segment_path, lock_file;
   kj::Array<capnp::word> init_data;
-  std::unique_ptr<RawFile> rlog, qlog;
+  LogWriter writer;
 };
 
 kj::Array<capnp::word> logger_build_init_data();
@@ -273,7 +273,11 @@ void loggerd_thread() {
 
         if ((++msg_count % 1000) == 0) {
           double seconds = (millis_since_boot() - start_ts) / 1000.0;
-          LOGD("%" PRIu64 " messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count / seconds, bytes_count * 0.001 / seconds);
+          auto stats = s.logger.stats();
+          LOGD("%" PRIu64 " messages, %.2f msg/sec, %.2f KB/sec, written %.2f KB/sec", msg_count, msg_count / seconds,
+               bytes_count * 0.001 / seconds, stats.bytes_out * 0.001 / seconds);
+          LOGD("log queue %zu KB (max %zu KB), write latency %.2f ms (max %.2f ms), %" PRIu64 " full waits",
+               stats.queue_bytes / 1024, stats.max_queue_bytes / 1024, stats.avg_latency_ms, stats.max_latency_ms, stats.full_waits);
         }
 
         count++;
@@ -290,6 +294,7 @@ void loggerd_thread() {
 
   if (do_exit.power_failure) {
     LOGE("power failure");
+    s.logger.flush();
     sync();
     LOGE("sync done");
   }
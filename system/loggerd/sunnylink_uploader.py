@@ -9,6 +9,7 @@ import threading
 import time
 import traceback
 import datetime
+import zstandard as zstd
 from typing import BinaryIO
 from collections.abc import Iterator
 
@@ -86,7 +87,7 @@ class Uploader:
     self.last_filename = ""
 
     self.immediate_folders = ["crash/", "boot/"]
-    self.immediate_priority = {"qlog": 0, "qlog.bz2": 0, "qcamera.ts": 1}
+    self.immediate_priority = {"qlog": 0, "qlog.zst": 0, "qcamera.ts": 1}
 
   def list_upload_files(self, metered: bool) -> Iterator[tuple[str, str, str]]:
     r = self.params.get("AthenadRecentlyViewedRoutes", encoding="utf8")
@@ -156,8 +157,12 @@ class Uploader:
     with open(fn, "rb") as f:
       data: BinaryIO
       if key.endswith('.bz2') and not fn.endswith('.bz2'):
-        compressed = bz2.compress(f.read())
-        data = io.BytesIO(compressed)
+        # the sunnylink backend takes bz2 logs, loggerd writes them as zstd
+        content = f.read()
+        if fn.endswith('.zst'):
+          with zstd.ZstdDecompressor().stream_reader(content, read_across_frames=True) as reader:
+            content = reader.read()
+        data = io.BytesIO(bz2.compress(content))
       else:
         data = f
 
@@ -223,7 +228,8 @@ class Uploader:
 
     name, key, fn = d
 
-    # qlogs and bootlogs need to be compressed before uploading
+    # qlogs and bootlogs are uploaded as bz2
+    key = key.removesuffix('.zst')
     if key.endswith(('qlog', 'rlog')) or (key.startswith('boot/') and not key.endswith('.bz2')):
       key += ".bz2"
 
@@ -1,18 +1,70 @@
+#include <zstd.h>
+
+#include <algorithm>
+
 #include "catch2/catch.hpp"
+#include "common/timing.h"
 #include "system/loggerd/logger.h"
 
 typedef cereal::Sentinel::SentinelType SentinelType;
 
+// the logs are written as a sequence of zstd frames
+std::string read_log(const std::string &log_file) {
+  const std::string compressed = util::read_file(log_file);
+  std::string log;
+  ZSTD_DCtx *dctx = ZSTD_createDCtx();
+  ZSTD_inBuffer in = {compressed.data(), compressed.size(), 0};
+  std::vector<char> out_buf(ZSTD_DStreamOutSize());
+  while (in.pos < in.size) {
+    ZSTD_outBuffer out = {out_buf.data(), out_buf.size(), 0};
+    size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+    REQUIRE(!ZSTD_isError(ret));
+    log.append(out_buf.data(), out.pos);
+  }
+  ZSTD_freeDCtx(dctx);
+  return log;
+}
+
+// every frame in the index decompresses on its own into whole messages of its time range and types
+size_t verify_frame_index(const std::string &log_file, uint64_t frame_duration_ns) {
+  const std::string compressed = util::read_file(log_file);
+  std::vector<LogFrameIndexEntry> frames;
+  REQUIRE(parseLogFrameIndex(compressed, frames));
+
+  uint64_t offset = 0;
+  for (const auto &f : frames) {
+    REQUIRE(f.offset == offset);
+    offset += f.compressed_size;
+    if (frame_duration_ns > 0) REQUIRE(f.end_mono_time - f.begin_mono_time < frame_duration_ns);
+
+    std::string frame(f.uncompressed_size, '\0');
+    REQUIRE(ZSTD_decompress(frame.data(), frame.size(), compressed.data() + f.offset, f.compressed_size) == f.uncompressed_size);
+    kj::ArrayPtr<const capnp::word> words((capnp::word *)frame.data(), frame.size() / sizeof(capnp::word));
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      REQUIRE(f.has(event.which()));
+      REQUIRE(event.getLogMonoTime() >= f.begin_mono_time);
+      REQUIRE(event.getLogMonoTime() <= f.end_mono_time);
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  }
+  // followed only by the index
+  REQUIRE(compressed.size() == offset + 8 + frames.size() * sizeof(LogFrameIndexEntry) + sizeof(LogFrameIndexFooter));
+  return frames.size();
+}
+
 void verify_segment(const std::string &route_path, int segment, int max_segment, int required_event_cnt) {
   const std::string segment_path = route_path + "--" + std::to_string(segment);
   SentinelType begin_sentinel = segment == 0 ? SentinelType::START_OF_ROUTE : SentinelType::START_OF_SEGMENT;
   SentinelType end_sentinel = segment == max_segment - 1 ? SentinelType::END_OF_ROUTE : SentinelType::END_OF_SEGMENT;
 
   REQUIRE(!util::file_exists(segment_path + "/rlog.lock"));
-  for (const char *fn : {"/rlog", "/qlog"}) {
+  for (const char *fn : {"/rlog.zst", "/qlog.zst"}) {
     const std::string log_file = segment_path + fn;
-    std::string log = util::read_file(log_file);
+    std::string log = read_log(log_file);
     REQUIRE(!log.empty());
+    verify_frame_index(log_file, std::string(fn) == "/rlog.zst" ? LOG_FRAME_DURATION_NS : 0);
     int event_cnt = 0, i = 0;
     kj::ArrayPtr<const capnp::word> words((capnp::word *)log.data(), log.size() / sizeof(capnp::word));
     while (words.size() > 0) {
@@ -72,3 +124,58 @@ TEST_CASE("logger") {
     verify_segment(log_root + "/" + route_name, i, segment_cnt, 1);
   }
 }
+
+TEST_CASE("logger high rate") {
+  // several times the normal rlog bandwidth of about 2 MB/s, the writer thread must keep up without dropping anything
+  const double rate_bytes_per_sec = 10 * 1024 * 1024;
+  const double seconds = 3;
+  const std::string log_root = "/tmp/test_logger_high_rate";
+  system(("rm " + log_root + " -rf").c_str());
+
+  MessageBuilder msg;
+  auto can = msg.initEvent().initCan(50);
+  for (int i = 0; i < can.size(); ++i) {
+    can[i].setAddress(0x100 + i);
+    can[i].setDat(kj::heapArray<capnp::byte>(8).asPtr());
+  }
+  auto bytes = msg.toBytes();
+
+  std::string segment_path;
+  LogWriterStats stats;
+  uint64_t count = 0;
+  double max_write_ms = 0;
+  {
+    LoggerState logger(log_root);
+    REQUIRE(logger.next());
+    segment_path = logger.segmentPath();
+    const double start = millis_since_boot();
+    for (double elapsed = 0; elapsed < seconds * 1000; elapsed = millis_since_boot() - start) {
+      // publish in bursts of 10 ms, like a poll loop draining its sockets
+      while (count * bytes.size() < rate_bytes_per_sec * elapsed / 1000) {
+        double write_start = millis_since_boot();
+        logger.write(bytes, count % 10 == 0);
+        max_write_ms = std::max(max_write_ms, millis_since_boot() - write_start);
+        ++count;
+      }
+      util::sleep_for(10);
+    }
+    logger.flush();
+    stats = logger.stats();
+  }
+
+  INFO("queue max " << stats.max_queue_bytes << " bytes, latency avg " << stats.avg_latency_ms << " ms max " << stats.max_latency_ms
+       << " ms, compression " << (double)stats.bytes_in / stats.bytes_out << "x, longest write " << max_write_ms << " ms");
+  REQUIRE(stats.full_waits == 0);
+  REQUIRE(verify_frame_index(segment_path + "/rlog.zst", LOG_FRAME_DURATION_NS) >= seconds);
+  REQUIRE(verify_frame_index(segment_path + "/qlog.zst", 0) >= 1);
+
+  std::string log = read_log(segment_path + "/rlog.zst");
+  kj::ArrayPtr<const capnp::word> words((capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+  uint64_t can_count = 0;
+  while (words.size() > 0) {
+    capnp::FlatArrayMessageReader reader(words);
+    can_count += reader.getRoot<cereal::Event>().which() == cereal::Event::CAN;
+    words = kj::arrayPtr(reader.getEnd(), words.end());
+  }
+  REQUIRE(can_count == count);
+}
@@ -0,0 +1,52 @@
+import bz2
+import zstandard as zstd
+
+import openpilot.system.loggerd.sunnylink_uploader as sunnylink_uploader
+from openpilot.system.hardware.hw import Paths
+from openpilot.system.loggerd.sunnylink_uploader import NetworkType, UPLOAD_ATTR_NAME, UPLOAD_ATTR_VALUE
+from openpilot.system.loggerd.tests.loggerd_tests_common import MockApi, UploaderTestCase
+from openpilot.system.loggerd.xattr_cache import setxattr
+
+
+class TestSunnylinkUploader(UploaderTestCase):
+  def setup_method(self):
+    super().setup_method()
+    sunnylink_uploader.SunnylinkApi = MockApi
+    self.uploader = sunnylink_uploader.Uploader("0000000000000000", Paths.log_root())
+
+  def upload_all(self, mocker) -> list[str]:
+    keys = []
+    def upload(name, key, fn, network_type, metered):
+      keys.append(key)
+      setxattr(fn, UPLOAD_ATTR_NAME, UPLOAD_ATTR_VALUE)
+      return True
+    mocker.patch.object(self.uploader, "upload", side_effect=upload)
+    while self.uploader.step(NetworkType.wifi, False) is not None:
+      pass
+    return keys
+
+  def test_zst_qlog_uploaded_first(self, mocker):
+    for t in ["rlog.zst", "fcamera.hevc", "qlog.zst"]:
+      self.make_file_with_data(self.seg_dir, t)
+
+    assert self.upload_all(mocker) == [f"{self.seg_dir}/qlog.bz2"]
+
+  def test_logs_uploaded_as_bz2(self, mocker):
+    self.make_file_with_data(self.seg_dir, "qlog")
+    self.make_file_with_data("boot", self.seg_dir)
+
+    assert self.upload_all(mocker) == [f"boot/{self.seg_dir}.bz2", f"{self.seg_dir}/qlog.bz2"]
+
+  def test_recompress_logs_as_bz2(self, mocker):
+    mocker.patch.object(sunnylink_uploader, "fake_upload", False)
+    sent = []
+    mocker.patch.object(sunnylink_uploader.requests, "put", side_effect=lambda url, data, **kwargs: sent.append(data.read()))
+
+    raw = self.make_file_with_data(self.seg_dir, "qlog").read_bytes()
+    # loggerd writes independent zstd frames
+    zst = self.make_file_with_data(self.seg_dir, "rlog.zst")
+    zst.write_bytes(zstd.compress(raw[:len(raw) // 2]) + zstd.compress(raw[len(raw) // 2:]))
+
+    self.uploader.do_upload(f"{self.seg_dir}/qlog.bz2", str(zst.with_name("qlog")))
+    self.uploader.do_upload(f"{self.seg_dir}/rlog.bz2", str(zst))
+    assert [bz2.decompress(d) for d in sent] == [raw, raw]
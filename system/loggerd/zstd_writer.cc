@@ -0,0 +1,95 @@
+#include "system/loggerd/zstd_writer.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "common/util.h"
+
+ZstdFileWriter::ZstdFileWriter(const std::string &path, uint64_t frame_duration_ns, int level) : frame_duration_ns(frame_duration_ns) {
+  file = util::safe_fopen(path.c_str(), "wb");
+  assert(file != nullptr);
+  cctx = ZSTD_createCCtx();
+  assert(cctx != nullptr);
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+  out_buf.resize(ZSTD_CStreamOutSize());
+}
+
+ZstdFileWriter::~ZstdFileWriter() {
+  endFrame();
+  writeIndex();
+  ZSTD_freeCCtx(cctx);
+  util::safe_fflush(file);
+  int err = fclose(file);
+  assert(err == 0);
+}
+
+size_t ZstdFileWriter::write(const void *data, size_t size, uint64_t mono_time, uint16_t which) {
+  // messages are roughly in time order, a frame covers about frame_duration_ns of the log
+  size_t written = 0;
+  if (frame_duration_ns > 0 && frame.uncompressed_size > 0 && mono_time >= frame.begin_mono_time + frame_duration_ns) {
+    written += endFrame();
+  }
+  if (frame.uncompressed_size == 0) {
+    frame.offset = file_size;
+    frame.begin_mono_time = frame.end_mono_time = mono_time;
+  }
+  frame.begin_mono_time = std::min(frame.begin_mono_time, mono_time);
+  frame.end_mono_time = std::max(frame.end_mono_time, mono_time);
+  frame.add(which);
+
+  ZSTD_inBuffer in = {data, size, 0};
+  written += compress(in, ZSTD_e_continue);
+  frame.uncompressed_size += size;
+  if (frame.uncompressed_size >= LOG_FRAME_SIZE) {
+    written += endFrame();
+  }
+  return written;
+}
+
+size_t ZstdFileWriter::endFrame() {
+  if (frame.uncompressed_size == 0) return 0;
+
+  ZSTD_inBuffer in = {nullptr, 0, 0};
+  size_t written = compress(in, ZSTD_e_end);
+  frame.compressed_size = file_size - frame.offset;
+  index.push_back(frame);
+  frame = {};
+  return written;
+}
+
+size_t ZstdFileWriter::flush() {
+  ZSTD_inBuffer in = {nullptr, 0, 0};
+  size_t written = compress(in, ZSTD_e_flush);
+  util::safe_fflush(file);
+  return written;
+}
+
+size_t ZstdFileWriter::compress(ZSTD_inBuffer &in, ZSTD_EndDirective mode) {
+  size_t written = 0;
+  bool finished = false;
+  while (!finished) {
+    ZSTD_outBuffer out = {out_buf.data(), out_buf.size(), 0};
+    size_t remaining = ZSTD_compressStream2(cctx, &out, &in, mode);
+    assert(!ZSTD_isError(remaining));
+
+    size_t n = util::safe_fwrite(out_buf.data(), 1, out.pos, file);
+    assert(n == out.pos);
+    written += out.pos;
+    file_size += out.pos;
+    // continue until all input is consumed, or the frame/flush is complete
+    finished = mode == ZSTD_e_continue ? in.pos == in.size : remaining == 0;
+  }
+  return written;
+}
+
+void ZstdFileWriter::writeIndex() {
+  if (index.empty()) return;
+
+  const LogFrameIndexFooter footer = {(uint32_t)index.size(), sizeof(LogFrameIndexEntry), LOG_FRAME_INDEX_VERSION, LOG_FRAME_INDEX_MAGIC};
+  const uint32_t header[] = {LOG_FRAME_INDEX_SKIPPABLE_MAGIC, (uint32_t)(index.size() * sizeof(LogFrameIndexEntry) + sizeof(footer))};
+  size_t n = util::safe_fwrite(header, 1, sizeof(header), file);
+  n += util::safe_fwrite(index.data(), 1, index.size() * sizeof(LogFrameIndexEntry), file);
+  n += util::safe_fwrite(&footer, 1, sizeof(footer), file);
+  assert(n == sizeof(header) + header[1]);
+  file_size += n;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <zstd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "system/loggerd/log_frame_index.h"
+
+constexpr int LOG_COMPRESSION_LEVEL = 10;  // same as the uploader
+// a frame ends after this much log time or uncompressed data, readers can start decompressing at any frame.
+// the duration is per writer, logs that are read whole can be cut by size only
+constexpr uint64_t LOG_FRAME_DURATION_NS = 1e9;
+constexpr size_t LOG_FRAME_SIZE = 1024 * 1024;
+
+// Compresses messages into a file as a sequence of independent zstd frames, followed by an index of
+// the frames when the file is closed. Frames only end between messages.
+class ZstdFileWriter {
+public:
+  // frames are not cut by time when frame_duration_ns is 0
+  ZstdFileWriter(const std::string &path, uint64_t frame_duration_ns = LOG_FRAME_DURATION_NS, int level = LOG_COMPRESSION_LEVEL);
+  ~ZstdFileWriter();
+  // returns the number of compressed bytes written to the file
+  size_t write(const void *data, size_t size, uint64_t mono_time, uint16_t which);
+  size_t endFrame();
+  // everything written so far is compressed and handed to the kernel
+  size_t flush();
+
+private:
+  size_t compress(ZSTD_inBuffer &in, ZSTD_EndDirective mode);
+  void writeIndex();
+
+  const uint64_t frame_duration_ns;
+  FILE *file = nullptr;
+  ZSTD_CCtx *cctx = nullptr;
+  std::vector<char> out_buf;
+  uint64_t file_size = 0;
+  LogFrameIndexEntry frame = {};
+  std::vector<LogFrameIndexEntry> index;
+};
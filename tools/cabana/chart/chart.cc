@@ -1,6 +1,7 @@
 #include "tools/cabana/chart/chart.h"
 
 #include <algorithm>
+#include <cmath>
 #include <limits>
 
 #include <QActionGroup>
@@ -19,6 +20,7 @@
 #include <QWindow>
 
 #include "tools/cabana/chart/chartswidget.h"
+#include "tools/cabana/dbc/signaldecoder.h"
 
 // ChartAxisElement's padding is 4 (https://codebrowser.dev/qt5/qtcharts/src/charts/axis/chartaxiselement_p.h.html)
 const int AXIS_X_TOP_MARGIN = 4;
@@ -218,6 +220,7 @@ void ChartView::updatePlotArea(int left_pos, bool force) {
     x_label_size += QSizeF{5, 5};
     chart()->setPlotArea(rect().adjusted(align_to + left, adjust_top + top, -x_label_size.width() / 2 - right, -x_label_size.height() - bottom));
     chart()->layout()->invalidate();
+    for (auto &s : sigs) updateSeriesData(s);
     resetChartCache();
   }
 }
@@ -248,6 +251,7 @@ void ChartView::updatePlot(double cur, double min, double max) {
   cur_sec = cur;
   if (min != axis_x->min() || max != axis_x->max()) {
     axis_x->setRange(min, max);
+    for (auto &s : sigs) updateSeriesData(s);
     updateAxisY();
     updateSeriesPoints();
     // update tooltip
@@ -282,19 +286,14 @@ void ChartView::updateSeriesPoints() {
   }
 }
 
-void ChartView::appendCanEvents(const cabana::Signal *sig, const std::vector<const CanEvent *> &events,
-                                std::vector<QPointF> &vals, std::vector<QPointF> &step_vals) {
-  vals.reserve(vals.size() + events.capacity());
-  step_vals.reserve(step_vals.size() + events.capacity() * 2);
+void ChartView::appendCanEvents(const cabana::Signal *sig, const MessageEvents &events, std::vector<QPointF> &vals) {
+  vals.reserve(vals.size() + events.size());
 
-  double value = 0;
-  for (const CanEvent *e : events) {
-    if (sig->getValue(e->dat, e->size, &value)) {
-      const double ts = can->toSeconds(e->mono_time);
-      vals.emplace_back(ts, value);
-      if (!step_vals.empty())
-        step_vals.emplace_back(ts, step_vals.back().y());
-      step_vals.emplace_back(ts, value);
+  std::vector<double> values(events.size());
+  cabana::SignalDecoder(*sig).decode(events, 0, events.size(), values.data());
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (!std::isnan(values[i])) {
+      vals.emplace_back(can->toSeconds(events.monoTime(i)), values[i]);
     }
   }
 }
@@ -304,27 +303,24 @@ void ChartView::updateSeries(const cabana::Signal *sig, const MessageEventsMap *
     if (!sig || s.sig == sig) {
       if (!msg_new_events) {
         s.vals.clear();
-        s.step_vals.clear();
       }
       auto events = msg_new_events ? msg_new_events : &can->eventsMap();
       auto it = events->find(s.msg_id);
       if (it == events->end() || it->second.empty()) continue;
 
-      if (s.vals.empty() || can->toSeconds(it->second.back()->mono_time) > s.vals.back().x()) {
-        appendCanEvents(s.sig, it->second, s.vals, s.step_vals);
+      size_t from = s.vals.size();
+      if (s.vals.empty() || can->toSeconds(it->second.monoTimes().back()) > s.vals.back().x()) {
+        appendCanEvents(s.sig, it->second, s.vals);
       } else {
-        std::vector<QPointF> vals, step_vals;
-        appendCanEvents(s.sig, it->second, vals, step_vals);
-        s.vals.insert(std::lower_bound(s.vals.begin(), s.vals.end(), vals.front().x(), xLessThan),
-                      vals.begin(), vals.end());
-        s.step_vals.insert(std::lower_bound(s.step_vals.begin(), s.step_vals.end(), step_vals.front().x(), xLessThan),
-                           step_vals.begin(), step_vals.end());
+        std::vector<QPointF> vals;
+        appendCanEvents(s.sig, it->second, vals);
+        if (vals.empty()) continue;
+        auto pos = s.vals.insert(std::lower_bound(s.vals.begin(), s.vals.end(), vals.front().x(), xLessThan),
+                                 vals.begin(), vals.end());
+        from = pos - s.vals.begin();
       }
-
-      if (!can->liveStreaming()) {
-        s.segment_tree.build(s.vals);
-      }
-      s.series->replace(QVector<QPointF>::fromStdVector(series_type == SeriesType::StepLine ? s.step_vals : s.vals));
+      s.pyramid.build(s.vals, from);
+      updateSeriesData(s);
     }
   }
   updateAxisY();
@@ -332,6 +328,43 @@ void ChartView::updateSeries(const cabana::Signal *sig, const MessageEventsMap *
   QMetaObject::invokeMethod(this, &ChartView::resetChartCache, Qt::QueuedConnection);
 }
 
+// drops the points of evicted events
+void ChartView::removeSeries(double min_sec, double max_sec) {
+  for (auto &s : sigs) {
+    auto first = std::lower_bound(s.vals.begin(), s.vals.end(), min_sec, xLessThan);
+    auto last = std::lower_bound(first, s.vals.end(), max_sec, xLessThan);
+    if (first != last) {
+      const size_t from = first - s.vals.begin();
+      s.vals.erase(first, last);
+      s.pyramid.build(s.vals, from);
+      updateSeriesData(s);
+    }
+  }
+  updateAxisY();
+  resetChartCache();
+}
+
+// feed QtCharts at most about two points per pixel of the visible range
+void ChartView::updateSeriesData(SigItem &s) {
+  auto first = std::lower_bound(s.vals.cbegin(), s.vals.cend(), axis_x->min(), xLessThan);
+  auto last = std::lower_bound(first, s.vals.cend(), axis_x->max(), xLessThan);
+  const int buckets = std::max<int>(chart()->plotArea().width(), 1);
+  QVector<QPointF> points;
+  s.pyramid.decimate(s.vals, first - s.vals.cbegin(), last - s.vals.cbegin(), axis_x->min(), axis_x->max(), buckets, points);
+
+  if (series_type == SeriesType::StepLine && !points.empty()) {
+    QVector<QPointF> step_points;
+    step_points.reserve(points.size() * 2);
+    step_points.push_back(points.front());
+    for (int i = 1; i < points.size(); ++i) {
+      step_points.push_back({points[i].x(), points[i - 1].y()});
+      step_points.push_back(points[i]);
+    }
+    points.swap(step_points);
+  }
+  s.series->replace(points);
+}
+
 // auto zoom on yaxis
 void ChartView::updateAxisY() {
   if (sigs.empty()) return;
@@ -350,16 +383,7 @@ void ChartView::updateAxisY() {
 
     auto first = std::lower_bound(s.vals.cbegin(), s.vals.cend(), axis_x->min(), xLessThan);
     auto last = std::lower_bound(first, s.vals.cend(), axis_x->max(), xLessThan);
-    s.min = std::numeric_limits<double>::max();
-    s.max = std::numeric_limits<double>::lowest();
-    if (can->liveStreaming()) {
-      for (auto it = first; it != last; ++it) {
-        if (it->y() < s.min) s.min = it->y();
-        if (it->y() > s.max) s.max = it->y();
-      }
-    } else {
-      std::tie(s.min, s.max) = s.segment_tree.minmax(std::distance(s.vals.cbegin(), first), std::distance(s.vals.cbegin(), last));
-    }
+    std::tie(s.min, s.max) = s.pyramid.minmax(s.vals, first - s.vals.cbegin(), last - s.vals.cbegin());
     min = std::min(min, s.min);
     max = std::max(max, s.max);
   }
@@ -838,7 +862,7 @@ void ChartView::setSeriesType(SeriesType type) {
     }
     for (auto &s : sigs) {
       s.series = createSeries(series_type, s.sig->color);
-      s.series->replace(QVector<QPointF>::fromStdVector(series_type == SeriesType::StepLine ? s.step_vals : s.vals));
+      updateSeriesData(s);
     }
     updateSeriesPoints();
     updateTitle();
@@ -33,6 +33,7 @@ public:
   void addSignal(const MessageId &msg_id, const cabana::Signal *sig);
   bool hasSignal(const MessageId &msg_id, const cabana::Signal *sig) const;
   void updateSeries(const cabana::Signal *sig = nullptr, const MessageEventsMap *msg_new_events = nullptr);
+  void removeSeries(double min_sec, double max_sec);
   void updatePlot(double cur, double min, double max);
   void setSeriesType(SeriesType type);
   void updatePlotArea(int left, bool force = false);
@@ -46,9 +47,8 @@ public:
     const cabana::Signal *sig = nullptr;
     QXYSeries *series = nullptr;
     std::vector<QPointF> vals;
-    std::vector<QPointF> step_vals;
     QPointF track_pt{};
-    SegmentTree segment_tree;
+    MinMaxPyramid pyramid;
     double min = 0;
     double max = 0;
   };
@@ -65,8 +65,7 @@ private slots:
   void signalRemoved(const cabana::Signal *sig) { removeIf([=](auto &s) { return s.sig == sig; }); }
 
 private:
-  void appendCanEvents(const cabana::Signal *sig, const std::vector<const CanEvent *> &events,
-                       std::vector<QPointF> &vals, std::vector<QPointF> &step_vals);
+  void appendCanEvents(const cabana::Signal *sig, const MessageEvents &events, std::vector<QPointF> &vals);
   void createToolButtons();
   void addSeries(QXYSeries *series);
   void contextMenuEvent(QContextMenuEvent *event) override;
@@ -95,6 +94,7 @@ private:
   QXYSeries *createSeries(SeriesType type, QColor color);
   void setSeriesColor(QXYSeries *, QColor color);
   void updateSeriesPoints();
+  void updateSeriesData(SigItem &s);
   void removeIf(std::function<bool(const SigItem &)> predicate);
   inline void clearTrackPoints() { for (auto &s : sigs) s.track_pt = {}; }
 
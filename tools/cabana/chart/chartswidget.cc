@@ -102,6 +102,7 @@ ChartsWidget::ChartsWidget(QWidget *parent) : QFrame(parent) {
   QObject::connect(auto_scroll_timer, &QTimer::timeout, this, &ChartsWidget::doAutoScroll);
   QObject::connect(dbc(), &DBCManager::DBCFileChanged, this, &ChartsWidget::removeAll);
   QObject::connect(can, &AbstractStream::eventsMerged, this, &ChartsWidget::eventsMerged);
+  QObject::connect(can, &AbstractStream::eventsEvicted, this, &ChartsWidget::eventsEvicted);
   QObject::connect(can, &AbstractStream::msgsReceived, this, &ChartsWidget::updateState);
   QObject::connect(can, &AbstractStream::seeking, this, &ChartsWidget::updateState);
   QObject::connect(can, &AbstractStream::timeRangeChanged, this, &ChartsWidget::timeRangeChanged);
@@ -160,6 +161,12 @@ void ChartsWidget::eventsMerged(const MessageEventsMap &new_events) {
   }
 }
 
+void ChartsWidget::eventsEvicted(uint64_t from_mono_time, uint64_t to_mono_time) {
+  for (auto c : charts) {
+    c->removeSeries(can->toSeconds(from_mono_time), can->toSeconds(to_mono_time));
+  }
+}
+
 void ChartsWidget::timeRangeChanged(const std::optional<std::pair<double, double>> &time_range) {
   updateToolBar();
   updateState();
@@ -63,6 +63,7 @@ private:
   void splitChart(ChartView *chart);
   QRect chartVisibleRect(ChartView *chart);
   void eventsMerged(const MessageEventsMap &new_events);
+  void eventsEvicted(uint64_t from_mono_time, uint64_t to_mono_time);
   void updateState();
   void zoomReset();
   void startAutoScroll();
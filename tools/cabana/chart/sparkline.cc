@@ -1,22 +1,26 @@
 #include "tools/cabana/chart/sparkline.h"
 
 #include <algorithm>
+#include <cmath>
 #include <limits>
 #include <QPainter>
 
+#include "tools/cabana/dbc/signaldecoder.h"
+
 void Sparkline::update(const MessageId &msg_id, const cabana::Signal *sig, double last_msg_ts, int range, QSize size) {
   const auto &msgs = can->events(msg_id);
 
   auto range_start = can->toMonoTime(last_msg_ts - range);
   auto range_end = can->toMonoTime(last_msg_ts);
-  auto first = std::lower_bound(msgs.cbegin(), msgs.cend(), range_start, CompareCanEvent());
-  auto last = std::upper_bound(first, msgs.cend(), range_end, CompareCanEvent());
+  const size_t first = msgs.lowerBound(range_start);
+  const size_t last = std::max(first, msgs.upperBound(range_end));
 
   points.clear();
-  double value = 0;
-  for (auto it = first; it != last; ++it) {
-    if (sig->getValue((*it)->dat, (*it)->size, &value)) {
-      points.emplace_back(((*it)->mono_time - (*first)->mono_time) / 1e9, value);
+  values.resize(last - first);
+  cabana::SignalDecoder(*sig).decode(msgs, first, values.size(), values.data());
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (!std::isnan(values[i])) {
+      points.emplace_back((msgs.monoTime(first + i) - msgs.monoTime(first)) / 1e9, values[i]);
     }
   }
 
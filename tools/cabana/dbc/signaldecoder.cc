@@ -0,0 +1,71 @@
+#include "tools/cabana/dbc/signaldecoder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "tools/cabana/streams/messageevents.h"
+
+cabana::SignalDecoder::SignalDecoder(const Signal &sig) : has_mux_(sig.multiplexor != nullptr), multiplex_value_(sig.multiplex_value) {
+  sig_.compile(sig);
+  if (has_mux_) {
+    mux_.compile(*sig.multiplexor);
+  }
+}
+
+void cabana::SignalDecoder::Plan::compile(const Signal &s) {
+  sig = s;
+  sig.factor = 1;
+  sig.offset = 0;
+  sig.multiplexor = nullptr;
+  factor = s.factor;
+  offset = s.offset;
+  little_endian = s.is_little_endian;
+  is_signed = s.is_signed;
+  if (s.size < 1 || s.size > 64 || s.lsb < 0 || s.msb < 0) return;
+
+  first_byte = (little_endian ? s.lsb : s.msb) / 8;
+  last_byte = (little_endian ? s.msb : s.lsb) / 8;
+  // an unaligned 64 bit signal spans nine bytes, leave it to get_raw_value
+  if (last_byte - first_byte >= 8) return;
+
+  mask = s.size == 64 ? ~0ULL : (1ULL << s.size) - 1;
+  sign_shift = 64 - s.size;
+  byte_shift = s.lsb % 8;
+  end_byte = last_byte + 1;
+
+  // load the 8 bytes ending at the signal's last byte, as the whole word of a classic CAN frame
+  base = std::max(0, last_byte - 7);
+  word_size = std::max(8, end_byte);
+  shift = little_endian ? s.lsb - base * 8 : (base + 7 - last_byte) * 8 + byte_shift;
+}
+
+void cabana::SignalDecoder::extractAll(const Plan &plan, const MessageEvents &events, size_t first, size_t count, double *values) const {
+  // the payloads are contiguous at a fixed stride
+  const uint8_t *data = events.data(first);
+  const size_t stride = events.stride();
+  for (size_t i = 0; i < count; ++i) {
+    values[i] = plan.extract(data + i * stride, events.dataSize(first + i));
+  }
+}
+
+void cabana::SignalDecoder::decodeRaw(const MessageEvents &events, size_t first, size_t count, double *values) const {
+  extractAll(sig_, events, first, count, values);
+  // scaled in a separate pass, which vectorizes
+  const double factor = sig_.factor, offset = sig_.offset;
+  for (size_t i = 0; i < count; ++i) {
+    values[i] = values[i] * factor + offset;
+  }
+}
+
+void cabana::SignalDecoder::decode(const MessageEvents &events, size_t first, size_t count, double *values) const {
+  decodeRaw(events, first, count, values);
+  if (has_mux_) {
+    const uint8_t *data = events.data(first);
+    const size_t stride = events.stride();
+    for (size_t i = 0; i < count; ++i) {
+      if (mux_.decode(data + i * stride, events.dataSize(first + i)) != multiplex_value_) {
+        values[i] = NAN;
+      }
+    }
+  }
+}
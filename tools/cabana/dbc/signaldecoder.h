@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "tools/cabana/dbc/dbc.h"
+
+class MessageEvents;
+
+namespace cabana {
+
+// A signal compiled into a shift and mask plan, chosen once for its position, size and endianness.
+// Decodes the same values as get_raw_value and Signal::getValue, without walking the bits every time.
+class SignalDecoder {
+public:
+  SignalDecoder() = default;
+  explicit SignalDecoder(const Signal &sig);
+
+  inline double getRawValue(const uint8_t *data, size_t data_size) const { return sig_.decode(data, data_size); }
+  inline bool getValue(const uint8_t *data, size_t data_size, double *val) const {
+    if (has_mux_ && mux_.decode(data, data_size) != multiplex_value_) return false;
+    *val = sig_.decode(data, data_size);
+    return true;
+  }
+
+  // decodes events[first:first + count] into values, with NaN where a multiplexed signal isn't present
+  void decode(const MessageEvents &events, size_t first, size_t count, double *values) const;
+  // get_raw_value for each event, ignoring the multiplexor
+  void decodeRaw(const MessageEvents &events, size_t first, size_t count, double *values) const;
+
+private:
+  struct Plan {
+    void compile(const Signal &sig);
+    int64_t extract(const uint8_t *data, size_t data_size) const;
+    inline double decode(const uint8_t *data, size_t data_size) const { return extract(data, data_size) * factor + offset; }
+
+    Signal sig;  // unscaled, for messages too short to hold the signal
+    int word_size = std::numeric_limits<int>::max();  // messages this long are decoded with one 8 byte load
+    int end_byte = std::numeric_limits<int>::max();   // messages this long hold the whole signal
+    int first_byte = 0, last_byte = 0;
+    int base = 0;   // first byte of the 8 byte load
+    int shift = 0;       // of the signal's lsb in the loaded word
+    int byte_shift = 0;  // of the signal's lsb in its first byte
+    int sign_shift = 0;
+    uint64_t mask = 0;
+    bool little_endian = true;
+    bool is_signed = false;
+    double factor = 1, offset = 0;
+  };
+
+  void extractAll(const Plan &plan, const MessageEvents &events, size_t first, size_t count, double *values) const;
+
+  Plan sig_, mux_;
+  bool has_mux_ = false;
+  double multiplex_value_ = 0;
+};
+
+}  // namespace cabana
+
+inline int64_t cabana::SignalDecoder::Plan::extract(const uint8_t *data, size_t data_size) const {
+  uint64_t v;
+  if ((int)data_size >= word_size) {
+    memcpy(&v, data + base, sizeof(v));
+    if (!little_endian) v = __builtin_bswap64(v);
+    v = (v >> shift) & mask;
+  } else if ((int)data_size >= end_byte) {
+    v = 0;
+    if (little_endian) {
+      for (int i = last_byte; i >= first_byte; --i) v = (v << 8) | data[i];
+    } else {
+      for (int i = first_byte; i <= last_byte; ++i) v = (v << 8) | data[i];
+    }
+    v = (v >> byte_shift) & mask;
+  } else {
+    return get_raw_value(data, data_size, sig);
+  }
+  return is_signed ? (int64_t)(v << sign_shift) >> sign_shift : (int64_t)v;
+}
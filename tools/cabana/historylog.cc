@@ -7,6 +7,7 @@
 #include <QVBoxLayout>
 
 #include "tools/cabana/commands.h"
+#include "tools/cabana/dbc/signaldecoder.h"
 #include "tools/cabana/utils/export.h"
 
 QVariant HistoryLogModel::data(const QModelIndex &index, int role) const {
@@ -86,7 +87,7 @@ void HistoryLogModel::updateState(bool clear) {
 
 bool HistoryLogModel::canFetchMore(const QModelIndex &parent) const {
   const auto &events = can->events(msg_id);
-  return !events.empty() && !messages.empty() && messages.back().mono_time > events.front()->mono_time;
+  return !events.empty() && !messages.empty() && messages.back().mono_time > events.monoTime(0);
 }
 
 void HistoryLogModel::fetchMore(const QModelIndex &parent) {
@@ -96,20 +97,23 @@ void HistoryLogModel::fetchMore(const QModelIndex &parent) {
 
 void HistoryLogModel::fetchData(std::deque<Message>::iterator insert_pos, uint64_t from_time, uint64_t min_time) {
   const auto &events = can->events(msg_id);
-  auto first = std::upper_bound(events.rbegin(), events.rend(), from_time, [](uint64_t ts, auto e) {
-    return ts > e->mono_time;
-  });
+  // walk back from the last event before from_time
+  size_t first = events.lowerBound(from_time);
 
   std::vector<HistoryLogModel::Message> msgs;
   std::vector<double> values(sigs.size());
+  std::vector<cabana::SignalDecoder> decoders;
+  for (auto s : sigs) decoders.emplace_back(*s);
   msgs.reserve(batch_size);
-  for (; first != events.rend() && (*first)->mono_time > min_time; ++first) {
-    const CanEvent *e = *first;
-    for (int i = 0; i < sigs.size(); ++i) {
-      sigs[i]->getValue(e->dat, e->size, &values[i]);
+  for (; first > 0 && events.monoTime(first - 1) > min_time; --first) {
+    const uint64_t mono_time = events.monoTime(first - 1);
+    const uint8_t *dat = events.data(first - 1);
+    const uint8_t size = events.dataSize(first - 1);
+    for (int i = 0; i < decoders.size(); ++i) {
+      decoders[i].getValue(dat, size, &values[i]);
     }
     if (!filter_cmp || filter_cmp(values[filter_sig_idx], filter_value)) {
-       msgs.emplace_back(Message{e->mono_time, values, {e->dat, e->dat + e->size}});
+       msgs.emplace_back(Message{mono_time, values, {dat, dat + size}});
       if (msgs.size() >= batch_size && min_time == 0) {
         break;
       }
@@ -38,6 +38,9 @@ void settings_op(SettingOperation op) {
   op(s, "sparkline_range", settings.sparkline_range);
   op(s, "multiple_lines_hex", settings.multiple_lines_hex);
   op(s, "log_livestream", settings.log_livestream);
+  op(s, "live_retention_minutes", settings.live_retention_minutes);
+  op(s, "live_retention_mb", settings.live_retention_mb);
+  op(s, "live_spill_events", settings.live_spill_events);
   op(s, "log_path", settings.log_path);
   op(s, "drag_direction", (int &)settings.drag_direction);
   op(s, "suppress_defined_signals", settings.suppress_defined_signals);
@@ -99,6 +102,24 @@ SettingsDlg::SettingsDlg(QWidget *parent) : QDialog(parent) {
   chart_height->setValue(settings.chart_height);
   main_layout->addWidget(groupbox);
 
+  groupbox = new QGroupBox("Live Stream");
+  groupbox->setToolTip(tr("Applies to streams opened after the change"));
+  form_layout = new QFormLayout(groupbox);
+  form_layout->addRow(tr("Keep Minutes"), live_retention_minutes = new QSpinBox(this));
+  live_retention_minutes->setRange(0, 24 * 60);
+  live_retention_minutes->setSpecialValueText(tr("Unlimited"));
+  live_retention_minutes->setValue(settings.live_retention_minutes);
+
+  form_layout->addRow(tr("Keep MB"), live_retention_mb = new QSpinBox(this));
+  live_retention_mb->setRange(0, 64 * 1024);
+  live_retention_mb->setSingleStep(256);
+  live_retention_mb->setSpecialValueText(tr("Unlimited"));
+  live_retention_mb->setValue(settings.live_retention_mb);
+
+  form_layout->addRow(live_spill_events = new QCheckBox(tr("Spill older events to the log path for seeking back")));
+  live_spill_events->setChecked(settings.live_spill_events);
+  main_layout->addWidget(groupbox);
+
   log_livestream = new QGroupBox(tr("Enable live stream logging"), this);
   log_livestream->setCheckable(true);
   QHBoxLayout *path_layout = new QHBoxLayout(log_livestream);
@@ -134,6 +155,9 @@ void SettingsDlg::save() {
   settings.max_cached_minutes = cached_minutes->value();
   settings.chart_series_type = chart_series_type->currentIndex();
   settings.chart_height = chart_height->value();
+  settings.live_retention_minutes = live_retention_minutes->value();
+  settings.live_retention_mb = live_retention_mb->value();
+  settings.live_spill_events = live_spill_events->isChecked();
   settings.log_livestream = log_livestream->isChecked();
   settings.log_path = log_path->text();
   settings.drag_direction = (Settings::DragDirection)drag_direction->currentIndex();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QByteArray>
+#include <QCheckBox>
 #include <QComboBox>
 #include <QDialog>
 #include <QGroupBox>
@@ -35,6 +36,9 @@ public:
   int sparkline_range = 15; // 15 seconds
   bool multiple_lines_hex = false;
   bool log_livestream = true;
+  int live_retention_minutes = 60;
+  int live_retention_mb = 2048;
+  bool live_spill_events = false;
   bool suppress_defined_signals = false;
   QString log_path;
   QString last_dir;
@@ -59,6 +63,9 @@ public:
   QSpinBox *chart_height;
   QComboBox *chart_series_type;
   QComboBox *theme;
+  QSpinBox *live_retention_minutes;
+  QSpinBox *live_retention_mb;
+  QCheckBox *live_spill_events;
   QGroupBox *log_livestream;
   QLineEdit *log_path;
   QComboBox *drag_direction;
@@ -6,13 +6,10 @@
 #include "common/timing.h"
 #include "tools/cabana/settings.h"
 
-static const int EVENT_NEXT_BUFFER_SIZE = 6 * 1024 * 1024;  // 6MB
-
 AbstractStream *can = nullptr;
 
 AbstractStream::AbstractStream(QObject *parent) : QObject(parent) {
   assert(parent != nullptr);
-  event_buffer_ = std::make_unique<MonotonicBuffer>(EVENT_NEXT_BUFFER_SIZE);
 
   QObject::connect(this, &AbstractStream::privateUpdateLastMsgsSignal, this, &AbstractStream::updateLastMessages, Qt::QueuedConnection);
   QObject::connect(this, &AbstractStream::seekedTo, this, &AbstractStream::updateLastMsgsTo);
@@ -114,8 +111,8 @@ void AbstractStream::updateEvent(const MessageId &id, double sec, const uint8_t
   new_msgs_.insert(id);
 }
 
-const std::vector<const CanEvent *> &AbstractStream::events(const MessageId &id) const {
-  static std::vector<const CanEvent *> empty_events;
+const MessageEvents &AbstractStream::events(const MessageId &id) const {
+  static MessageEvents empty_events;
   auto it = events_.find(id);
   return it != events_.end() ? it->second : empty_events;
 }
@@ -135,8 +132,8 @@ void AbstractStream::updateLastMsgsTo(double sec) {
   msgs.reserve(events_.size());
 
   for (const auto &[id, ev] : events_) {
-    auto it = std::upper_bound(ev.begin(), ev.end(), last_ts, CompareCanEvent());
-    if (it != ev.begin()) {
+    const size_t count = ev.upperBound(last_ts);
+    if (count > 0) {
       auto &m = msgs[id];
       double freq = 0;
       // Keep suppressed bits.
@@ -148,9 +145,9 @@ void AbstractStream::updateLastMsgsTo(double sec) {
                        [](const auto &change) { return CanData::ByteLastChange{.suppressed = change.suppressed}; });
       }
 
-      auto prev = std::prev(it);
-      m.compute(id, (*prev)->dat, (*prev)->size, toSeconds((*prev)->mono_time), getSpeed(), {}, freq);
-      m.count = std::distance(ev.begin(), prev) + 1;
+      const size_t prev = count - 1;
+      m.compute(id, ev.data(prev), ev.dataSize(prev), toSeconds(ev.monoTime(prev)), getSpeed(), {}, freq);
+      m.count = count;
     }
   }
 
@@ -163,37 +160,33 @@ void AbstractStream::updateLastMsgsTo(double sec) {
   emit msgsReceived(nullptr, id_changed);
 }
 
-const CanEvent *AbstractStream::newEvent(uint64_t mono_time, const cereal::CanData::Reader &c) {
+void AbstractStream::addEvent(MessageEventsMap &segment, uint64_t mono_time, const cereal::CanData::Reader &c) {
   auto dat = c.getDat();
-  CanEvent *e = (CanEvent *)event_buffer_->allocate(sizeof(CanEvent) + sizeof(uint8_t) * dat.size());
-  e->src = c.getSrc();
-  e->address = c.getAddress();
-  e->mono_time = mono_time;
-  e->size = dat.size();
-  memcpy(e->dat, (uint8_t *)dat.begin(), e->size);
-  return e;
+  segment[{.source = c.getSrc(), .address = c.getAddress()}].append(mono_time, (const uint8_t *)dat.begin(), dat.size());
 }
 
-void AbstractStream::mergeEvents(const std::vector<const CanEvent *> &events) {
-  static MessageEventsMap msg_events;
-  std::for_each(msg_events.begin(), msg_events.end(), [](auto &e) { e.second.clear(); });
-
-  // Group events by message ID
-  for (auto e : events) {
-    msg_events[{.source = e->src, .address = e->address}].push_back(e);
+void AbstractStream::mergeEvents(const MessageEventsMap &segment) {
+  bool merged = false;
+  for (const auto &[id, new_e] : segment) {
+    if (!new_e.empty()) {
+      events_[id].merge(new_e);
+      merged = true;
+    }
+  }
+  if (merged) {
+    emit eventsMerged(segment);
   }
+}
 
-  if (!events.empty()) {
-    for (const auto &[id, new_e] : msg_events) {
-      if (!new_e.empty()) {
-        auto &e = events_[id];
-        auto pos = std::upper_bound(e.cbegin(), e.cend(), new_e.front()->mono_time, CompareCanEvent());
-        e.insert(pos, new_e.cbegin(), new_e.cend());
-      }
-    }
-    auto pos = std::upper_bound(all_events_.cbegin(), all_events_.cend(), events.front()->mono_time, CompareCanEvent());
-    all_events_.insert(pos, events.cbegin(), events.cend());
-    emit eventsMerged(msg_events);
+void AbstractStream::evictEvents(uint64_t from_mono_time, uint64_t to_mono_time) {
+  bool evicted = false;
+  for (auto &[_, e] : events_) {
+    const size_t first = e.lowerBound(from_mono_time), last = e.lowerBound(to_mono_time);
+    evicted |= first < last;
+    e.erase(first, last);
+  }
+  if (evicted) {
+    emit eventsEvicted(from_mono_time, to_mono_time);
   }
 }
 
@@ -222,12 +215,12 @@ double calc_freq(const MessageId &msg_id, double current_sec) {
   auto current_mono_time = can->toMonoTime(current_sec);
   auto start_mono_time = can->toMonoTime(current_sec - 59);
 
-  auto first = std::lower_bound(events.begin(), events.end(), start_mono_time, CompareCanEvent());
-  auto last = std::upper_bound(first, events.end(), current_mono_time, CompareCanEvent());
+  const size_t first = events.lowerBound(start_mono_time);
+  const size_t last = events.upperBound(current_mono_time);
 
-  int count = std::distance(first, last);
+  int count = last > first ? last - first : 0;
   if (count > 1) {
-    double duration = ((*std::prev(last))->mono_time - (*first)->mono_time) / 1e9;
+    double duration = (events.monoTime(last - 1) - events.monoTime(first)) / 1e9;
     return count / duration;
   }
   return 0;
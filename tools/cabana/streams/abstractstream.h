@@ -15,6 +15,7 @@
 
 #include "cereal/messaging/messaging.h"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/streams/messageevents.h"
 #include "tools/cabana/utils/util.h"
 #include "tools/replay/util.h"
 
@@ -39,21 +40,6 @@ struct CanData {
   double last_freq_update_ts = 0;
 };
 
-struct CanEvent {
-  uint8_t src;
-  uint32_t address;
-  uint64_t mono_time;
-  uint8_t size;
-  uint8_t dat[];
-};
-
-struct CompareCanEvent {
-  constexpr bool operator()(const CanEvent *const e, uint64_t ts) const { return e->mono_time < ts; }
-  constexpr bool operator()(uint64_t ts, const CanEvent *const e) const { return ts < e->mono_time; }
-};
-
-typedef std::unordered_map<MessageId, std::vector<const CanEvent *>> MessageEventsMap;
-
 class AbstractStream : public QObject {
   Q_OBJECT
 
@@ -82,9 +68,8 @@ public:
 
   inline const std::unordered_map<MessageId, CanData> &lastMessages() const { return last_msgs; }
   inline const MessageEventsMap &eventsMap() const { return events_; }
-  inline const std::vector<const CanEvent *> &allEvents() const { return all_events_; }
   const CanData &lastMessage(const MessageId &id) const;
-  const std::vector<const CanEvent *> &events(const MessageId &id) const;
+  const MessageEvents &events(const MessageId &id) const;
 
   size_t suppressHighlighted();
   void clearSuppressed();
@@ -97,6 +82,7 @@ signals:
   void seekedTo(double sec);
   void timeRangeChanged(const std::optional<std::pair<double, double>> &range);
   void eventsMerged(const MessageEventsMap &events_map);
+  void eventsEvicted(uint64_t from_mono_time, uint64_t to_mono_time);
   void msgsReceived(const std::set<MessageId> *new_msgs, bool has_new_ids);
   void sourcesUpdated(const SourceSet &s);
   void privateUpdateLastMsgsSignal();
@@ -105,11 +91,11 @@ public:
   SourceSet sources;
 
 protected:
-  void mergeEvents(const std::vector<const CanEvent *> &events);
-  const CanEvent *newEvent(uint64_t mono_time, const cereal::CanData::Reader &c);
+  void mergeEvents(const MessageEventsMap &segment);
+  void evictEvents(uint64_t from_mono_time, uint64_t to_mono_time);
+  static void addEvent(MessageEventsMap &segment, uint64_t mono_time, const cereal::CanData::Reader &c);
   void updateEvent(const MessageId &id, double sec, const uint8_t *data, uint8_t size);
 
-  std::vector<const CanEvent *> all_events_;
   double current_sec_ = 0;
   std::optional<std::pair<double, double>> time_range_;
 
@@ -120,7 +106,6 @@ private:
 
   MessageEventsMap events_;
   std::unordered_map<MessageId, CanData> last_msgs;
-  std::unique_ptr<MonotonicBuffer> event_buffer_;
 
   // Members accessed in multiple threads. (mutex protected)
   std::mutex mutex_;
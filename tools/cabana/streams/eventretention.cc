@@ -0,0 +1,180 @@
+#include "tools/cabana/streams/eventretention.h"
+
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDebug>
+
+#include "common/util.h"
+#include "tools/replay/util.h"
+
+EventRetention::EventRetention(double seconds, size_t max_bytes, const std::string &spill_dir)
+    : window(seconds * 1e9), max_bytes(max_bytes), spill_dir(spill_dir) {
+  if (!spill_dir.empty() && !util::create_directories(spill_dir, 0755)) {
+    qWarning() << "failed to create spill directory" << spill_dir.c_str();
+  }
+}
+
+EventRetention::~EventRetention() {
+  for (auto &c : chunks) {
+    c.written.wait();
+    ::unlink(c.path.c_str());
+  }
+  if (!spill_dir.empty()) {
+    ::rmdir(spill_dir.c_str());
+  }
+}
+
+EventRetention::Update EventRetention::update(const MessageEventsMap &events, uint64_t current_ts) {
+  uint64_t latest = 0, live_from = UINT64_MAX;
+  size_t live_bytes = 0;
+  for (const auto &[_, e] : events) {
+    if (e.empty()) continue;
+
+    const size_t first = e.lowerBound(cutoff);
+    if (first < e.size()) {
+      latest = std::max(latest, e.monoTime(e.size() - 1));
+      live_from = std::min(live_from, e.monoTime(first));
+      live_bytes += (e.size() - first) * (e.bytes() / e.size());
+    }
+  }
+  Update result;
+  if (latest == 0) return result;
+
+  // advance the cutoff a chunk at a time
+  uint64_t new_cutoff = cutoff;
+  if (window > 0 && latest > window && latest - window >= cutoff + window / 10) {
+    new_cutoff = latest - window;
+  }
+  if (max_bytes > 0 && live_bytes > max_bytes) {
+    // assumes the events are spread evenly over time, and leaves a tenth of the budget free
+    const double evict = 1.0 - 0.9 * max_bytes / live_bytes;
+    new_cutoff = std::max<uint64_t>(new_cutoff, live_from + (latest - live_from) * evict);
+  }
+  if (!spill_dir.empty() && new_cutoff > cutoff) {
+    spill(events, cutoff, new_cutoff);
+  }
+
+  // keep what's spilled around a playback position before the window, about as much as the window holds.
+  // it's recentered once the position leaves its middle half
+  auto new_kept = kept;
+  if (!chunks.empty() && current_ts < new_cutoff) {
+    const uint64_t span = latest - new_cutoff;
+    if (kept.first == kept.second || current_ts < kept.first + span / 4 || current_ts + span / 4 > kept.second) {
+      new_kept = {std::max(begin(), current_ts - std::min(current_ts, span / 2)), std::min(current_ts + span / 2, new_cutoff)};
+    }
+  } else {
+    new_kept = {};
+  }
+  if (new_cutoff == cutoff && new_kept == kept) return result;
+
+  if (new_kept.first == new_kept.second) {
+    result.evict.push_back({0, new_cutoff});
+  } else {
+    result.evict.push_back({0, new_kept.first});
+    if (new_kept.second < new_cutoff) result.evict.push_back({new_kept.second, new_cutoff});
+  }
+
+  // page in what's newly kept, that was evicted before
+  std::vector<std::pair<uint64_t, uint64_t>> pieces;
+  if (kept.first == kept.second) {
+    pieces.push_back({new_kept.first, std::min(new_kept.second, cutoff)});
+  } else {
+    pieces.push_back({new_kept.first, std::min(new_kept.second, kept.first)});
+    pieces.push_back({std::max(new_kept.first, kept.second), std::min(new_kept.second, cutoff)});
+  }
+  for (auto [from, to] : pieces) {
+    if (from < to) {
+      for (const auto &[id, e] : read(from, to)) {
+        result.page_in[id].merge(e);
+      }
+    }
+  }
+
+  cutoff = new_cutoff;
+  kept = new_kept;
+  return result;
+}
+
+// a chunk holds for each message: source, address, count and stride, then its mono times, sizes and payloads
+void EventRetention::spill(const MessageEventsMap &events, uint64_t from, uint64_t to) {
+  std::string buf;
+  auto put = [&buf](const void *p, size_t size) { buf.append((const char *)p, size); };
+  uint64_t chunk_from = UINT64_MAX;
+  for (const auto &[id, e] : events) {
+    const size_t first = e.lowerBound(from), last = e.lowerBound(to);
+    if (first >= last) continue;
+
+    const uint32_t count = last - first;
+    const uint8_t stride = e.stride();
+    put(&id.source, sizeof(id.source));
+    put(&id.address, sizeof(id.address));
+    put(&count, sizeof(count));
+    put(&stride, sizeof(stride));
+    put(e.monoTimes().data() + first, count * sizeof(uint64_t));
+    for (size_t i = first; i < last; ++i) buf.push_back(e.dataSize(i));
+    put(e.data(first), count * stride);
+    chunk_from = std::min(chunk_from, e.monoTime(first));
+  }
+  if (buf.empty()) return;
+
+  // compressed and written in the background, reads of the chunk wait for it
+  const std::string path = spill_dir + "/" + std::to_string(chunks.size()) + ".zst";
+  auto written = std::async(std::launch::async, [path, buf = std::move(buf)]() {
+    std::string out(ZSTD_compressBound(buf.size()), '\0');
+    const size_t size = ZSTD_compress(out.data(), out.size(), buf.data(), buf.size(), 1);
+    if (ZSTD_isError(size) || util::write_file(path.c_str(), out.data(), size, O_WRONLY | O_CREAT | O_TRUNC) != 0) {
+      qWarning() << "failed to spill events to" << path.c_str();
+      return size_t(0);
+    }
+    return size;
+  });
+  chunks.push_back({.from = chunk_from, .to = to, .path = path, .written = written.share()});
+}
+
+size_t EventRetention::spilledBytes() const {
+  size_t size = 0;
+  for (auto &c : chunks) size += c.written.get();
+  return size;
+}
+
+MessageEventsMap EventRetention::read(uint64_t from, uint64_t to) const {
+  MessageEventsMap result;
+  for (const auto &c : chunks) {
+    if (c.to <= from || c.from >= to) continue;
+
+    c.written.wait();
+    const std::string buf = decompressZST(util::read_file(c.path));
+    size_t pos = 0;
+    auto get = [&](void *p, size_t size) {
+      if (pos + size > buf.size()) return false;
+      memcpy(p, buf.data() + pos, size);
+      pos += size;
+      return true;
+    };
+    MessageId id;
+    uint32_t count = 0;
+    uint8_t stride = 0;
+    while (get(&id.source, sizeof(id.source)) && get(&id.address, sizeof(id.address)) &&
+           get(&count, sizeof(count)) && get(&stride, sizeof(stride)) &&
+           pos + count * (sizeof(uint64_t) + 1 + stride) <= buf.size()) {
+      const char *mono_times = buf.data() + pos;
+      const uint8_t *sizes = (const uint8_t *)mono_times + count * sizeof(uint64_t);
+      const uint8_t *data = sizes + count;
+      pos += count * (sizeof(uint64_t) + 1 + stride);
+
+      auto &e = result[id];
+      for (uint32_t i = 0; i < count; ++i) {
+        uint64_t mono_time;
+        memcpy(&mono_time, mono_times + i * sizeof(uint64_t), sizeof(mono_time));
+        if (mono_time >= from && mono_time < to) {
+          e.append(mono_time, data + i * stride, sizes[i]);
+        }
+      }
+    }
+  }
+  return result;
+}
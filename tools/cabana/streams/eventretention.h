@@ -0,0 +1,46 @@
+#pragma once
+
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tools/cabana/streams/messageevents.h"
+
+// Bounds the events a live stream keeps to a time window and a memory budget, evicting the oldest
+// in chunks of about a tenth of it. With a spill directory, evicted events are first written there
+// as compressed chunks, and the ones around a playback position before the window are paged back in.
+class EventRetention {
+public:
+  EventRetention(double seconds, size_t max_bytes, const std::string &spill_dir = {});
+  ~EventRetention();
+
+  struct Update {
+    std::vector<std::pair<uint64_t, uint64_t>> evict;  // [from, to) mono time ranges to remove
+    MessageEventsMap page_in;                          // spilled events to merge back
+  };
+  // called after new events are merged, with the playback position
+  Update update(const MessageEventsMap &events, uint64_t current_ts);
+
+  // the oldest event that is kept or can be paged back in, 0 before anything is evicted
+  inline uint64_t begin() const { return !chunks.empty() ? chunks.front().from : cutoff; }
+  // compressed size of the spilled chunks
+  size_t spilledBytes() const;
+  // spilled events of [from, to)
+  MessageEventsMap read(uint64_t from, uint64_t to) const;
+
+private:
+  void spill(const MessageEventsMap &events, uint64_t from, uint64_t to);
+
+  struct Chunk {
+    uint64_t from, to;
+    std::string path;
+    std::shared_future<size_t> written;
+  };
+  const uint64_t window;
+  const size_t max_bytes;
+  const std::string spill_dir;
+  std::vector<Chunk> chunks;
+  uint64_t cutoff = 0;                     // events before this are evicted or spilled
+  std::pair<uint64_t, uint64_t> kept = {};  // paged back in around the playback position
+};
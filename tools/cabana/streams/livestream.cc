@@ -53,6 +53,11 @@ void LiveStream::startUpdateTimer() {
 }
 
 void LiveStream::start() {
+  std::string spill_dir;
+  if (settings.live_spill_events) {
+    spill_dir = QString("%1/spill--%2").arg(settings.log_path).arg(QDateTime::currentDateTime().toString("yyyy-MM-dd--hh-mm-ss")).toStdString();
+  }
+  retention = std::make_unique<EventRetention>(settings.live_retention_minutes * 60.0, settings.live_retention_mb * 1024ull * 1024, spill_dir);
   stream_thread->start();
   startUpdateTimer();
   begin_date_time = QDateTime::currentDateTime();
@@ -80,7 +85,7 @@ void LiveStream::handleEvent(kj::ArrayPtr<capnp::word> data) {
     const uint64_t mono_time = event.getLogMonoTime();
     std::lock_guard lk(lock);
     for (const auto &c : event.getCan()) {
-      received_events_.push_back(newEvent(mono_time, c));
+      addEvent(received_events_, mono_time, c);
     }
   }
 }
@@ -91,12 +96,16 @@ void LiveStream::timerEvent(QTimerEvent *event) {
       // merge events received from live stream thread.
       std::lock_guard lk(lock);
       mergeEvents(received_events_);
-      uint64_t last_received_ts = !received_events_.empty() ? received_events_.back()->mono_time : 0;
-      lastest_event_ts = std::max(lastest_event_ts, last_received_ts);
-      received_events_.clear();
+      for (auto &[_, e] : received_events_) {
+        if (!e.empty()) {
+          begin_event_ts = begin_event_ts ? std::min(begin_event_ts, e.monoTime(0)) : e.monoTime(0);
+          lastest_event_ts = std::max(lastest_event_ts, e.monoTime(e.size() - 1));
+          e.clear();
+        }
+      }
     }
-    if (!all_events_.empty()) {
-      begin_event_ts = all_events_.front()->mono_time;
+    if (!eventsMap().empty()) {
+      updateRetention();
       updateEvents();
       return;
     }
@@ -109,7 +118,7 @@ void LiveStream::updateEvents() {
 
   if (first_update_ts == 0) {
     first_update_ts = nanos_since_boot();
-    first_event_ts = current_event_ts = all_events_.back()->mono_time;
+    first_event_ts = current_event_ts = lastest_event_ts;
   }
 
   if (paused_ || prev_speed != speed_) {
@@ -120,22 +129,34 @@ void LiveStream::updateEvents() {
   }
 
   uint64_t last_ts = post_last_event && speed_ == 1.0
-                       ? all_events_.back()->mono_time
+                       ? lastest_event_ts
                        : first_event_ts + (nanos_since_boot() - first_update_ts) * speed_;
-  auto first = std::upper_bound(all_events_.cbegin(), all_events_.cend(), current_event_ts, CompareCanEvent());
-  auto last = std::upper_bound(first, all_events_.cend(), last_ts, CompareCanEvent());
-
-  for (auto it = first; it != last; ++it) {
-    const CanEvent *e = *it;
-    MessageId id = {.source = e->src, .address = e->address};
-    updateEvent(id, (e->mono_time - begin_event_ts) / 1e9, e->dat, e->size);
-    current_event_ts = e->mono_time;
+  uint64_t last_event_ts = current_event_ts;
+  for (const auto &[id, events] : eventsMap()) {
+    for (size_t i = events.upperBound(current_event_ts), last = events.upperBound(last_ts); i < last; ++i) {
+      updateEvent(id, (events.monoTime(i) - begin_event_ts) / 1e9, events.data(i), events.dataSize(i));
+      last_event_ts = std::max(last_event_ts, events.monoTime(i));
+    }
   }
+  current_event_ts = last_event_ts;
   emit privateUpdateLastMsgsSignal();
 }
 
+void LiveStream::updateRetention() {
+  auto update = retention->update(eventsMap(), current_event_ts);
+  for (auto [from, to] : update.evict) {
+    evictEvents(from, to);
+  }
+  mergeEvents(update.page_in);
+}
+
+double LiveStream::minSeconds() const {
+  const uint64_t begin = retention ? retention->begin() : 0;
+  return begin > begin_event_ts ? (begin - begin_event_ts) / 1e9 : 0;
+}
+
 void LiveStream::seekTo(double sec) {
-  sec = std::max(0.0, sec);
+  sec = std::max(minSeconds(), sec);
   first_update_ts = nanos_since_boot();
   current_event_ts = first_event_ts = std::min<uint64_t>(sec * 1e9 + begin_event_ts, lastest_event_ts);
   post_last_event = (first_event_ts == lastest_event_ts);
@@ -7,6 +7,7 @@
 #include <QBasicTimer>
 
 #include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/streams/eventretention.h"
 
 class LiveStream : public AbstractStream {
   Q_OBJECT
@@ -18,6 +19,7 @@ public:
   void stop();
   inline QDateTime beginDateTime() const { return begin_date_time; }
   inline uint64_t beginMonoTime() const override { return begin_event_ts; }
+  double minSeconds() const override;
   double maxSeconds() const override { return std::max(1.0, (lastest_event_ts - begin_event_ts) / 1e9); }
   void setSpeed(float speed) override { speed_ = speed; }
   double getSpeed() override { return speed_; }
@@ -33,10 +35,11 @@ private:
   void startUpdateTimer();
   void timerEvent(QTimerEvent *event) override;
   void updateEvents();
+  void updateRetention();
 
   std::mutex lock;
   QThread *stream_thread;
-  std::vector<const CanEvent *> received_events_;
+  MessageEventsMap received_events_;
 
   int timer_id;
   QBasicTimer update_timer;
@@ -53,4 +56,5 @@ private:
 
   struct Logger;
   std::unique_ptr<Logger> logger;
+  std::unique_ptr<EventRetention> retention;
 };
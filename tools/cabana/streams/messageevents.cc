@@ -0,0 +1,70 @@
+#include "tools/cabana/streams/messageevents.h"
+
+#include <cstring>
+
+void MessageEvents::append(uint64_t mono_time, const uint8_t *dat, uint8_t size) {
+  if (size > stride_) setStride(size);
+
+  mono_times_.push_back(mono_time);
+  sizes_.push_back(size);
+  data_.resize(data_.size() + stride_);
+  memcpy(data_.data() + data_.size() - stride_, dat, size);
+}
+
+size_t MessageEvents::merge(const MessageEvents &segment) {
+  if (segment.empty()) return size();
+
+  const size_t stride = std::max(stride_, segment.stride_);
+  if (stride != stride_) setStride(stride);
+
+  const size_t pos = upperBound(segment.mono_times_.front());
+  mono_times_.insert(mono_times_.begin() + pos, segment.mono_times_.cbegin(), segment.mono_times_.cend());
+  sizes_.insert(sizes_.begin() + pos, segment.sizes_.cbegin(), segment.sizes_.cend());
+  if (segment.stride_ == stride_) {
+    data_.insert(data_.begin() + pos * stride_, segment.data_.cbegin(), segment.data_.cend());
+  } else {
+    auto it = data_.insert(data_.begin() + pos * stride_, segment.size() * stride_, 0);
+    for (size_t i = 0; i < segment.size(); ++i) {
+      memcpy(&*it + i * stride_, segment.data(i), segment.dataSize(i));
+    }
+  }
+  return pos;
+}
+
+void MessageEvents::erase(size_t first, size_t last) {
+  if (first >= last) return;
+
+  mono_times_.erase(mono_times_.begin() + first, mono_times_.begin() + last);
+  sizes_.erase(sizes_.begin() + first, sizes_.begin() + last);
+  data_.erase(data_.begin() + first * stride_, data_.begin() + last * stride_);
+}
+
+MessageEvents MessageEvents::slice(size_t first, size_t last) const {
+  MessageEvents events;
+  events.mono_times_.assign(mono_times_.cbegin() + first, mono_times_.cbegin() + last);
+  events.sizes_.assign(sizes_.cbegin() + first, sizes_.cbegin() + last);
+  events.data_.assign(data_.cbegin() + first * stride_, data_.cbegin() + last * stride_);
+  events.stride_ = stride_;
+  return events;
+}
+
+void MessageEvents::clear() {
+  mono_times_.clear();
+  sizes_.clear();
+  data_.clear();
+  stride_ = 0;
+}
+
+size_t MessageEvents::memoryUsage() const {
+  return mono_times_.capacity() * sizeof(uint64_t) + sizes_.capacity() + data_.capacity();
+}
+
+// pads the stored payloads to a wider stride, messages rarely change size
+void MessageEvents::setStride(size_t stride) {
+  std::vector<uint8_t> data(size() * stride);
+  for (size_t i = 0; i < size(); ++i) {
+    memcpy(data.data() + i * stride, data_.data() + i * stride_, sizes_[i]);
+  }
+  data_ = std::move(data);
+  stride_ = stride;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "tools/cabana/dbc/dbc.h"
+
+// The events of one message, stored as columns: the mono times in one array and the payloads
+// in another at a fixed stride, so scans and binary searches stream through memory.
+class MessageEvents {
+public:
+  inline size_t size() const { return mono_times_.size(); }
+  inline bool empty() const { return mono_times_.empty(); }
+  inline uint64_t monoTime(size_t i) const { return mono_times_[i]; }
+  inline const uint8_t *data(size_t i) const { return data_.data() + i * stride_; }
+  inline uint8_t dataSize(size_t i) const { return sizes_[i]; }
+  inline size_t stride() const { return stride_; }
+  inline const std::vector<uint64_t> &monoTimes() const { return mono_times_; }
+
+  // index of the first event at or after mono_time
+  inline size_t lowerBound(uint64_t mono_time) const {
+    return std::lower_bound(mono_times_.cbegin(), mono_times_.cend(), mono_time) - mono_times_.cbegin();
+  }
+  // index of the first event after mono_time
+  inline size_t upperBound(uint64_t mono_time) const {
+    return std::upper_bound(mono_times_.cbegin(), mono_times_.cend(), mono_time) - mono_times_.cbegin();
+  }
+
+  void append(uint64_t mono_time, const uint8_t *dat, uint8_t size);
+  // inserts a segment of events that doesn't overlap the ones already stored, returns the index of its first event
+  size_t merge(const MessageEvents &segment);
+  // removes events[first:last]
+  void erase(size_t first, size_t last);
+  // a copy of events[first:last]
+  MessageEvents slice(size_t first, size_t last) const;
+  void clear();
+  // bytes used by the stored events, and by the columns including their spare capacity
+  inline size_t bytes() const { return size() * (sizeof(uint64_t) + 1 + stride_); }
+  size_t memoryUsage() const;
+
+private:
+  void setStride(size_t stride);
+
+  std::vector<uint64_t> mono_times_;
+  std::vector<uint8_t> sizes_;
+  std::vector<uint8_t> data_;
+  size_t stride_ = 0;
+};
+
+typedef std::unordered_map<MessageId, MessageEvents> MessageEventsMap;
@@ -32,14 +32,13 @@ void ReplayStream::mergeSegments() {
     if (seg && seg->isLoaded() && !processed_segments.count(n)) {
       processed_segments.insert(n);
 
-      std::vector<const CanEvent *> new_events;
-      new_events.reserve(seg->log->events.size());
+      MessageEventsMap new_events;
       for (const Event &e : seg->log->events) {
         if (e.which == cereal::Event::Which::CAN) {
           capnp::FlatArrayMessageReader reader(e.data);
           auto event = reader.getRoot<cereal::Event>();
           for (const auto &c : event.getCan()) {
-            new_events.push_back(newEvent(e.mono_time, c));
+            addEvent(new_events, e.mono_time, c);
           }
         }
       }
@@ -0,0 +1,373 @@
+// Benchmarks cabana's hot paths on a synthetic route.
+//
+// usage: bench_cabana [minutes of route] [hours of live stream]
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <QDir>
+#include <QPointF>
+#include <QtConcurrent>
+
+#include "tools/cabana/dbc/signaldecoder.h"
+#include "tools/cabana/streams/abstractstream.h"
+#include "tools/cabana/streams/eventretention.h"
+#include "tools/cabana/tools/signalsearch.h"
+#include "tools/cabana/utils/util.h"
+
+template <class F>
+static double measure(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the per event layout the stream used before the columnar store
+struct CanEvent {
+  uint8_t src;
+  uint32_t address;
+  uint64_t mono_time;
+  uint8_t size;
+  uint8_t dat[];
+};
+
+// one message at 1kHz and forty at 100Hz, merged a minute at a time like a replay's segments
+struct Route {
+  Route(double minutes) : buffer(64 * 1024 * 1024) {
+    std::mt19937 rng(0);
+    const uint64_t duration = minutes * 60 * 1e9, segment_duration = 60 * 1e9;
+    uint8_t dat[8];
+    for (uint64_t start = 0; start < duration; start += segment_duration) {
+      MessageEventsMap segment;
+      std::vector<const CanEvent *> segment_events;
+      for (uint64_t t = start; t < std::min(start + segment_duration, duration); t += 1e6) {
+        for (int i = 0; i < (t % 10'000'000 == 0 ? 41 : 1); ++i) {
+          for (auto &b : dat) b = rng();
+          segment[{.source = 0, .address = uint32_t(0x100 + i)}].append(t, dat, sizeof(dat));
+
+          CanEvent *e = (CanEvent *)buffer.allocate(sizeof(CanEvent) + sizeof(dat));
+          e->src = 0;
+          e->address = 0x100 + i;
+          e->mono_time = t;
+          e->size = sizeof(dat);
+          memcpy(e->dat, dat, sizeof(dat));
+          segment_events.push_back(e);
+        }
+      }
+
+      merge_ms += measure([&]() {
+        for (const auto &[id, e] : segment) events[id].merge(e);
+      });
+      pointer_merge_ms += measure([&]() {
+        for (auto e : segment_events) pointer_events[{.source = e->src, .address = e->address}].push_back(e);
+        all_events.insert(all_events.end(), segment_events.begin(), segment_events.end());
+      });
+    }
+  }
+
+  size_t size() const { return all_events.size(); }
+
+  MessageEventsMap events;
+  double merge_ms = 0;
+
+  MonotonicBuffer buffer;
+  std::vector<const CanEvent *> all_events;
+  std::unordered_map<MessageId, std::vector<const CanEvent *>> pointer_events;
+  double pointer_merge_ms = 0;
+};
+
+static void bench_decode(const Route &route) {
+  const auto &events = route.events.at({.source = 0, .address = 0x100});
+  cabana::Signal sig = {};
+  sig.start_bit = 7;
+  sig.size = 16;
+  sig.is_signed = true;
+  sig.factor = 0.01;
+  updateMsbLsb(sig);
+
+  // what the chart did for every event of the signal's message
+  const auto &pointer_events = route.pointer_events.at({.source = 0, .address = 0x100});
+  std::vector<QPointF> vals;
+  vals.reserve(pointer_events.size());
+  const double per_event = measure([&]() {
+    double value = 0;
+    for (const CanEvent *e : pointer_events) {
+      if (sig.getValue(e->dat, e->size, &value)) {
+        vals.emplace_back(e->mono_time / 1e9, value);
+      }
+    }
+  });
+
+  std::vector<QPointF> decoded_vals;
+  decoded_vals.reserve(events.size());
+  const double decoded = measure([&]() {
+    std::vector<double> values(events.size());
+    cabana::SignalDecoder(sig).decode(events, 0, events.size(), values.data());
+    for (size_t i = 0; i < events.size(); ++i) {
+      if (!std::isnan(values[i])) {
+        decoded_vals.emplace_back(events.monoTime(i) / 1e9, values[i]);
+      }
+    }
+  });
+
+  bool same = vals == decoded_vals;
+  printf("decode %zu events: getValue on event pointers %.1f ms, SignalDecoder on columns %.1f ms (%.1fx)%s\n", events.size(), per_event, decoded,
+         per_event / decoded, same ? "" : ", VALUES DIFFER");
+}
+
+// what ChartView does for 12 charts: merge the route a minute at a time, then pan and zoom
+static void bench_charts(const Route &route) {
+  const int chart_count = 12, plot_width = 1600;
+  struct Chart {
+    MessageId msg_id;
+    cabana::Signal sig = {};
+    std::vector<QPointF> vals;
+    MinMaxPyramid pyramid;
+  };
+  std::vector<Chart> charts(chart_count);
+  for (int i = 0; i < chart_count; ++i) {
+    auto &c = charts[i];
+    c.msg_id = {.source = 0, .address = uint32_t(0x100 + i)};
+    c.sig.start_bit = (i * 8) % 64;
+    c.sig.size = 8 + i % 2 * 4;
+    c.sig.is_little_endian = true;
+    updateMsbLsb(c.sig);
+  }
+
+  std::vector<double> values;
+  const double merge = measure([&]() {
+    const uint64_t segment = 60 * 1e9;
+    for (uint64_t start = 0; start <= route.all_events.back()->mono_time; start += segment) {
+      for (auto &c : charts) {
+        const auto &events = route.events.at(c.msg_id);
+        const size_t first = events.lowerBound(start);
+        values.resize(events.lowerBound(start + segment) - first);
+        cabana::SignalDecoder(c.sig).decode(events, first, values.size(), values.data());
+        const size_t from = c.vals.size();
+        for (size_t i = 0; i < values.size(); ++i) c.vals.emplace_back(events.monoTime(first + i) / 1e9, values[i]);
+        c.pyramid.build(c.vals, from);
+      }
+    }
+  });
+  size_t total_points = 0;
+  for (auto &c : charts) total_points += c.vals.size();
+  printf("charts: merged %zu points into %d charts a minute at a time in %.1f ms\n", total_points, chart_count, merge);
+
+  // every frame of a pan updates the y axis and the series of each chart
+  const double route_seconds = charts[0].vals.back().x();
+  QVector<QPointF> points;
+  for (double range : {route_seconds, 600.0, 60.0, 10.0}) {
+    const int frames = 100;
+    size_t visible = 0, fed = 0;
+    const double ms = measure([&]() {
+      for (int f = 0; f < frames; ++f) {
+        const double x_min = (route_seconds - range) * f / frames, x_max = x_min + range;
+        for (auto &c : charts) {
+          auto first = std::lower_bound(c.vals.cbegin(), c.vals.cend(), x_min, [](auto &p, double x) { return p.x() < x; });
+          auto last = std::lower_bound(first, c.vals.cend(), x_max, [](auto &p, double x) { return p.x() < x; });
+          c.pyramid.minmax(c.vals, first - c.vals.cbegin(), last - c.vals.cbegin());
+          c.pyramid.decimate(c.vals, first - c.vals.cbegin(), last - c.vals.cbegin(), x_min, x_max, plot_width, points);
+          visible += last - first;
+          fed += points.size();
+        }
+      }
+    });
+    printf("charts: %6.0fs range: %.3f ms/frame, %8zu points in range, %5zu fed to QtCharts per frame\n",
+           range, ms / frames, visible / frames, fed / frames);
+  }
+}
+
+// memory of the stored events, and a bit statistics pass over all of them like find similar bits
+static void bench_store(const Route &route) {
+  size_t columns_bytes = 0;
+  for (const auto &[_, e] : route.events) columns_bytes += e.memoryUsage();
+  size_t pointer_bytes = route.buffer.size() + route.all_events.capacity() * sizeof(CanEvent *);
+  for (const auto &[_, e] : route.pointer_events) pointer_bytes += e.capacity() * sizeof(CanEvent *);
+  const double millions = route.size() / 1e6;
+  printf("store: %.1f MB per million events in columns, %.1f MB as event pointers\n",
+         columns_bytes / 1e6 / millions, pointer_bytes / 1e6 / millions);
+  printf("store: merged a minute at a time in %.1f ms into columns, %.1f ms as event pointers\n", route.merge_ms, route.pointer_merge_ms);
+
+  std::array<uint32_t, 64> pointer_counts = {}, column_counts = {};
+  const double pointer_scan = measure([&]() {
+    for (const auto &[_, events] : route.pointer_events) {
+      for (const CanEvent *e : events) {
+        for (int i = 0; i < e->size; ++i) {
+          for (int j = 0; j < 8; ++j) pointer_counts[i * 8 + j] += (e->dat[i] >> (7 - j)) & 1;
+        }
+      }
+    }
+  });
+  const double column_scan = measure([&]() {
+    for (const auto &[_, events] : route.events) {
+      for (size_t n = 0; n < events.size(); ++n) {
+        const uint8_t *dat = events.data(n);
+        for (int i = 0; i < events.dataSize(n); ++i) {
+          for (int j = 0; j < 8; ++j) column_counts[i * 8 + j] += (dat[i] >> (7 - j)) & 1;
+        }
+      }
+    }
+  });
+  printf("store: full scan %.1f ms over columns, %.1f ms over event pointers (%.1fx)%s\n", column_scan, pointer_scan,
+         pointer_scan / column_scan, pointer_counts == column_counts ? "" : ", COUNTS DIFFER");
+}
+
+// what FindSignalModel does for all the 8 bit little endian signals of all the messages
+static void bench_find_signal(const Route &route) {
+  std::vector<std::pair<MessageId, cabana::Signal>> sigs;
+  for (const auto &[id, _] : route.events) {
+    for (int start_bit = 0; start_bit <= 56; ++start_bit) {
+      cabana::Signal sig = {};
+      sig.start_bit = start_bit;
+      sig.size = 8;
+      sig.is_little_endian = true;
+      updateMsbLsb(sig);
+      sigs.push_back({id, sig});
+    }
+  }
+
+  std::unordered_map<MessageId, std::unique_ptr<SignalSearchEvents>> messages;
+  const double snapshot = measure([&]() {
+    std::vector<std::pair<MessageId, std::unique_ptr<SignalSearchEvents>>> snapshots;
+    for (const auto &[id, _] : route.events) snapshots.push_back({id, nullptr});
+    QtConcurrent::blockingMap(snapshots, [&](auto &s) {
+      const auto &events = route.events.at(s.first);
+      s.second = std::make_unique<SignalSearchEvents>(events, 0, events.size());
+    });
+    for (auto &[id, events] : snapshots) messages[id] = std::move(events);
+  });
+  printf("find signal: copied %zu messages for %zu signals in %.1f ms\n", messages.size(), sigs.size(), snapshot);
+
+  const std::pair<const char *, ValueCompare> searches[] = {
+    {"= 5", {.op = ValueCompare::Equal, .v1 = 5}},
+    {"between 100 and 101", {.op = ValueCompare::Between, .v1 = 100, .v2 = 101}},
+    {"> 255", {.op = ValueCompare::Greater, .v1 = 255}},
+  };
+  for (const auto &[name, cmp] : searches) {
+    // every signal decoded event by event until its first match
+    size_t decoded_matches = 0;
+    const double per_signal = measure([&]() {
+      for (const auto &[id, sig] : sigs) {
+        const auto &events = route.events.at(id);
+        const cabana::SignalDecoder decoder(sig);
+        for (size_t i = 0; i < events.size(); ++i) {
+          if (cmp(decoder.getRawValue(events.data(i), events.dataSize(i)))) {
+            ++decoded_matches;
+            break;
+          }
+        }
+      }
+    });
+
+    // tasks of up to 64 signals of a message, in parallel
+    struct Task {
+      const SignalSearchEvents *events;
+      std::vector<SignalSearchEvents::Candidate> candidates;
+    };
+    std::vector<Task> tasks;
+    for (const auto &[id, sig] : sigs) {
+      if (tasks.empty() || tasks.back().events != messages.at(id).get() || tasks.back().candidates.size() == 64) {
+        tasks.push_back({.events = messages.at(id).get()});
+      }
+      tasks.back().candidates.push_back({.sig = sig});
+    }
+    std::atomic<bool> canceled = false;
+    const double searched = measure([&]() {
+      QtConcurrent::blockingMap(tasks, [&](Task &t) { t.events->search(t.candidates, cmp, canceled); });
+    });
+    size_t matches = 0;
+    for (const auto &t : tasks) {
+      for (const auto &c : t.candidates) matches += c.match != SIZE_MAX;
+    }
+    printf("find signal %-20s: decoding each signal %7.1f ms, SignalSearchEvents in parallel %6.1f ms (%.0fx), %zu matches%s\n", name,
+           per_signal, searched, per_signal / searched, matches, matches == decoded_matches ? "" : ", MATCHES DIFFER");
+  }
+}
+
+// a counter, the message's address and a slow wave, compressible like real traffic
+static void live_payload(uint64_t t, int i, uint8_t dat[8]) {
+  const int16_t wave = std::sin(t / 1e9 * 0.1 + i) * 1000;
+  memset(dat, 0, 8);
+  dat[0] = t / 10'000'000;
+  dat[1] = i;
+  memcpy(dat + 2, &wave, sizeof(wave));
+}
+
+// what LiveStream does with EventRetention, on a feed at the route's rate merged every 100ms
+static void bench_retention(double hours) {
+  const double window_minutes = 10;
+  const std::string spill_dir = QDir::tempPath().toStdString() + "/bench_cabana_spill";
+  EventRetention retention(window_minutes * 60, 0, spill_dir);
+  MessageEventsMap events;
+  auto apply = [&](EventRetention::Update &&update) {
+    for (auto [from, to] : update.evict) {
+      for (auto &[_, e] : events) e.erase(e.lowerBound(from), e.lowerBound(to));
+    }
+    for (const auto &[id, e] : update.page_in) events[id].merge(e);
+  };
+
+  const uint64_t duration = hours * 3600 * 1e9, tick = 100'000'000;
+  size_t total = 0, peak_bytes = 0;
+  std::vector<double> tick_ms;
+  uint8_t dat[8];
+  for (uint64_t start = 0; start < duration; start += tick) {
+    for (uint64_t t = start; t < start + tick; t += 1e6) {
+      for (int i = 0; i < (t % 10'000'000 == 0 ? 41 : 1); ++i) {
+        live_payload(t, i, dat);
+        events[{.source = 0, .address = uint32_t(0x100 + i)}].append(t, dat, sizeof(dat));
+        ++total;
+      }
+    }
+    tick_ms.push_back(measure([&]() { apply(retention.update(events, start + tick - 1e6)); }));
+    size_t bytes = 0;
+    for (const auto &[_, e] : events) bytes += e.memoryUsage();
+    peak_bytes = std::max(peak_bytes, bytes);
+  }
+  size_t retained = 0;
+  for (const auto &[_, e] : events) retained += e.size();
+  const size_t unbounded_bytes = total * (sizeof(uint64_t) + 1 + sizeof(dat));
+  std::sort(tick_ms.begin(), tick_ms.end());
+  printf("retention: %.0f hours, %zu events, %.0f minute window: %zu events retained, peak %.1f MB (%.1f MB unbounded)\n",
+         hours, total, window_minutes, retained, peak_bytes / 1e6, unbounded_bytes / 1e6);
+  printf("retention: per 100ms update p50 %.3f ms, max %.1f ms, %.1f MB spilled\n",
+         tick_ms[tick_ms.size() / 2], tick_ms.back(), retention.spilledBytes() / 1e6);
+
+  // seek back to the first hour, then return to live
+  const uint64_t seek = std::min<uint64_t>(3600 * 1e9, duration / 2);
+  const double page_in = measure([&]() { apply(retention.update(events, seek)); });
+  bool same = true;
+  size_t paged = 0;
+  for (const auto &[id, e] : events) {
+    for (size_t n = 0, last = e.lowerBound(seek + tick); n < last; ++n, ++paged) {
+      live_payload(e.monoTime(n), id.address - 0x100, dat);
+      same &= memcmp(e.data(n), dat, sizeof(dat)) == 0;
+    }
+  }
+  const double page_out = measure([&]() { apply(retention.update(events, duration - 1e6)); });
+  printf("retention: seeking back paged in %zu events in %.1f ms, returning to live evicted them in %.1f ms%s\n",
+         paged, page_in, page_out, same ? "" : ", PAYLOADS DIFFER");
+}
+
+int main(int argc, char *argv[]) {
+  const double minutes = argc > 1 ? atof(argv[1]) : 60;
+  Route route(minutes);
+  printf("%.0f minute route, %zu events\n", minutes, route.size());
+
+  bench_store(route);
+  bench_decode(route);
+  bench_charts(route);
+  bench_find_signal(route);
+  bench_retention(argc > 2 ? atof(argv[2]) : 8);
+  return 0;
+}
@@ -1,9 +1,21 @@
 
 #undef INFO
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <string>
+#include <tuple>
+
 #include <QDir>
 
 #include "catch2/catch.hpp"
 #include "tools/cabana/dbc/dbcmanager.h"
+#include "tools/cabana/dbc/signaldecoder.h"
+#include "tools/cabana/streams/eventretention.h"
+#include "tools/cabana/streams/messageevents.h"
+#include "tools/cabana/tools/signalsearch.h"
+#include "tools/cabana/utils/util.h"
 
 const std::string TEST_RLOG_URL = "https://commadataci.blob.core.windows.net/openpilotci/0c94aa1e1296d7c6/2021-05-05--19-48-37/0/rlog.bz2";
 
@@ -155,3 +167,215 @@ TEST_CASE("parse_opendbc") {
   INFO(errors.join("\n").toStdString());
   REQUIRE(errors.empty());
 }
+
+TEST_CASE("SignalDecoder") {
+  const int msg_sizes[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+  std::mt19937 rng(0);
+  uint8_t data[64];
+  for (int i = 0; i < 20000; ++i) {
+    const int msg_size = msg_sizes[rng() % std::size(msg_sizes)];
+    cabana::Signal sig = {};
+    sig.size = 1 + rng() % 63;
+    sig.start_bit = rng() % std::max(msg_size * 8, 1);
+    sig.is_little_endian = rng() % 2;
+    sig.is_signed = rng() % 2;
+    sig.factor = (rng() % 2) ? 1 : 0.25;
+    sig.offset = rng() % 3;
+    updateMsbLsb(sig);
+
+    const cabana::SignalDecoder decoder(sig);
+    for (auto &b : data) b = rng();
+    // also messages too short to hold the whole signal
+    for (int size : {msg_size, (int)(rng() % 65)}) {
+      INFO("start_bit " << sig.start_bit << " size " << sig.size << " little_endian " << sig.is_little_endian << " data_size " << size);
+      REQUIRE(decoder.getRawValue(data, size) == get_raw_value(data, size, sig));
+    }
+  }
+}
+
+TEST_CASE("SignalDecoder - multiplexed") {
+  DBCFile file("", R"(BO_ 162 message_1: 8 XXX
+  SG_ mux M : 0|4@1+ (1,0) [0|15] "" XXX
+  SG_ sig_4 m4 : 8|16@0- (0.5,1) [0|1] "" XXX
+  SG_ sig_5 m5 : 12|12@1+ (1,0) [0|1] "" XXX
+)");
+  auto msg = file.msg(162);
+  for (auto sig : msg->sigs) {
+    const cabana::SignalDecoder decoder(*sig);
+    for (uint8_t mux : {4, 5, 6}) {
+      const uint8_t data[8] = {mux, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde};
+      double value = 0, expected = 0;
+      const bool present = sig->getValue(data, std::size(data), &expected);
+      REQUIRE(decoder.getValue(data, std::size(data), &value) == present);
+      if (present) REQUIRE(value == expected);
+    }
+  }
+}
+
+TEST_CASE("MessageEvents") {
+  // segments of a message whose size changes, merged out of order
+  std::mt19937 rng(0);
+  std::vector<std::tuple<uint64_t, std::vector<uint8_t>>> expected;
+  MessageEvents events;
+  for (int start : {3, 0, 5, 1, 4, 2}) {
+    MessageEvents segment;
+    for (int i = 0; i < 100; ++i) {
+      const uint64_t mono_time = start * 1000 + i * 10;
+      std::vector<uint8_t> dat(start == 4 && i == 50 ? 64 : 1 + start);
+      for (auto &b : dat) b = rng();
+      segment.append(mono_time, dat.data(), dat.size());
+      expected.emplace_back(mono_time, dat);
+    }
+    REQUIRE(events.merge(segment) == events.lowerBound(start * 1000));
+  }
+  std::sort(expected.begin(), expected.end());
+
+  REQUIRE(events.size() == expected.size());
+  REQUIRE(events.stride() == 64);
+  for (size_t i = 0; i < events.size(); ++i) {
+    auto &[mono_time, dat] = expected[i];
+    REQUIRE(events.monoTime(i) == mono_time);
+    REQUIRE(std::vector<uint8_t>(events.data(i), events.data(i) + events.dataSize(i)) == dat);
+  }
+  REQUIRE(events.lowerBound(1000) == 100);
+  REQUIRE(events.upperBound(1000) == 101);
+  REQUIRE(events.upperBound(10000) == events.size());
+
+  // the decoder reads the payloads at the store's stride
+  cabana::Signal sig = {};
+  sig.start_bit = 0;
+  sig.size = 8;
+  sig.is_little_endian = true;
+  updateMsbLsb(sig);
+  std::vector<double> values(events.size());
+  cabana::SignalDecoder(sig).decode(events, 0, events.size(), values.data());
+  for (size_t i = 0; i < events.size(); ++i) {
+    REQUIRE(values[i] == get_raw_value(events.data(i), events.dataSize(i), sig));
+  }
+}
+
+TEST_CASE("EventRetention") {
+  auto payload = [](uint64_t mono_time, uint32_t address) {
+    std::vector<uint8_t> dat(8);
+    const uint64_t v = mono_time ^ (address * 0x9e3779b97f4a7c15);
+    memcpy(dat.data(), &v, sizeof(v));
+    return dat;
+  };
+  MessageEventsMap events;
+  auto apply = [&](EventRetention::Update &&update) {
+    for (auto [from, to] : update.evict) {
+      for (auto &[_, e] : events) e.erase(e.lowerBound(from), e.lowerBound(to));
+    }
+    for (const auto &[id, e] : update.page_in) events[id].merge(e);
+  };
+
+  // ten minutes of two messages at 100Hz, merged every 100ms into a one minute window
+  const uint64_t step = 10'000'000, window = 60e9, chunk = window / 10;
+  const std::string spill_dir = QDir::tempPath().toStdString() + "/test_cabana_spill";
+  EventRetention retention(window / 1e9, 0, spill_dir);
+  uint64_t t = 0;
+  for (; t < 10 * window; t += step) {
+    for (uint32_t address : {0x100, 0x200}) {
+      auto dat = payload(t, address);
+      events[{.source = 0, .address = address}].append(t, dat.data(), dat.size());
+    }
+    if ((t + step) % (10 * step) == 0) apply(retention.update(events, t));
+  }
+  const uint64_t latest = t - step;
+  for (const auto &[_, e] : events) {
+    REQUIRE(latest - e.monoTime(0) >= window);
+    REQUIRE(latest - e.monoTime(0) <= window + chunk);
+  }
+  REQUIRE(retention.begin() == 0);
+
+  // seeking back pages the spilled events around the position in
+  const uint64_t seek = 3 * window;
+  apply(retention.update(events, seek));
+  for (const auto &[id, e] : events) {
+    const size_t first = e.lowerBound(seek - window / 3), last = e.upperBound(seek + window / 3);
+    REQUIRE(last - first == 2 * window / 3 / step + 1);
+    for (size_t i = first; i < last; ++i) {
+      REQUIRE(std::vector<uint8_t>(e.data(i), e.data(i) + e.dataSize(i)) == payload(e.monoTime(i), id.address));
+    }
+    REQUIRE(e.monoTime(e.size() - 1) == latest);
+  }
+
+  // and returning to live evicts them again
+  apply(retention.update(events, latest));
+  for (const auto &[_, e] : events) {
+    REQUIRE(latest - e.monoTime(0) <= window + chunk);
+  }
+}
+
+TEST_CASE("SignalSearchEvents") {
+  // bits that change slowly, like most signals, and a message that changes size
+  std::mt19937 rng(0);
+  MessageEvents events;
+  uint8_t dat[8] = {};
+  for (int i = 0; i < 5000; ++i) {
+    dat[rng() % 8] ^= 1 << (rng() % 8);
+    events.append(i * 10, dat, i > 4000 && i < 4100 ? 4 : 8);
+  }
+  SignalSearchEvents search(events, 100, events.size());
+  const auto &searched = search.events();
+  REQUIRE(searched.size() == events.size() - 100);
+
+  for (int op = ValueCompare::Equal; op <= ValueCompare::Between; ++op) {
+    const ValueCompare cmp = {.op = (ValueCompare::Op)op, .v1 = 3, .v2 = 5};
+    std::vector<SignalSearchEvents::Candidate> candidates;
+    for (int size : {1, 4, 12}) {
+      for (int start_bit = 0; start_bit < 64; start_bit += 5) {
+        cabana::Signal sig = {};
+        sig.start_bit = start_bit;
+        sig.size = size;
+        sig.is_little_endian = start_bit % 2;
+        sig.is_signed = start_bit % 3 == 0;
+        sig.factor = start_bit % 4 == 0 ? -0.5 : 1;
+        updateMsbLsb(sig);
+        candidates.push_back({.sig = sig, .first = rng() % searched.size()});
+      }
+    }
+    std::atomic<bool> canceled = false;
+    search.search(candidates, cmp, canceled);
+    for (const auto &c : candidates) {
+      size_t match = SIZE_MAX;
+      for (size_t i = c.first; i < searched.size() && match == SIZE_MAX; ++i) {
+        if (cmp(get_raw_value(searched.data(i), searched.dataSize(i), c.sig))) match = i;
+      }
+      REQUIRE(c.match == match);
+    }
+  }
+}
+
+TEST_CASE("MinMaxPyramid") {
+  std::mt19937 rng(0);
+  std::vector<QPointF> pts;
+  MinMaxPyramid pyramid;
+  for (int i = 0; i < 50; ++i) {
+    // merge a segment at the end or in the middle, like the stream does
+    size_t from = (rng() % 2 && !pts.empty()) ? rng() % pts.size() : pts.size();
+    std::vector<QPointF> segment(rng() % 1000);
+    for (auto &p : segment) p.setY(rng() % 1000);
+    pts.insert(pts.begin() + from, segment.begin(), segment.end());
+    for (size_t j = 0; j < pts.size(); ++j) pts[j].setX(j);
+    pyramid.build(pts, from);
+
+    for (int j = 0; j < 100 && !pts.empty(); ++j) {
+      size_t first = rng() % pts.size();
+      size_t last = first + 1 + rng() % (pts.size() - first);
+      auto [min, max] = std::minmax_element(pts.begin() + first, pts.begin() + last, [](auto &l, auto &r) { return l.y() < r.y(); });
+      REQUIRE(pyramid.minmax(pts, first, last) == std::pair{min->y(), max->y()});
+
+      // the decimated points keep the range's min and max, in order
+      const int buckets = 1 + rng() % 100;
+      QVector<QPointF> out;
+      pyramid.decimate(pts, first, last, pts[first].x(), pts[last - 1].x() + 1, buckets, out);
+      REQUIRE(out.size() <= 2 * buckets + 2);
+      REQUIRE(std::is_sorted(out.begin(), out.end(), [](auto &l, auto &r) { return l.x() < r.x(); }));
+      auto begin = out.begin() + (first > 0), end = out.end() - (last < pts.size());
+      auto [out_min, out_max] = std::minmax_element(begin, end, [](auto &l, auto &r) { return l.y() < r.y(); });
+      REQUIRE(out_min->y() == min->y());
+      REQUIRE(out_max->y() == max->y());
+    }
+  }
+}
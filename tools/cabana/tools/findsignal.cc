@@ -1,15 +1,27 @@
 #include "tools/cabana/tools/findsignal.h"
 
+#include <limits>
+
 #include <QFormLayout>
 #include <QHBoxLayout>
 #include <QHeaderView>
 #include <QMenu>
 #include <QtConcurrent>
-#include <QTimer>
 #include <QVBoxLayout>
 
 // FindSignalModel
 
+FindSignalModel::FindSignalModel(QObject *parent) : QAbstractTableModel(parent) {
+  append_timer.setInterval(100);
+  QObject::connect(&append_timer, &QTimer::timeout, this, &FindSignalModel::appendMatches);
+  QObject::connect(&watcher, &QFutureWatcher<void>::finished, this, &FindSignalModel::searchFinished);
+}
+
+FindSignalModel::~FindSignalModel() {
+  watcher.disconnect();
+  cancel();
+}
+
 QVariant FindSignalModel::headerData(int section, Qt::Orientation orientation, int role) const {
   static QString titles[] = {"Id", "Start Bit, size", "(time, value)"};
   if (role != Qt::DisplayRole) return {};
@@ -28,34 +40,89 @@ QVariant FindSignalModel::data(const QModelIndex &index, int role) const {
   return {};
 }
 
-void FindSignalModel::search(std::function<bool(double)> cmp) {
-  beginResetModel();
-
-  std::mutex lock;
+void FindSignalModel::search(const ValueCompare &compare) {
   const auto prev_sigs = !histories.isEmpty() ? histories.back() : initial_signals;
+  tasks.clear();
+  std::unordered_map<MessageId, size_t> open_tasks;
+  for (const auto &s : prev_sigs) {
+    auto it = open_tasks.find(s.id);
+    if (it == open_tasks.end() || tasks[it->second].sigs.size() == 64) {
+      it = open_tasks.insert_or_assign(s.id, tasks.size()).first;
+      tasks.push_back({.id = s.id});
+    }
+    tasks[it->second].sigs.push_back(s);
+  }
+
+  cmp = compare;
+  canceled = false;
+  watcher.setFuture(QtConcurrent::map(tasks, [this](const SearchTask &task) { searchTask(task); }));
+  append_timer.start();
+
+  beginResetModel();
   filtered_signals.clear();
   filtered_signals.reserve(prev_sigs.size());
-  QtConcurrent::blockingMap(prev_sigs, [&](auto &s) {
-    const auto &events = can->events(s.id);
-    auto first = std::upper_bound(events.cbegin(), events.cend(), s.mono_time, CompareCanEvent());
-    auto last = events.cend();
-    if (last_time < std::numeric_limits<uint64_t>::max()) {
-      last = std::upper_bound(events.cbegin(), events.cend(), last_time, CompareCanEvent());
-    }
+  endResetModel();
+}
 
-    auto it = std::find_if(first, last, [&](const CanEvent *e) { return cmp(get_raw_value(e->dat, e->size, s.sig)); });
-    if (it != last) {
+void FindSignalModel::searchTask(const SearchTask &task) {
+  const auto &message = *messages.at(task.id);
+  const auto &events = message.events();
+  std::vector<SignalSearchEvents::Candidate> candidates;
+  candidates.reserve(task.sigs.size());
+  for (const auto &s : task.sigs) {
+    candidates.push_back({.sig = s.sig, .first = events.upperBound(s.mono_time)});
+  }
+  message.search(candidates, cmp, canceled);
+
+  QList<SearchSignal> matches;
+  for (int i = 0; i < task.sigs.size(); ++i) {
+    if (const size_t n = candidates[i].match; n != SIZE_MAX) {
+      const auto &s = task.sigs[i];
+      const double value = get_raw_value(events.data(n), events.dataSize(n), s.sig);
       auto values = s.values;
-      values += QString("(%1, %2)").arg(can->toSeconds((*it)->mono_time), 0, 'f', 3).arg(get_raw_value((*it)->dat, (*it)->size, s.sig));
-      std::lock_guard lk(lock);
-      filtered_signals.push_back({.id = s.id, .mono_time = (*it)->mono_time, .sig = s.sig, .values = values});
+      values += QString("(%1, %2)").arg(can->toSeconds(events.monoTime(n)), 0, 'f', 3).arg(value);
+      matches.push_back({.id = s.id, .mono_time = events.monoTime(n), .sig = s.sig, .values = values});
     }
-  });
-  histories.push_back(filtered_signals);
+  }
+  std::lock_guard lk(lock);
+  pending_matches += matches;
+}
 
+void FindSignalModel::appendMatches() {
+  QList<SearchSignal> matches;
+  {
+    std::lock_guard lk(lock);
+    matches.swap(pending_matches);
+  }
+  const int rows = rowCount();
+  const int new_rows = std::min(filtered_signals.size() + matches.size(), 300);
+  if (new_rows > rows) beginInsertRows({}, rows, new_rows - 1);
+  filtered_signals += matches;
+  if (new_rows > rows) endInsertRows();
+  emit searchProgress();
+}
+
+void FindSignalModel::searchFinished() {
+  append_timer.stop();
+  beginResetModel();
+  if (canceled) {
+    pending_matches.clear();
+    filtered_signals.clear();
+    if (!histories.isEmpty()) filtered_signals = histories.back();
+  } else {
+    filtered_signals += pending_matches;
+    pending_matches.clear();
+    histories.push_back(filtered_signals);
+  }
   endResetModel();
 }
 
+void FindSignalModel::cancel() {
+  canceled = true;
+  watcher.cancel();
+  watcher.waitForFinished();
+}
+
 void FindSignalModel::undo() {
   if (!histories.isEmpty()) {
     beginResetModel();
@@ -71,6 +138,7 @@ void FindSignalModel::reset() {
   histories.clear();
   filtered_signals.clear();
   initial_signals.clear();
+  messages.clear();
   endResetModel();
 }
 
@@ -160,6 +228,7 @@ FindSignalDlg::FindSignalDlg(QWidget *parent) : QDialog(parent, Qt::WindowFlags(
   QObject::connect(search_btn, &QPushButton::clicked, this, &FindSignalDlg::search);
   QObject::connect(undo_btn, &QPushButton::clicked, model, &FindSignalModel::undo);
   QObject::connect(model, &QAbstractItemModel::modelReset, this, &FindSignalDlg::modelReset);
+  QObject::connect(model, &FindSignalModel::searchProgress, this, &FindSignalDlg::updateStats);
   QObject::connect(reset_btn, &QPushButton::clicked, model, &FindSignalModel::reset);
   QObject::connect(view, &QTableView::customContextMenuRequested, this, &FindSignalDlg::customMenuRequested);
   QObject::connect(view, &QTableView::doubleClicked, [this](const QModelIndex &index) {
@@ -172,27 +241,24 @@ FindSignalDlg::FindSignalDlg(QWidget *parent) : QDialog(parent, Qt::WindowFlags(
 }
 
 void FindSignalDlg::search() {
+  if (model->searching()) {
+    model->cancel();
+    return;
+  }
   if (model->histories.isEmpty()) {
     setInitialSignals();
   }
-  auto v1 = value1->text().toDouble();
-  auto v2 = value2->text().toDouble();
-  std::function<bool(double)> cmp = nullptr;
-  switch (compare_cb->currentIndex()) {
-    case 0: cmp = [v1](double v) { return v == v1;}; break;
-    case 1: cmp = [v1](double v) { return v > v1;}; break;
-    case 2: cmp = [v1](double v) { return v >= v1;}; break;
-    case 3: cmp = [v1](double v) { return v != v1;}; break;
-    case 4: cmp = [v1](double v) { return v < v1;}; break;
-    case 5: cmp = [v1](double v) { return v <= v1;}; break;
-    case 6: cmp = [v1, v2](double v) { return v >= v1 && v <= v2;}; break;
-  }
+  // the operators are in the order of compare_cb
+  const ValueCompare cmp = {.op = (ValueCompare::Op)compare_cb->currentIndex(),
+                            .v1 = value1->text().toDouble(),
+                            .v2 = value2->text().toDouble()};
   properties_group->setEnabled(false);
   message_group->setEnabled(false);
-  search_btn->setEnabled(false);
-  stats_label->setVisible(false);
-  search_btn->setText("Finding ....");
-  QTimer::singleShot(0, this, [=]() { model->search(cmp); });
+  undo_btn->setEnabled(false);
+  reset_btn->setEnabled(false);
+  search_btn->setText(tr("Cancel"));
+  model->search(cmp);
+  updateStats();
 }
 
 void FindSignalDlg::setInitialSignals() {
@@ -218,17 +284,19 @@ void FindSignalDlg::setInitialSignals() {
   double last_time_val = last_time_edit->text().toDouble();
   auto [first_sec, last_sec] = std::minmax(first_time_val, last_time_val);
   uint64_t first_time = can->toMonoTime(first_sec);
-  model->last_time = std::numeric_limits<uint64_t>::max();
+  uint64_t last_time = std::numeric_limits<uint64_t>::max();
   if (last_sec > 0) {
-    model->last_time = can->toMonoTime(last_sec);
+    last_time = can->toMonoTime(last_sec);
   }
   model->initial_signals.clear();
+  std::vector<std::pair<MessageId, std::unique_ptr<SignalSearchEvents>>> messages;
 
   for (const auto &[id, m] : can->lastMessages()) {
     if (buses.isEmpty() || buses.contains(id.source) && (addresses.isEmpty() || addresses.contains(id.address))) {
       const auto &events = can->events(id);
-      auto e = std::lower_bound(events.cbegin(), events.cend(), first_time, CompareCanEvent());
-      if (e != events.cend()) {
+      const size_t e = events.lowerBound(first_time);
+      if (e < events.size()) {
+        messages.push_back({id, nullptr});
         const int total_size = m.dat.size() * 8;
         for (int size = min_size->value(); size <= max_size->value(); ++size) {
           for (int start = 0; start <= total_size - size; ++start) {
@@ -236,16 +304,28 @@ void FindSignalDlg::setInitialSignals() {
             s.sig.start_bit = start;
             s.sig.size = size;
             updateMsbLsb(s.sig);
-            s.value = get_raw_value((*e)->dat, (*e)->size, s.sig);
+            s.value = get_raw_value(events.data(e), events.dataSize(e), s.sig);
             model->initial_signals.push_back(s);
           }
         }
       }
     }
   }
+
+  // the searches run in the background, on a copy of the events
+  QtConcurrent::blockingMap(messages, [=](auto &m) {
+    const auto &events = can->events(m.first);
+    m.second = std::make_unique<SignalSearchEvents>(events, events.lowerBound(first_time), events.upperBound(last_time));
+  });
+  model->messages.clear();
+  for (auto &[id, events] : messages) {
+    model->messages[id] = std::move(events);
+  }
 }
 
 void FindSignalDlg::modelReset() {
+  if (model->searching()) return;
+
   properties_group->setEnabled(model->histories.isEmpty());
   message_group->setEnabled(model->histories.isEmpty());
   search_btn->setText(model->histories.isEmpty() ? tr("Find") : tr("Find Next"));
@@ -256,6 +336,12 @@ void FindSignalDlg::modelReset() {
   stats_label->setText(tr("%1 matches. right click on an item to create signal. double click to open message").arg(model->filtered_signals.size()));
 }
 
+void FindSignalDlg::updateStats() {
+  if (model->searching()) {
+    stats_label->setText(tr("Finding... %1 matches, %2% searched").arg(model->filtered_signals.size()).arg(model->progress()));
+  }
+}
+
 void FindSignalDlg::customMenuRequested(const QPoint &pos) {
   if (auto index = view->indexAt(pos); index.isValid()) {
     QMenu menu(this);
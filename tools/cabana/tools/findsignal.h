@@ -1,18 +1,27 @@
 #pragma once
 
 #include <algorithm>
-#include <limits>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <QAbstractTableModel>
 #include <QCheckBox>
+#include <QFutureWatcher>
 #include <QLabel>
 #include <QPushButton>
 #include <QTableView>
+#include <QTimer>
 
 #include "tools/cabana/commands.h"
 #include "tools/cabana/settings.h"
+#include "tools/cabana/tools/signalsearch.h"
 
 class FindSignalModel : public QAbstractTableModel {
+  Q_OBJECT
+
 public:
   struct SearchSignal {
     MessageId id = {};
@@ -22,19 +31,46 @@ public:
     QStringList values;
   };
 
-  FindSignalModel(QObject *parent) : QAbstractTableModel(parent) {}
+  FindSignalModel(QObject *parent);
+  ~FindSignalModel();
   QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
   QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
   int columnCount(const QModelIndex &parent = QModelIndex()) const override { return 3; }
   int rowCount(const QModelIndex &parent = QModelIndex()) const override { return std::min(filtered_signals.size(), 300); }
-  void search(std::function<bool(double)> cmp);
+  // searches in the background, adding the matches as they are found
+  void search(const ValueCompare &cmp);
+  void cancel();
+  inline bool searching() const { return watcher.isRunning(); }
+  inline int progress() const { return watcher.progressMaximum() > 0 ? watcher.progressValue() * 100 / watcher.progressMaximum() : 0; }
   void reset();
   void undo();
 
   QList<SearchSignal> filtered_signals;
   QList<SearchSignal> initial_signals;
   QList<QList<SearchSignal>> histories;
-  uint64_t last_time = std::numeric_limits<uint64_t>::max();
+  // the events searched in, copied from the stream with the initial signals
+  std::unordered_map<MessageId, std::unique_ptr<SignalSearchEvents>> messages;
+
+signals:
+  void searchProgress();
+
+private:
+  // up to 64 signals of a message, evaluated together over its events
+  struct SearchTask {
+    MessageId id;
+    QList<SearchSignal> sigs;
+  };
+  void searchTask(const SearchTask &task);
+  void appendMatches();
+  void searchFinished();
+
+  ValueCompare cmp;
+  std::vector<SearchTask> tasks;
+  std::atomic<bool> canceled = false;
+  std::mutex lock;
+  QList<SearchSignal> pending_matches;
+  QFutureWatcher<void> watcher;
+  QTimer append_timer;
 };
 
 class FindSignalDlg : public QDialog {
@@ -48,6 +84,7 @@ signals:
 private:
   void search();
   void modelReset();
+  void updateStats();
   void setInitialSignals();
   void customMenuRequested(const QPoint &pos);
 
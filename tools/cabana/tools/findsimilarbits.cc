@@ -1,6 +1,9 @@
 #include "tools/cabana/tools/findsimilarbits.h"
 
 #include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
 
 #include <QGridLayout>
 #include <QHeaderView>
@@ -9,6 +12,7 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QRadioButton>
+#include <QtConcurrent>
 
 #include "tools/cabana/dbc/dbcmanager.h"
 #include "tools/cabana/streams/abstractstream.h"
@@ -114,44 +118,91 @@ void FindSimilarBitsDlg::find() {
   search_btn->setEnabled(true);
 }
 
-QList<FindSimilarBitsDlg::mismatched_struct> FindSimilarBitsDlg::calcBits(uint8_t bus, uint32_t selected_address, int byte_idx,
-                                                                          int bit_idx, uint8_t find_bus, bool equal, int min_msgs_cnt) {
-  QHash<uint32_t, QVector<uint32_t>> mismatches;
-  QHash<uint32_t, uint32_t> msg_count;
-  const auto &events = can->allEvents();
-  int bit_to_find = -1;
-  for (const CanEvent *e : events) {
-    if (e->src == bus) {
-      if (e->address == selected_address && e->size > byte_idx) {
-        bit_to_find = ((e->dat[byte_idx] >> (7 - bit_idx)) & 1) != 0;
+// the ones of each payload bit, and the events of each size, for the events where the bit to find is 0 and 1
+struct BitCounts {
+  std::array<std::vector<uint32_t>, 2> ones;
+  std::array<std::array<uint32_t, 65>, 2> sizes = {};
+};
+
+// a byte wide counter per bit of eight payload bytes is added at a time, and flushed before it overflows
+static void countBits(const MessageEvents &events, const MessageEvents &selected, int byte_idx, int bit_idx, BitCounts &counts) {
+  const size_t stride = events.stride(), words = (stride + 7) / 8;
+  std::array<std::vector<uint64_t>, 2> lanes;
+  std::array<int, 2> pending = {};
+  for (int t : {0, 1}) {
+    lanes[t].assign(words * 8, 0);
+    counts.ones[t].assign(words * 64, 0);
+  }
+  auto flush = [&](int t) {
+    for (size_t w = 0; w < words; ++w) {
+      for (int j = 0; j < 8; ++j) {
+        for (int k = 0; k < 8; ++k) {
+          counts.ones[t][(w * 8 + k) * 8 + 7 - j] += (lanes[t][w * 8 + j] >> (k * 8)) & 0xff;
+        }
+        lanes[t][w * 8 + j] = 0;
       }
     }
-    if (e->src == find_bus) {
-      ++msg_count[e->address];
-      if (bit_to_find == -1) continue;
+    pending[t] = 0;
+  };
 
-      auto &mismatched = mismatches[e->address];
-      if (mismatched.size() < e->size * 8) {
-        mismatched.resize(e->size * 8);
-      }
-      for (int i = 0; i < e->size; ++i) {
-        for (int j = 0; j < 8; ++j) {
-          int bit = ((e->dat[i] >> (7 - j)) & 1) != 0;
-          mismatched[i * 8 + j] += equal ? (bit != bit_to_find) : (bit == bit_to_find);
-        }
+  // walk the selected message along, for the bit's latest value at each event
+  int bit_to_find = -1;
+  size_t k = 0;
+  for (size_t n = 0; n < events.size(); ++n) {
+    for (; k < selected.size() && selected.monoTime(k) <= events.monoTime(n); ++k) {
+      if (selected.dataSize(k) > byte_idx) {
+        bit_to_find = ((selected.data(k)[byte_idx] >> (7 - bit_idx)) & 1) != 0;
       }
     }
+    if (bit_to_find == -1) continue;
+
+    const uint8_t *dat = events.data(n);
+    uint64_t *lane = lanes[bit_to_find].data();
+    for (size_t w = 0; w < words; ++w) {
+      uint64_t v = 0;
+      memcpy(&v, dat + w * 8, std::min<size_t>(8, stride - w * 8));
+      for (int j = 0; j < 8; ++j) lane[w * 8 + j] += (v >> j) & 0x0101010101010101ULL;
+    }
+    ++counts.sizes[bit_to_find][events.dataSize(n)];
+    if (++pending[bit_to_find] == 255) flush(bit_to_find);
   }
+  flush(0);
+  flush(1);
+}
+
+QList<FindSimilarBitsDlg::mismatched_struct> FindSimilarBitsDlg::calcBits(uint8_t bus, uint32_t selected_address, int byte_idx,
+                                                                          int bit_idx, uint8_t find_bus, bool equal, int min_msgs_cnt) {
+  struct Task {
+    uint32_t address;
+    const MessageEvents *events;
+    BitCounts counts;
+  };
+  std::vector<Task> tasks;
+  for (const auto &[id, events] : can->eventsMap()) {
+    if (id.source == find_bus) tasks.push_back({.address = id.address, .events = &events});
+  }
+  const auto &selected = can->events({.source = bus, .address = selected_address});
+  QtConcurrent::blockingMap(tasks, [&](Task &t) { countBits(*t.events, selected, byte_idx, bit_idx, t.counts); });
 
   QList<mismatched_struct> result;
-  result.reserve(mismatches.size());
-  for (auto it = mismatches.begin(); it != mismatches.end(); ++it) {
-    if (auto cnt = msg_count[it.key()]; cnt > min_msgs_cnt) {
-      auto &mismatched = it.value();
-      for (int i = 0; i < mismatched.size(); ++i) {
-        if (float perc = (mismatched[i] / (double)cnt) * 100; perc < 50) {
-          result.push_back({it.key(), (uint32_t)i / 8, (uint32_t)i % 8, mismatched[i], cnt, perc});
-        }
+  for (const auto &t : tasks) {
+    const uint32_t cnt = t.events->size();
+    if (cnt <= min_msgs_cnt) continue;
+
+    // the events of each target bit value whose payload has each byte
+    std::array<std::array<uint32_t, 65>, 2> present = {};
+    int max_size = 0;
+    for (int v : {0, 1}) {
+      for (int size = 64; size > 0; --size) {
+        present[v][size - 1] = present[v][size] + t.counts.sizes[v][size];
+        if (t.counts.sizes[v][size] > 0) max_size = std::max(max_size, size);
+      }
+    }
+    for (int i = 0; i < max_size * 8; ++i) {
+      const uint32_t ones0 = t.counts.ones[0][i], ones1 = t.counts.ones[1][i];
+      const uint32_t mismatched = equal ? (present[1][i / 8] - ones1) + ones0 : ones1 + (present[0][i / 8] - ones0);
+      if (float perc = (mismatched / (double)cnt) * 100; perc < 50) {
+        result.push_back({t.address, (uint32_t)i / 8, (uint32_t)i % 8, mismatched, cnt, perc});
       }
     }
   }
@@ -0,0 +1,163 @@
+#include "tools/cabana/tools/signalsearch.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "tools/cabana/dbc/signaldecoder.h"
+
+// ValueCompare
+
+bool ValueCompare::operator()(double v) const {
+  switch (op) {
+    case Equal: return v == v1;
+    case Greater: return v > v1;
+    case GreaterEqual: return v >= v1;
+    case NotEqual: return v != v1;
+    case Less: return v < v1;
+    case LessEqual: return v <= v1;
+    case Between: return v >= v1 && v <= v2;
+  }
+  return false;
+}
+
+bool ValueCompare::mayMatch(double min, double max) const {
+  switch (op) {
+    case Equal: return min <= v1 && v1 <= max;
+    case Greater: return max > v1;
+    case GreaterEqual: return max >= v1;
+    case NotEqual: return min != v1 || max != v1;
+    case Less: return min < v1;
+    case LessEqual: return min <= v1;
+    case Between: return max >= v1 && min <= v2;
+  }
+  return true;
+}
+
+// checks the whole block without branching, which vectorizes, before looking for the first match in it
+template <class Pred>
+static size_t findFirst(const double *values, size_t count, Pred pred) {
+  bool any = false;
+  for (size_t i = 0; i < count; ++i) any |= pred(values[i]);
+  if (!any) return count;
+  return std::find_if(values, values + count, pred) - values;
+}
+
+size_t ValueCompare::find(const double *values, size_t count) const {
+  const double a = v1, b = v2;
+  switch (op) {
+    case Equal: return findFirst(values, count, [a](double v) { return v == a; });
+    case Greater: return findFirst(values, count, [a](double v) { return v > a; });
+    case GreaterEqual: return findFirst(values, count, [a](double v) { return v >= a; });
+    case NotEqual: return findFirst(values, count, [a](double v) { return v != a; });
+    case Less: return findFirst(values, count, [a](double v) { return v < a; });
+    case LessEqual: return findFirst(values, count, [a](double v) { return v <= a; });
+    case Between: return findFirst(values, count, [a, b](double v) { return v >= a && v <= b; });
+  }
+  return count;
+}
+
+// SignalSearchEvents
+
+SignalSearchEvents::SignalSearchEvents(const MessageEvents &events, size_t first, size_t last)
+    : events_(events.slice(first, last)), words_((events.stride() + 7) / 8) {
+  const size_t blocks = (events_.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const size_t stride = events_.stride();
+  always_set_.resize(blocks * words_);
+  ever_set_.resize(blocks * words_);
+  same_size_.resize(blocks);
+  for (size_t b = 0; b < blocks; ++b) {
+    const size_t first = b * BLOCK_SIZE, last = std::min(first + BLOCK_SIZE, events_.size());
+    for (size_t w = 0; w < words_; ++w) {
+      const size_t bytes = std::min<size_t>(8, stride - w * 8);
+      uint64_t always = ~0ULL, ever = 0;
+      for (size_t i = first; i < last; ++i) {
+        uint64_t v = 0;
+        if (bytes == 8) {
+          memcpy(&v, events_.data(i) + w * 8, 8);
+        } else {
+          memcpy(&v, events_.data(i) + w * 8, bytes);
+        }
+        always &= v;
+        ever |= v;
+      }
+      always_set_[b * words_ + w] = always;
+      ever_set_[b * words_ + w] = ever;
+    }
+    bool same_size = true;
+    for (size_t i = first; i < last; ++i) same_size &= events_.dataSize(i) == events_.dataSize(first);
+    same_size_[b] = same_size;
+  }
+}
+
+void SignalSearchEvents::search(std::vector<Candidate> &candidates, const ValueCompare &cmp, const std::atomic<bool> &canceled) const {
+  struct Plan {
+    cabana::SignalDecoder decoder;
+    cabana::SignalDecoder bits;  // unsigned and unscaled, to decode the bounds
+    bool bounded;                // the bits fit a double exactly
+    bool exact;                  // and are scaled without rounding
+  };
+  std::vector<Plan> plans;
+  plans.reserve(candidates.size());
+  for (const auto &c : candidates) {
+    cabana::Signal bits = c.sig;
+    bits.is_signed = false;
+    bits.factor = 1;
+    bits.offset = 0;
+    bits.multiplexor = nullptr;
+    const bool integral = std::trunc(c.sig.factor) == c.sig.factor && std::abs(c.sig.factor) < (1 << 20) &&
+                          std::trunc(c.sig.offset) == c.sig.offset && std::abs(c.sig.offset) < (1LL << 52);
+    plans.push_back({cabana::SignalDecoder(c.sig), cabana::SignalDecoder(bits), c.sig.size <= 52, integral && c.sig.size <= 32});
+  }
+
+  // the least and greatest raw values a signal can take in a block, from the bits always and ever set in it
+  auto bounds = [this](const cabana::Signal &sig, const Plan &plan, size_t block) {
+    const size_t size = events_.dataSize(block * BLOCK_SIZE);
+    const int64_t always = plan.bits.getRawValue((const uint8_t *)&always_set_[block * words_], size);
+    const int64_t ever = plan.bits.getRawValue((const uint8_t *)&ever_set_[block * words_], size);
+    if (!sig.is_signed) return std::pair{always, ever};
+
+    const int64_t sign = 1LL << (sig.size - 1);
+    if (always & sign) return std::pair{always - 2 * sign, ever - 2 * sign};
+    if (ever & sign) return std::pair{(always | sign) - 2 * sign, ever & ~sign};
+    return std::pair{always, ever};
+  };
+
+  // a window of blocks at a time for all the candidates, while its payloads are in cache
+  const size_t blocks = same_size_.size(), window = 64;
+  double values[BLOCK_SIZE];
+  for (size_t w = 0; w < blocks && !canceled; w += window) {
+    const size_t window_end = std::min(w + window, blocks);
+    for (size_t n = 0; n < candidates.size(); ++n) {
+      auto &c = candidates[n];
+      const auto &plan = plans[n];
+      for (size_t b = std::max(w, c.first / BLOCK_SIZE); b < window_end && c.match == SIZE_MAX; ++b) {
+        const size_t first = std::max(b * BLOCK_SIZE, c.first), last = std::min((b + 1) * BLOCK_SIZE, events_.size());
+        if (first >= last) continue;
+
+        if (plan.bounded && same_size_[b]) {
+          auto [min, max] = bounds(c.sig, plan, b);
+          if (min == max) {
+            // the signal's bits don't change in the block
+            if (cmp(plan.decoder.getRawValue(events_.data(first), events_.dataSize(first)))) c.match = first;
+            continue;
+          }
+          double lo = min * c.sig.factor + c.sig.offset, hi = max * c.sig.factor + c.sig.offset;
+          if (lo > hi) std::swap(lo, hi);
+          if (!plan.exact) {
+            // widened by the rounding the decoder may do differently, e.g. with a fused multiply add
+            const double slack = (std::max(std::abs(min), std::abs(max)) * std::abs(c.sig.factor) + std::abs(c.sig.offset)) * 4 * DBL_EPSILON;
+            lo -= slack;
+            hi += slack;
+          }
+          if (!cmp.mayMatch(lo, hi)) continue;
+        }
+        plan.decoder.decodeRaw(events_, first, last - first, values);
+        if (const size_t i = cmp.find(values, last - first); i < last - first) {
+          c.match = first + i;
+        }
+      }
+    }
+  }
+}
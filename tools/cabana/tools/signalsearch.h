@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "tools/cabana/dbc/dbc.h"
+#include "tools/cabana/streams/messageevents.h"
+
+// A comparison of signal values, that also tells whether any value of a range could satisfy it.
+struct ValueCompare {
+  enum Op { Equal, Greater, GreaterEqual, NotEqual, Less, LessEqual, Between };
+
+  bool operator()(double v) const;
+  bool mayMatch(double min, double max) const;
+  // index of the first of values[0:count] that satisfies it, or count
+  size_t find(const double *values, size_t count) const;
+
+  Op op = Equal;
+  double v1 = 0, v2 = 0;
+};
+
+// A snapshot of a message's events to search signals in, with the payload bits that are always set and
+// ever set in each block of events. They bound the values any signal takes in a block, so blocks where
+// no value could match are skipped without decoding, and blocks where its bits don't change are decoded once.
+class SignalSearchEvents {
+public:
+  static constexpr size_t BLOCK_SIZE = 64;
+
+  SignalSearchEvents(const MessageEvents &events, size_t first, size_t last);
+  inline const MessageEvents &events() const { return events_; }
+
+  struct Candidate {
+    cabana::Signal sig;
+    size_t first = 0;         // searches events[first:]
+    size_t match = SIZE_MAX;  // the first event whose raw value satisfies the comparison
+  };
+  // finds the matches of all the candidates, a cache sized window of events at a time. returns early once canceled
+  void search(std::vector<Candidate> &candidates, const ValueCompare &cmp, const std::atomic<bool> &canceled) const;
+
+private:
+  MessageEvents events_;
+  size_t words_ = 0;                          // 64 bit words per payload
+  std::vector<uint64_t> always_set_, ever_set_;  // per block, the payload bits ANDed and ORed
+  std::vector<uint8_t> same_size_;            // per block, whether its payloads are the same size
+};
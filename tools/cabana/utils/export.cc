@@ -1,8 +1,14 @@
 #include "tools/cabana/utils/export.h"
 
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <vector>
+
 #include <QFile>
 #include <QTextStream>
 
+#include "tools/cabana/dbc/signaldecoder.h"
 #include "tools/cabana/streams/abstractstream.h"
 
 namespace utils {
@@ -12,10 +18,29 @@ void exportToCSV(const QString &file_name, std::optional<MessageId> msg_id) {
   if (file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
     QTextStream stream(&file);
     stream << "time,addr,bus,data\n";
-    for (auto e : msg_id ? can->events(*msg_id) : can->allEvents()) {
-      stream << QString::number(can->toSeconds(e->mono_time), 'f', 3) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src << ","
-             << "0x" << QByteArray::fromRawData((const char *)e->dat, e->size).toHex().toUpper() << "\n";
+
+    // merge the events of the messages in time order
+    struct Cursor {
+      const MessageId *id;
+      const MessageEvents *events;
+      size_t i;
+    };
+    auto later = [](const Cursor &l, const Cursor &r) { return l.events->monoTime(l.i) > r.events->monoTime(r.i); };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> cursors(later);
+    for (const auto &[id, events] : can->eventsMap()) {
+      if (!events.empty() && (!msg_id || id == *msg_id)) {
+        cursors.push({&id, &events, 0});
+      }
+    }
+    while (!cursors.empty()) {
+      Cursor c = cursors.top();
+      cursors.pop();
+      stream << QString::number(can->toSeconds(c.events->monoTime(c.i)), 'f', 3) << ","
+             << "0x" << QString::number(c.id->address, 16) << "," << c.id->source << ","
+             << "0x" << QByteArray::fromRawData((const char *)c.events->data(c.i), c.events->dataSize(c.i)).toHex().toUpper() << "\n";
+      if (++c.i < c.events->size()) {
+        cursors.push(c);
+      }
     }
   }
 }
@@ -29,15 +54,29 @@ void exportSignalsToCSV(const QString &file_name, const MessageId &msg_id) {
       stream << "," << s->name;
     stream << "\n";
 
-    for (auto e : can->events(msg_id)) {
-      stream << QString::number(can->toSeconds(e->mono_time), 'f', 3) << ","
-             << "0x" << QString::number(e->address, 16) << "," << e->src;
-      for (auto s : msg->sigs) {
-        double value = 0;
-        s->getValue(e->dat, e->size, &value);
-        stream << "," << QString::number(value, 'f', s->precision);
+    std::vector<cabana::SignalDecoder> decoders;
+    for (auto s : msg->sigs) decoders.emplace_back(*s);
+
+    // decode a block of events at a time, a column per signal
+    const size_t block_size = 4096;
+    const auto &events = can->events(msg_id);
+    std::vector<std::vector<double>> values(decoders.size(), std::vector<double>(block_size));
+    for (size_t begin = 0; begin < events.size(); begin += block_size) {
+      const size_t count = std::min(block_size, events.size() - begin);
+      for (int i = 0; i < decoders.size(); ++i) {
+        decoders[i].decode(events, begin, count, values[i].data());
+      }
+
+      for (size_t j = 0; j < count; ++j) {
+        stream << QString::number(can->toSeconds(events.monoTime(begin + j)), 'f', 3) << ","
+               << "0x" << QString::number(msg_id.address, 16) << "," << msg_id.source;
+        for (int i = 0; i < decoders.size(); ++i) {
+          // multiplexed signals that aren't present are written as 0
+          const double value = std::isnan(values[i][j]) ? 0 : values[i][j];
+          stream << "," << QString::number(value, 'f', msg->sigs[i]->precision);
+        }
+        stream << "\n";
       }
-      stream << "\n";
     }
   }
 }
@@ -16,37 +16,89 @@
 
 #include "selfdrive/ui/qt/util.h"
 
-// SegmentTree
-
-void SegmentTree::build(const std::vector<QPointF> &arr) {
-  size = arr.size();
-  tree.resize(4 * size);  // size of the tree is 4 times the size of the array
-  if (size > 0) {
-    build_tree(arr, 1, 0, size - 1);
+// MinMaxPyramid
+
+void MinMaxPyramid::build(const std::vector<QPointF> &pts, size_t from) {
+  size_t k = 0;
+  for (size_t start = from / FANOUT, count = pts.size() / FANOUT; count > 0; ++k, start /= FANOUT, count /= FANOUT) {
+    if (k == levels.size()) levels.emplace_back();
+    auto &level = levels[k];
+    level.resize(count);
+    for (size_t i = start; i < count; ++i) {
+      Node n;
+      if (k == 0) {
+        n = {uint32_t(i * FANOUT), uint32_t(i * FANOUT)};
+        for (size_t j = i * FANOUT + 1; j < (i + 1) * FANOUT; ++j) {
+          if (pts[j].y() < pts[n.min].y()) n.min = j;
+          if (pts[j].y() > pts[n.max].y()) n.max = j;
+        }
+      } else {
+        const auto &below = levels[k - 1];
+        n = below[i * FANOUT];
+        for (size_t j = i * FANOUT + 1; j < (i + 1) * FANOUT; ++j) {
+          if (pts[below[j].min].y() < pts[n.min].y()) n.min = below[j].min;
+          if (pts[below[j].max].y() > pts[n.max].y()) n.max = below[j].max;
+        }
+      }
+      level[i] = n;
+    }
   }
+  levels.resize(k);
 }
 
-void SegmentTree::build_tree(const std::vector<QPointF> &arr, int n, int left, int right) {
-  if (left == right) {
-    const double y = arr[left].y();
-    tree[n] = {y, y};
-  } else {
-    const int mid = (left + right) >> 1;
-    build_tree(arr, 2 * n, left, mid);
-    build_tree(arr, 2 * n + 1, mid + 1, right);
-    tree[n] = {std::min(tree[2 * n].first, tree[2 * n + 1].first), std::max(tree[2 * n].second, tree[2 * n + 1].second)};
+MinMaxPyramid::Node MinMaxPyramid::minmaxIndex(const std::vector<QPointF> &pts, size_t first, size_t last) const {
+  Node n = {uint32_t(first), uint32_t(first)};
+  auto take = [&](const Node &o) {
+    if (pts[o.min].y() < pts[n.min].y()) n.min = o.min;
+    if (pts[o.max].y() > pts[n.max].y()) n.max = o.max;
+  };
+  auto take_point = [&](size_t i) { take({uint32_t(i), uint32_t(i)}); };
+
+  // scan the unaligned ends of each level, and move the aligned middle up a level
+  for (; first < last && (first % FANOUT || levels.empty()); ++first) take_point(first);
+  while (last > first && last % FANOUT) take_point(--last);
+  first /= FANOUT;
+  last /= FANOUT;
+  for (size_t k = 0; first < last; ++k) {
+    const auto &level = levels[k];
+    const bool top = k + 1 == levels.size();
+    while (first < last && (first % FANOUT || top)) take(level[first++]);
+    while (last > first && last % FANOUT) take(level[--last]);
+    first /= FANOUT;
+    last /= FANOUT;
   }
+  return n;
+}
+
+std::pair<double, double> MinMaxPyramid::minmax(const std::vector<QPointF> &pts, size_t first, size_t last) const {
+  if (first >= last) return {std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest()};
+  Node n = minmaxIndex(pts, first, last);
+  return {pts[n.min].y(), pts[n.max].y()};
 }
 
-std::pair<double, double> SegmentTree::get_minmax(int n, int left, int right, int range_left, int range_right) const {
-  if (range_left > right || range_right < left)
-    return {std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest()};
-  if (range_left <= left && range_right >= right)
-    return tree[n];
-  int mid = (left + right) >> 1;
-  auto l = get_minmax(2 * n, left, mid, range_left, range_right);
-  auto r = get_minmax(2 * n + 1, mid + 1, right, range_left, range_right);
-  return {std::min(l.first, r.first), std::max(l.second, r.second)};
+void MinMaxPyramid::decimate(const std::vector<QPointF> &pts, size_t first, size_t last, double x_min, double x_max, int buckets, QVector<QPointF> &out) const {
+  out.clear();
+  if (first > 0) out.push_back(pts[first - 1]);
+  if (last - first <= 2 * (size_t)buckets) {
+    out.append(pts.data() + first, last - first);
+  } else {
+    const double width = (x_max - x_min) / buckets;
+    auto it = pts.cbegin() + first;
+    for (int b = 1; b <= buckets && first < last; ++b) {
+      const double x_end = b == buckets ? x_max : x_min + b * width;
+      it = std::lower_bound(it, pts.cbegin() + last, x_end, [](const QPointF &p, double x) { return p.x() < x; });
+      const size_t end = it - pts.cbegin();
+      if (end > first) {
+        auto [min, max] = minmaxIndex(pts, first, end);
+        out.push_back(pts[std::min(min, max)]);
+        if (min != max) out.push_back(pts[std::max(min, max)]);
+        first = end;
+      }
+    }
+    // points from float rounding at x_max
+    if (first < last) out.append(pts.data() + first, last - first);
+  }
+  if (last < pts.size()) out.push_back(pts[last]);
 }
 
 // MessageBytesDelegate
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cmath>
+#include <cstdint>
 #include <vector>
 #include <utility>
 
@@ -17,6 +18,7 @@
 #include <QStringBuilder>
 #include <QStyledItemDelegate>
 #include <QToolButton>
+#include <QVector>
 
 #include "tools/cabana/dbc/dbc.h"
 #include "tools/cabana/settings.h"
@@ -52,17 +54,27 @@ enum {
   BytesRole = Qt::UserRole + 2
 };
 
-class SegmentTree {
+// Multi-resolution min/max of a series, built incrementally as points are merged in.
+// A node of level k holds the indices of the min and max points among FANOUT^(k+1) points.
+class MinMaxPyramid {
 public:
-  SegmentTree() = default;
-  void build(const std::vector<QPointF> &arr);
-  inline std::pair<double, double> minmax(int left, int right) const { return get_minmax(1, 0, size - 1, left, right); }
+  MinMaxPyramid() = default;
+  // (re)builds the nodes covering pts[from:], after points were appended or inserted at from
+  void build(const std::vector<QPointF> &pts, size_t from = 0);
+  // min and max y of pts[first:last]
+  std::pair<double, double> minmax(const std::vector<QPointF> &pts, size_t first, size_t last) const;
+  // pts[first:last] reduced to the min and max point of each of the buckets between x_min and x_max,
+  // plus the points just outside the range so lines reach the edges
+  void decimate(const std::vector<QPointF> &pts, size_t first, size_t last, double x_min, double x_max, int buckets, QVector<QPointF> &out) const;
 
 private:
-  std::pair<double, double> get_minmax(int n, int left, int right, int range_left, int range_right) const;
-  void build_tree(const std::vector<QPointF> &arr, int n, int left, int right);
-  std::vector<std::pair<double, double>> tree;
-  int size = 0;
+  struct Node {
+    uint32_t min, max;
+  };
+  Node minmaxIndex(const std::vector<QPointF> &pts, size_t first, size_t last) const;
+
+  static constexpr size_t FANOUT = 8;
+  std::vector<std::vector<Node>> levels;
 };
 
 class MessageBytesDelegate : public QStyledItemDelegate {
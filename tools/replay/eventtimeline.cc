@@ -0,0 +1,76 @@
+#include "tools/replay/eventtimeline.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+EventTimeline::EventTimeline(std::vector<Span> spans, std::vector<bool> allowed)
+    : spans_(std::move(spans)), allowed_(std::move(allowed)) {
+  for (const auto &span : spans_) {
+    size_ += span.events->size();
+  }
+}
+
+bool EventTimeline::contains(int seg_num) const {
+  return std::any_of(spans_.begin(), spans_.end(), [=](auto &span) { return span.seg_num == seg_num; });
+}
+
+Segment *EventTimeline::segment(int seg_num) const {
+  auto it = std::find_if(spans_.begin(), spans_.end(), [=](auto &span) { return span.seg_num == seg_num; });
+  return it != spans_.end() ? it->segment.get() : nullptr;
+}
+
+bool EventTimeline::sameSegments(const std::vector<int> &seg_nums) const {
+  return std::equal(spans_.begin(), spans_.end(), seg_nums.begin(), seg_nums.end(),
+                    [](auto &span, int n) { return span.seg_num == n; });
+}
+
+const Event *EventTimeline::back() const {
+  const Event *last = nullptr;
+  for (const auto &span : spans_) {
+    auto it = std::find_if(span.events->rbegin(), span.events->rend(), [this](auto &e) { return allowed(e); });
+    if (it != span.events->rend() && (!last || *last < *it)) {
+      last = &(*it);
+    }
+  }
+  return last;
+}
+
+EventTimeline::Iterator::Iterator(const EventTimeline &timeline, const Event &from, bool inclusive)
+    : allowed_(&timeline.allowed_) {
+  heap_.reserve(timeline.spans_.size());
+  for (const auto &span : timeline.spans_) {
+    const Event *begin = span.events->data(), *end = begin + span.events->size();
+    const Event *cur = inclusive ? std::lower_bound(begin, end, from) : std::upper_bound(begin, end, from);
+    if ((cur = skip(cur, end)) != end) {
+      heap_.push_back({cur, end});
+    }
+  }
+  std::make_heap(heap_.begin(), heap_.end(), std::greater<>());
+}
+
+EventTimeline::Iterator::Iterator(const EventTimeline &timeline, const Iterator &pos)
+    : Iterator(timeline, *pos.get(), true) {
+  const Event from = *pos.get();
+  while (repeats_ < pos.repeats_ && get() && !(from < *get())) {
+    next();
+  }
+}
+
+void EventTimeline::Iterator::next() {
+  const Event *prev = get();
+  std::pop_heap(heap_.begin(), heap_.end(), std::greater<>());
+  auto &cursor = heap_.back();
+  cursor.cur = skip(cursor.cur + 1, cursor.end);
+  if (cursor.cur != cursor.end) {
+    std::push_heap(heap_.begin(), heap_.end(), std::greater<>());
+  } else {
+    heap_.pop_back();
+  }
+  repeats_ = get() && !(*prev < *get()) ? repeats_ + 1 : 0;
+}
+
+const Event *EventTimeline::Iterator::skip(const Event *cur, const Event *end) const {
+  while (cur != end && !(cur->which < allowed_->size() && (*allowed_)[cur->which])) ++cur;
+  return cur;
+}
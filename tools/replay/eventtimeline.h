@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "tools/replay/route.h"
+
+// The events of the merged segments. Every segment keeps its own sorted events and they are merged while
+// iterating, so adding or evicting a segment only builds a new list of spans instead of copying the events.
+// A timeline is immutable once built; readers hold on to their snapshot, which keeps its segments alive.
+class EventTimeline {
+public:
+  struct Span {
+    int seg_num;
+    std::shared_ptr<Segment> segment;  // owns the events, may be null if they are kept alive elsewhere
+    const std::vector<Event> *events;
+  };
+
+  // spans are ordered by segment number, allowed[which] selects the events to iterate
+  EventTimeline(std::vector<Span> spans, std::vector<bool> allowed);
+  inline const std::vector<Span> &spans() const { return spans_; }
+  bool contains(int seg_num) const;
+  Segment *segment(int seg_num) const;
+  bool sameSegments(const std::vector<int> &seg_nums) const;
+  inline bool empty() const { return size_ == 0; }
+  // total events of all spans, including the ones that are not allowed
+  inline size_t size() const { return size_; }
+  const Event *back() const;
+
+  // k-way merge over the spans, adjacent segments overlap slightly at their boundary
+  class Iterator {
+  public:
+    // starts at the first event after `from`, or at `from` itself if inclusive
+    Iterator(const EventTimeline &timeline, const Event &from, bool inclusive = false);
+    // continues at the position of `pos` in another snapshot, passing the events equal to pos.get() that `pos`
+    // already passed. equal events are merged in an arbitrary order, so only their count is carried over
+    Iterator(const EventTimeline &timeline, const Iterator &pos);
+    inline const Event *get() const { return heap_.empty() ? nullptr : heap_.front().cur; }
+    void next();
+
+  private:
+    struct Cursor {
+      const Event *cur, *end;
+      bool operator>(const Cursor &other) const { return *other.cur < *cur; }
+    };
+    const Event *skip(const Event *cur, const Event *end) const;
+
+    const std::vector<bool> *allowed_;
+    std::vector<Cursor> heap_;  // min-heap on the current event
+    size_t repeats_ = 0;  // events passed that are equal to the current one
+  };
+
+private:
+  inline bool allowed(const Event &e) const { return e.which < allowed_.size() && allowed_[e.which]; }
+
+  std::vector<Span> spans_;
+  std::vector<bool> allowed_;
+  size_t size_ = 0;
+};
@@ -0,0 +1,72 @@
+#include <csignal>
+#include <thread>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QFileInfo>
+
+#include "tools/replay/extractor.h"
+#include "tools/replay/util.h"
+
+static std::atomic<bool> do_exit = false;
+static void set_do_exit(int) { do_exit = true; }
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Extract fields of services from local logs into one file per service.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("paths", "logs, or directories to search for them", "<path>...");
+  parser.addOption({{"s", "service"}, "service and fields to extract, can be repeated. e.g. carState:vEgo,cruiseState.speed or can:address,src,dat", "service:fields"});
+  parser.addOption({{"o", "output"}, "output directory", "dir"});
+  parser.addOption({"format", "csv or bin. default is csv", "format"});
+  parser.addOption({{"j", "threads"}, "worker threads. default is the number of cores", "n"});
+  parser.addOption({"qlog", "search directories for qlogs instead of rlogs"});
+  parser.process(app);
+
+  const QStringList paths = parser.positionalArguments();
+  const QStringList specs = parser.values("service");
+  const QString format = parser.value("format").isEmpty() ? "csv" : parser.value("format");
+  if (paths.empty() || specs.empty() || parser.value("output").isEmpty() || (format != "csv" && format != "bin")) {
+    parser.showHelp();
+  }
+
+  LogExtractor extractor;
+  for (const auto &spec : specs) {
+    if (!extractor.addService(spec.toStdString())) return 1;
+  }
+
+  // directories are searched recursively, the logs found in a directory are sorted by route and segment number
+  const QString name = parser.isSet("qlog") ? "qlog" : "rlog";
+  const QStringList name_filters = {name, name + ".bz2", name + ".zst"};
+  std::vector<std::string> logs;
+  for (const auto &path : paths) {
+    if (QFileInfo(path).isDir()) {
+      QDirIterator it(path, name_filters, QDir::Files, QDirIterator::Subdirectories);
+      std::vector<std::string> found;
+      while (it.hasNext()) found.push_back(it.next().toStdString());
+      LogExtractor::sortBySegment(found);
+      logs.insert(logs.end(), found.begin(), found.end());
+    } else {
+      logs.push_back(path.toStdString());
+    }
+  }
+  if (logs.empty()) {
+    rError("no logs found");
+    return 1;
+  }
+
+  const int threads = parser.value("threads").isEmpty() ? std::thread::hardware_concurrency() : parser.value("threads").toInt();
+  std::signal(SIGINT, set_do_exit);
+  std::signal(SIGTERM, set_do_exit);
+
+  rInfo("extracting from %zu logs with %d threads", logs.size(), threads);
+  bool success = extractor.run(logs, parser.value("output").toStdString(),
+                               format == "csv" ? LogExtractor::Format::CSV : LogExtractor::Format::Binary, threads, &do_exit);
+  const auto &stats = extractor.stats();
+  rInfo("%zu logs, %zu failed, %zu rows in %.1f s, %.2f logs/s", stats.logs, stats.failed, stats.rows, stats.seconds,
+        stats.seconds > 0 ? stats.logs / stats.seconds : 0);
+  return success ? 0 : 1;
+}
@@ -0,0 +1,409 @@
+#include "tools/replay/extractor.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#include "cereal/services.h"
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/logreader.h"
+
+namespace {
+
+constexpr char EXTRACT_MAGIC[4] = {'R', 'E', 'X', 'T'};
+constexpr uint32_t EXTRACT_VERSION = 1;
+
+std::vector<std::string> split(const std::string &s, char delim) {
+  std::vector<std::string> parts;
+  std::istringstream stream(s);
+  for (std::string part; std::getline(stream, part, delim);) {
+    if (!part.empty()) parts.push_back(part);
+  }
+  return parts;
+}
+
+std::optional<capnp::StructSchema::Field> find_field(capnp::StructSchema schema, const std::string &name) {
+  for (auto field : schema.getFields()) {
+    if (field.getProto().getName() == kj::StringPtr(name.c_str())) return field;
+  }
+  return std::nullopt;
+}
+
+double to_double(const capnp::DynamicValue::Reader &value) {
+  switch (value.getType()) {
+    case capnp::DynamicValue::BOOL: return value.as<bool>();
+    case capnp::DynamicValue::INT: return value.as<int64_t>();
+    case capnp::DynamicValue::UINT: return value.as<uint64_t>();
+    case capnp::DynamicValue::FLOAT: return value.as<double>();
+    case capnp::DynamicValue::ENUM: return value.as<capnp::DynamicEnum>().getRaw();
+    default: return std::numeric_limits<double>::quiet_NaN();
+  }
+}
+
+std::string to_bytes(const capnp::DynamicValue::Reader &value) {
+  if (value.getType() == capnp::DynamicValue::TEXT) {
+    auto text = value.as<capnp::Text>();
+    return std::string(text.cStr(), text.size());
+  } else if (value.getType() == capnp::DynamicValue::DATA) {
+    auto data = value.as<capnp::Data>();
+    return std::string((const char *)data.begin(), data.size());
+  }
+  return {};
+}
+
+template <class T>
+void append(std::string &out, const T *data, size_t count = 1) {
+  out.append((const char *)data, sizeof(T) * count);
+}
+
+void append_csv_number(std::string &out, double value) {
+  if (std::isnan(value)) return;
+  char buf[32];
+  auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, end);
+}
+
+void append_csv_text(std::string &out, const std::string &text) {
+  out += '"';
+  for (char c : text) {
+    if (c == '"') out += '"';
+    out += c;
+  }
+  out += '"';
+}
+
+void append_csv_hex(std::string &out, const std::string &data) {
+  static const char digits[] = "0123456789abcdef";
+  for (uint8_t c : data) {
+    out += digits[c >> 4];
+    out += digits[c & 0xf];
+  }
+}
+
+}  // namespace
+
+bool LogExtractor::addService(const std::string &spec) {
+  const auto pos = spec.find(':');
+  const std::string name = spec.substr(0, pos);
+  const auto field_names = pos != std::string::npos ? split(spec.substr(pos + 1), ',') : std::vector<std::string>{};
+  if (services.count(name) == 0 || field_names.empty()) {
+    rWarning("invalid service %s, expected <service>:<field>[,<field>...]", spec.c_str());
+    return false;
+  }
+  if (std::any_of(services_.begin(), services_.end(), [&](auto &s) { return s.name == name; })) {
+    rWarning("service %s is selected twice", name.c_str());
+    return false;
+  }
+
+  auto field = capnp::Schema::from<cereal::Event>().asStruct().getFieldByName(name);
+  auto type = field.getType();
+  const bool is_list = type.isList();
+  if (is_list) type = type.asList().getElementType();
+  if (!type.isStruct()) {
+    rWarning("service %s has no fields", name.c_str());
+    return false;
+  }
+
+  Service service = {name, field, is_list, {}};
+  for (const auto &field_name : field_names) {
+    Field f = {field_name, {}, Field::Number};
+    auto schema = type.asStruct();
+    auto parts = split(field_name, '.');
+    for (int i = 0; i < parts.size(); ++i) {
+      auto part = find_field(schema, parts[i]);
+      if (!part) {
+        rWarning("%s has no field %s", name.c_str(), field_name.c_str());
+        return false;
+      }
+      f.path.push_back(*part);
+      auto part_type = part->getType();
+      if (i + 1 < parts.size()) {
+        if (!part_type.isStruct()) {
+          rWarning("%s.%s is not a struct", name.c_str(), parts[i].c_str());
+          return false;
+        }
+        schema = part_type.asStruct();
+      } else if (part_type.isText() || part_type.isData()) {
+        f.kind = part_type.isText() ? Field::Text : Field::Data;
+      } else if (part_type.isStruct() || part_type.isList() || part_type.isInterface() || part_type.isAnyPointer()) {
+        rWarning("%s.%s is not a number, text or data", name.c_str(), field_name.c_str());
+        return false;
+      }
+    }
+    service.fields.push_back(f);
+  }
+  services_.push_back(service);
+  return true;
+}
+
+void LogExtractor::sortBySegment(std::vector<std::string> &logs) {
+  struct Key {
+    std::string route;
+    long segment = -1;  // -1 when the directory is not a segment
+    std::string file;
+    bool operator<(const Key &k) const { return std::tie(route, segment, file) < std::tie(k.route, k.segment, k.file); }
+  };
+  auto number = [](const std::string &s, size_t pos, long &n) {
+    if (pos >= s.size() || s.size() - pos > 9) return false;
+    auto [end, ec] = std::from_chars(s.data() + pos, s.data() + s.size(), n);
+    return ec == std::errc() && end == s.data() + s.size();
+  };
+  auto make_key = [&](const std::string &log) {
+    Key key;
+    const size_t slash = log.rfind('/');
+    key.route = slash == std::string::npos ? "" : log.substr(0, slash);
+    key.file = log.substr(slash + 1);
+    const size_t name = key.route.rfind('/') + 1;  // 0 if there is no parent
+    const size_t dashes = key.route.rfind("--");
+    if (number(key.route, name, key.segment)) {
+      key.route.resize(name);
+    } else if (dashes != std::string::npos && dashes >= name && number(key.route, dashes + 2, key.segment)) {
+      key.route.resize(dashes);
+    } else {
+      key.segment = -1;
+    }
+    return key;
+  };
+
+  std::vector<std::pair<Key, std::string>> keyed;
+  keyed.reserve(logs.size());
+  for (auto &log : logs) keyed.emplace_back(make_key(log), std::move(log));
+  std::sort(keyed.begin(), keyed.end(), [](auto &a, auto &b) { return a.first < b.first; });
+  for (size_t i = 0; i < logs.size(); ++i) logs[i] = std::move(keyed[i].second);
+}
+
+bool LogExtractor::run(const std::vector<std::string> &logs, const std::string &out_dir, Format format, int threads,
+                       std::atomic<bool> *abort) {
+  stats_ = {};
+  if (services_.empty()) return false;
+
+  util::create_directories(out_dir, 0755);
+  std::vector<FILE *> files;
+  for (const auto &service : services_) {
+    const std::string file = out_dir + "/" + service.name + (format == Format::CSV ? ".csv" : ".bin");
+    FILE *f = fopen(file.c_str(), "wb");
+    if (!f) {
+      rWarning("failed to open %s", file.c_str());
+      for (auto opened : files) fclose(opened);
+      return false;
+    }
+    writeHeader(f, service, format);
+    files.push_back(f);
+  }
+
+  // workers take the logs in order, and stay at most a few logs ahead of the writer to bound memory
+  const double start = millis_since_boot();
+  threads = std::max(1, threads);
+  const size_t max_pending = threads * 2;
+  std::vector<Chunk> chunks(logs.size());
+  std::mutex lock;
+  std::condition_variable cv;
+  size_t next = 0, written = 0;
+  bool stop = false;
+  auto aborted = [=]() { return abort && *abort; };
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&]() {
+      while (true) {
+        size_t i = 0;
+        {
+          std::unique_lock lk(lock);
+          while (!cv.wait_for(lk, std::chrono::milliseconds(100), [&]() { return stop || aborted() || next < written + max_pending; })) {}
+          if (stop || aborted() || next >= logs.size()) break;
+          i = next++;
+        }
+        Chunk chunk;
+        chunk.success = extract(logs[i], chunk, abort);
+        {
+          std::lock_guard lk(lock);
+          chunks[i] = std::move(chunk);
+          chunks[i].done = true;
+        }
+        cv.notify_all();
+      }
+    });
+  }
+
+  for (size_t i = 0; i < logs.size() && !aborted(); ++i) {
+    Chunk chunk;
+    {
+      std::unique_lock lk(lock);
+      while (!cv.wait_for(lk, std::chrono::milliseconds(100), [&]() { return aborted() || chunks[i].done; })) {}
+      if (!chunks[i].done) break;
+      chunk = std::move(chunks[i]);
+      written = i + 1;
+    }
+    cv.notify_all();
+
+    if (!chunk.success) {
+      rWarning("failed to extract %s", logs[i].c_str());
+      ++stats_.failed;
+      continue;
+    }
+    for (int s = 0; s < services_.size(); ++s) {
+      writeChunk(files[s], services_[s], logs[i], chunk.tables[s], format);
+      stats_.rows += chunk.tables[s].mono_times.size();
+    }
+    ++stats_.logs;
+  }
+
+  {
+    std::lock_guard lk(lock);
+    stop = true;
+  }
+  cv.notify_all();
+  for (auto &t : workers) t.join();
+
+  bool success = !aborted();
+  for (auto f : files) {
+    success = !ferror(f) && success;
+    success = fclose(f) == 0 && success;
+  }
+  stats_.seconds = (millis_since_boot() - start) / 1000.0;
+  return success;
+}
+
+bool LogExtractor::extract(const std::string &log, Chunk &chunk, std::atomic<bool> *abort) const {
+  const size_t num_types = capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size();
+  std::vector<bool> filters(num_types, false);
+  std::vector<int> service_index(num_types, -1);
+  for (int i = 0; i < services_.size(); ++i) {
+    const uint16_t which = services_[i].field.getProto().getDiscriminantValue();
+    filters[which] = true;
+    service_index[which] = i;
+  }
+
+  LogReader reader(filters);
+  if (!reader.load(log, abort, false, 0, 0)) return false;
+
+  chunk.tables.resize(services_.size());
+  for (int i = 0; i < services_.size(); ++i) {
+    chunk.tables[i].columns.resize(services_[i].fields.size());
+  }
+  try {
+    for (const auto &e : reader.events) {
+      const int index = e.which < service_index.size() ? service_index[e.which] : -1;
+      if (index < 0 || e.eidx_segnum != -1) continue;  // skip the frame copies of encodeIdx
+
+      const auto &service = services_[index];
+      capnp::FlatArrayMessageReader msg(e.data);
+      auto value = capnp::toDynamic(msg.getRoot<cereal::Event>()).get(service.field);
+      if (service.is_list) {
+        for (auto row : value.as<capnp::DynamicList>()) {
+          addRow(service, row.as<capnp::DynamicStruct>(), e.mono_time, chunk.tables[index]);
+        }
+      } else {
+        addRow(service, value.as<capnp::DynamicStruct>(), e.mono_time, chunk.tables[index]);
+      }
+    }
+  } catch (const kj::Exception &e) {
+    rWarning("failed to read %s: %s", log.c_str(), e.getDescription().cStr());
+    return false;
+  }
+  return true;
+}
+
+void LogExtractor::addRow(const Service &service, capnp::DynamicStruct::Reader row, uint64_t mono_time, Table &table) const {
+  table.mono_times.push_back(mono_time);
+  for (int i = 0; i < service.fields.size(); ++i) {
+    const auto &field = service.fields[i];
+    auto &column = table.columns[i];
+
+    // inactive union members and unset pointers are missing: NaN or empty
+    std::optional<capnp::DynamicValue::Reader> value;
+    capnp::DynamicStruct::Reader s = row;
+    for (int j = 0; j < field.path.size() && s.has(field.path[j]); ++j) {
+      if (j + 1 < field.path.size()) {
+        s = s.get(field.path[j]).as<capnp::DynamicStruct>();
+      } else {
+        value = s.get(field.path[j]);
+      }
+    }
+    if (field.kind == Field::Number) {
+      column.values.push_back(value ? to_double(*value) : std::numeric_limits<double>::quiet_NaN());
+    } else {
+      column.bytes.push_back(value ? to_bytes(*value) : std::string{});
+    }
+  }
+}
+
+void LogExtractor::writeHeader(FILE *f, const Service &service, Format format) const {
+  std::string out;
+  if (format == Format::CSV) {
+    out = "log,mono_time";
+    for (const auto &field : service.fields) {
+      out += "," + field.name;
+    }
+    out += "\n";
+  } else {
+    const uint32_t columns = service.fields.size();
+    append(out, EXTRACT_MAGIC, sizeof(EXTRACT_MAGIC));
+    append(out, &EXTRACT_VERSION);
+    append(out, &columns);
+    for (const auto &field : service.fields) {
+      const uint8_t type = field.kind == Field::Number ? 0 : 1;
+      const uint32_t length = field.name.size();
+      append(out, &type);
+      append(out, &length);
+      out += field.name;
+    }
+  }
+  fwrite(out.data(), 1, out.size(), f);
+}
+
+void LogExtractor::writeChunk(FILE *f, const Service &service, const std::string &log, const Table &table, Format format) const {
+  const uint64_t rows = table.mono_times.size();
+  std::string out;
+  if (format == Format::CSV) {
+    std::string log_column;
+    append_csv_text(log_column, log);
+    for (uint64_t r = 0; r < rows; ++r) {
+      out += log_column;
+      out += ',';
+      out += std::to_string(table.mono_times[r]);
+      for (int c = 0; c < service.fields.size(); ++c) {
+        out += ',';
+        const auto kind = service.fields[c].kind;
+        if (kind == Field::Number) {
+          append_csv_number(out, table.columns[c].values[r]);
+        } else if (kind == Field::Text) {
+          append_csv_text(out, table.columns[c].bytes[r]);
+        } else {
+          append_csv_hex(out, table.columns[c].bytes[r]);
+        }
+      }
+      out += '\n';
+    }
+  } else {
+    const uint32_t length = log.size();
+    append(out, &length);
+    out += log;
+    append(out, &rows);
+    append(out, table.mono_times.data(), rows);
+    for (int c = 0; c < service.fields.size(); ++c) {
+      const auto &column = table.columns[c];
+      if (service.fields[c].kind == Field::Number) {
+        append(out, column.values.data(), rows);
+      } else {
+        for (const auto &b : column.bytes) {
+          const uint32_t size = b.size();
+          append(out, &size);
+        }
+        for (const auto &b : column.bytes) out += b;
+      }
+    }
+  }
+  fwrite(out.data(), 1, out.size(), f);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <capnp/dynamic.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+// Pulls selected fields of a few services out of many logs, one log per worker thread. The output has
+// one file per service in which every log is a chunk of columns, written in the order of the logs.
+//
+// binary format, all integers little endian:
+//   header: "REXT", u32 version, u32 columns, then per column: u8 type (0 = f64, 1 = bytes), u32 length, name
+//   chunk:  u32 length, log path, u64 rows, u64 mono_time[rows], then per column
+//           f64 values[rows] or u32 lengths[rows] followed by the bytes
+// numbers are converted to f64, missing values are NaN or empty. the CSV output writes data as hex.
+class LogExtractor {
+public:
+  enum class Format { CSV, Binary };
+
+  struct Stats {
+    size_t logs = 0;
+    size_t failed = 0;
+    size_t rows = 0;
+    double seconds = 0;
+  };
+
+  // "<service>:<field>[,<field>...]", nested fields are separated by dots, e.g. "carState:vEgo,cruiseState.speed".
+  // services that are lists, like can, get one row per element.
+  bool addService(const std::string &spec);
+  bool run(const std::vector<std::string> &logs, const std::string &out_dir, Format format, int threads,
+           std::atomic<bool> *abort = nullptr);
+  inline const Stats &stats() const { return stats_; }
+  // sorts the logs of routes by route name and then by numeric segment number, so "--2" comes before "--10".
+  // segment directories are named "<route>--<n>" or "<route>/<n>"
+  static void sortBySegment(std::vector<std::string> &logs);
+
+private:
+  struct Field {
+    std::string name;
+    std::vector<capnp::StructSchema::Field> path;
+    enum Kind { Number, Text, Data } kind;
+  };
+  struct Service {
+    std::string name;
+    capnp::StructSchema::Field field;
+    bool is_list;
+    std::vector<Field> fields;
+  };
+  struct Column {
+    std::vector<double> values;
+    std::vector<std::string> bytes;
+  };
+  struct Table {
+    std::vector<uint64_t> mono_times;
+    std::vector<Column> columns;
+  };
+  // the extracted tables of one log, by service
+  struct Chunk {
+    bool done = false;
+    bool success = false;
+    std::vector<Table> tables;
+  };
+
+  bool extract(const std::string &log, Chunk &chunk, std::atomic<bool> *abort) const;
+  void addRow(const Service &service, capnp::DynamicStruct::Reader row, uint64_t mono_time, Table &table) const;
+  void writeHeader(FILE *f, const Service &service, Format format) const;
+  void writeChunk(FILE *f, const Service &service, const std::string &log, const Table &table, Format format) const;
+
+  std::vector<Service> services_;
+  Stats stats_;
+};
@@ -1,7 +1,9 @@
 #include "tools/replay/filereader.h"
 
+#include <algorithm>
 #include <fstream>
 
+#include "common/timing.h"
 #include "common/util.h"
 #include "system/hardware/hw.h"
 #include "tools/replay/util.h"
@@ -30,6 +32,13 @@ std::string FileReader::read(const std::string &file, std::atomic<bool> *abort)
       fs.write(result.data(), result.size());
     }
   }
+
+  if (size_t rate = rate_limit_; rate > 0 && !result.empty()) {
+    double end_ms = millis_since_boot() + result.size() * 1000.0 / rate;
+    while (millis_since_boot() < end_ms && !(abort && *abort)) {
+      util::sleep_for(std::clamp<int>(end_ms - millis_since_boot(), 1, 100));
+    }
+  }
   return result;
 }
 
@@ -47,3 +56,34 @@ std::string FileReader::download(const std::string &url, std::atomic<bool> *abor
   }
   return {};
 }
+
+std::string FileReader::read(const std::string &file, int64_t offset, size_t size, std::atomic<bool> *abort) {
+  const bool is_remote = file.find("https://") == 0;
+  const std::string local_file = is_remote ? cacheFilePath(file) : file;
+  if (!is_remote || (cache_to_local_ && util::file_exists(local_file))) {
+    std::ifstream fs(local_file, std::ios::binary);
+    if (!fs) return {};
+    if (offset < 0) {
+      fs.seekg(0, std::ios::end);
+      offset = std::max<int64_t>(0, (int64_t)fs.tellg() + offset);
+      size = std::min<size_t>(size, (int64_t)fs.tellg() - offset);
+    }
+    std::string result(size, '\0');
+    fs.seekg(offset).read(result.data(), size);
+    result.resize(fs.gcount());
+    return result;
+  }
+
+  for (int i = 0; i <= max_retries_ && !(abort && *abort); ++i) {
+    if (i > 0) {
+      rWarning("download failed, retrying %d", i);
+      util::sleep_for(3000);
+    }
+
+    std::string result = httpGetRange(file, offset, size, abort);
+    if (!result.empty()) {
+      return result;
+    }
+  }
+  return {};
+}
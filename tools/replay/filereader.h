@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <string>
 
 class FileReader {
@@ -9,8 +10,13 @@ public:
       : cache_to_local_(cache_to_local), chunk_size_(chunk_size), max_retries_(retries) {}
   virtual ~FileReader() {}
   std::string read(const std::string &file, std::atomic<bool> *abort = nullptr);
+  // a byte range of the file, remote files are only downloaded in part. a negative offset counts from the end
+  std::string read(const std::string &file, int64_t offset, size_t size, std::atomic<bool> *abort = nullptr);
+  // limits the read rate of all readers, e.g. to test prefetching against a slow network. 0 is unlimited.
+  static void setRateLimit(size_t bytes_per_second) { rate_limit_ = bytes_per_second; }
 
 private:
+  static inline std::atomic<size_t> rate_limit_ = 0;
   std::string download(const std::string &url, std::atomic<bool> *abort);
   size_t chunk_size_;
   int max_retries_;
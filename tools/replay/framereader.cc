@@ -1,5 +1,8 @@
 #include "tools/replay/framereader.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <tuple>
@@ -51,13 +54,48 @@ struct DecoderManager {
 
 DecoderManager decoder_manager;
 
+// Only the reader that is being played keeps decoded frames, so there is one ring of GOPs per camera.
+// The previous reader's cache is cleared without the lock, since that waits for its GOPs being decoded.
+struct ActiveReaders {
+  void activate(CameraType type, FrameReader *reader) {
+    FrameReader *prev = nullptr;
+    {
+      std::unique_lock lock(mutex_);
+      if (readers_[type] == reader) return;
+      prev = std::exchange(readers_[type], reader);
+      if (prev) clearing_.push_back(prev);
+    }
+    if (prev) {
+      prev->clearCache();
+      std::unique_lock lock(mutex_);
+      clearing_.erase(std::find(clearing_.begin(), clearing_.end(), prev));
+      cleared_.notify_all();
+    }
+  }
+  // the reader can be destroyed once this returns
+  void remove(CameraType type, FrameReader *reader) {
+    std::unique_lock lock(mutex_);
+    if (readers_[type] == reader) readers_[type] = nullptr;
+    cleared_.wait(lock, [&]() { return std::find(clearing_.begin(), clearing_.end(), reader) == clearing_.end(); });
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cleared_;
+  FrameReader *readers_[MAX_CAMERAS] = {};
+  std::vector<FrameReader *> clearing_;
+};
+
+ActiveReaders active_readers;
+
 }  // namespace
 
-FrameReader::FrameReader() {
+FrameReader::FrameReader(bool decode_ahead) : decode_ahead_(decode_ahead) {
   av_log_set_level(AV_LOG_QUIET);
 }
 
 FrameReader::~FrameReader() {
+  active_readers.remove(type_, this);
+  clearCache();
   if (input_ctx) avformat_close_input(&input_ctx);
 }
 
@@ -84,8 +122,11 @@ bool FrameReader::loadFromFile(CameraType type, const std::string &file, bool no
   if (!decoder_) {
     return false;
   }
+  type_ = type;
   width = decoder_->width;
   height = decoder_->height;
+  // the hardware decoder is shared and decodes one frame at a time
+  decode_ahead_ = decode_ahead_ && !decoder_->hwDecoding();
 
   AVPacket pkt;
   packets_info.reserve(60 * 20);  // 20fps, one minute
@@ -101,9 +142,106 @@ bool FrameReader::get(int idx, VisionBuf *buf) {
   if (!buf || idx < 0 || idx >= packets_info.size()) {
     return false;
   }
+  if (decode_ahead_ && getDecoded(idx, buf)) {
+    return true;
+  }
   return decoder_->decode(this, idx, buf);
 }
 
+bool FrameReader::getDecoded(int idx, VisionBuf *buf) {
+  active_readers.activate(type_, this);
+
+  std::shared_future<DecodedFrames> frames;
+  const int begin = gopBegin(idx);
+  std::deque<Gop> stale;
+  {
+    std::unique_lock lock(gops_lock_);
+    // keep the GOP of idx and the ones after it, drop everything else
+    std::deque<Gop> gops;
+    size_t bytes = 0;
+    for (int i = 0, b = begin; i <= DECODE_AHEAD_GOPS && b < packets_info.size(); ++i, b = gopEnd(b)) {
+      auto it = std::find_if(gops_.begin(), gops_.end(), [b](auto &g) { return g.begin == b; });
+      if (it != gops_.end()) {
+        gops.push_back(std::move(*it));
+        gops_.erase(it);
+      } else {
+        gops.push_back(decodeGop(b, gopEnd(b)));
+      }
+      bytes += gops.back().bytes;
+    }
+    stale.swap(gops_);
+    gops_.swap(gops);
+    cache_bytes_ = bytes;
+    frames = gops_.front().frames;
+  }
+  // decoding GOPs that are no longer needed are waited for here, outside of the lock
+  stale.clear();
+
+  const uint8_t *y = frames.get().frame(idx - begin);
+  if (!y) {
+    return false;
+  }
+  const uint8_t *uv = y + width * height;
+  for (int row = 0; row < height; ++row) {
+    memcpy(buf->y + row * buf->stride, y + row * width, width);
+  }
+  for (int row = 0; row < height / 2; ++row) {
+    memcpy(buf->uv + row * buf->stride, uv + row * width, width);
+  }
+  return true;
+}
+
+FrameReader::Gop FrameReader::decodeGop(int begin, int end) {
+  // demux in this thread, input_ctx is not shared with the decoding threads
+  std::vector<AVPacket *> packets;
+  avio_seek(input_ctx->pb, packets_info[begin].pos, SEEK_SET);
+  prev_idx = -1;  // the serial decoder has to seek again
+  for (int i = begin; i < end; ++i) {
+    AVPacket *pkt = av_packet_alloc();
+    if (av_read_frame(input_ctx, pkt) != 0) {
+      av_packet_free(&pkt);
+      break;
+    }
+    packets.push_back(pkt);
+  }
+
+  AVCodecParameters *codecpar = avcodec_parameters_alloc();
+  avcodec_parameters_copy(codecpar, input_ctx->streams[0]->codecpar);
+  auto frames = std::async(std::launch::async, [packets, codecpar]() mutable {
+    DecodedFrames frames;
+    VideoDecoder decoder;
+    if (decoder.open(codecpar, false)) {
+      decoder.decodeGop(packets, frames);
+    }
+    for (auto &pkt : packets) av_packet_free(&pkt);
+    avcodec_parameters_free(&codecpar);
+    return frames;
+  }).share();
+  return {begin, packets.size() * width * height * 3 / 2, frames};
+}
+
+int FrameReader::gopBegin(int idx) const {
+  for (int i = idx; i >= 0; --i) {
+    if (packets_info[i].flags & AV_PKT_FLAG_KEY) return i;
+  }
+  return 0;
+}
+
+int FrameReader::gopEnd(int begin) const {
+  int i = begin + 1;
+  while (i < packets_info.size() && !(packets_info[i].flags & AV_PKT_FLAG_KEY)) ++i;
+  return i;
+}
+
+void FrameReader::clearCache() {
+  std::deque<Gop> gops;
+  {
+    std::unique_lock lock(gops_lock_);
+    gops.swap(gops_);
+    cache_bytes_ = 0;
+  }
+}
+
 // class VideoDecoder
 
 VideoDecoder::VideoDecoder() {
@@ -215,20 +353,38 @@ AVFrame *VideoDecoder::decodeFrame(AVPacket *pkt) {
   return (av_frame_->format == hw_pix_fmt) ? hw_frame_ : av_frame_;
 }
 
+void VideoDecoder::decodeGop(const std::vector<AVPacket *> &packets, DecodedFrames &frames) {
+  // one uninitialized allocation for the GOP, every valid frame is fully overwritten
+  frames.frame_size = width * height * 3 / 2;
+  frames.data.reset(new uint8_t[packets.size() * frames.frame_size]);
+  frames.valid.assign(packets.size(), false);
+  for (size_t i = 0; i < packets.size(); ++i) {
+    if (AVFrame *f = decodeFrame(packets[i])) {
+      uint8_t *nv12 = frames.data.get() + i * frames.frame_size;
+      copyBuffer(f, nv12, nv12 + width * height, width);
+      frames.valid[i] = true;
+    }
+  }
+}
+
 bool VideoDecoder::copyBuffer(AVFrame *f, VisionBuf *buf) {
+  copyBuffer(f, buf->y, buf->uv, buf->stride);
+  return true;
+}
+
+void VideoDecoder::copyBuffer(AVFrame *f, uint8_t *y, uint8_t *uv, int stride) {
   if (hw_pix_fmt == HW_PIX_FMT) {
     for (int i = 0; i < height/2; i++) {
-      memcpy(buf->y + (i*2 + 0)*buf->stride, f->data[0] + (i*2 + 0)*f->linesize[0], width);
-      memcpy(buf->y + (i*2 + 1)*buf->stride, f->data[0] + (i*2 + 1)*f->linesize[0], width);
-      memcpy(buf->uv + i*buf->stride, f->data[1] + i*f->linesize[1], width);
+      memcpy(y + (i*2 + 0)*stride, f->data[0] + (i*2 + 0)*f->linesize[0], width);
+      memcpy(y + (i*2 + 1)*stride, f->data[0] + (i*2 + 1)*f->linesize[0], width);
+      memcpy(uv + i*stride, f->data[1] + i*f->linesize[1], width);
     }
   } else {
     libyuv::I420ToNV12(f->data[0], f->linesize[0],
                        f->data[1], f->linesize[1],
                        f->data[2], f->linesize[2],
-                       buf->y, buf->stride,
-                       buf->uv, buf->stride,
+                       y, stride,
+                       uv, stride,
                        width, height);
   }
-  return true;
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -14,15 +19,32 @@ extern "C" {
 
 class VideoDecoder;
 
+// the frames of one GOP, decoded to NV12 back to back, stride is width
+struct DecodedFrames {
+  inline const uint8_t *frame(size_t i) const { return i < valid.size() && valid[i] ? data.get() + i * frame_size : nullptr; }
+
+  size_t frame_size = 0;
+  std::unique_ptr<uint8_t[]> data;
+  std::vector<bool> valid;  // frames that fail to decode are not valid
+};
+
+// GOPs decoded ahead of the requested frame when decoding in software
+constexpr int DECODE_AHEAD_GOPS = 1;
+
 class FrameReader {
 public:
-  FrameReader();
+  // with decode_ahead, software decoding works on whole GOPs: the requested one and the next
+  // DECODE_AHEAD_GOPS are decoded in parallel and frames are served from memory.
+  FrameReader(bool decode_ahead = true);
   ~FrameReader();
   bool load(CameraType type, const std::string &url, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr, bool local_cache = false,
             int chunk_size = -1, int retries = 0);
   bool loadFromFile(CameraType type, const std::string &file, bool no_hw_decoder = false, std::atomic<bool> *abort = nullptr);
   bool get(int idx, VisionBuf *buf);
   size_t getFrameCount() const { return packets_info.size(); }
+  void clearCache();
+  // bytes of the decoded GOPs held, including the ones still being decoded
+  inline size_t memoryUsage() const { return cache_bytes_; }
 
   int width = 0, height = 0;
 
@@ -34,6 +56,23 @@ public:
     int64_t pos;
   };
   std::vector<PacketInfo> packets_info;
+
+private:
+  struct Gop {
+    int begin;
+    size_t bytes;
+    std::shared_future<DecodedFrames> frames;
+  };
+  bool getDecoded(int idx, VisionBuf *buf);
+  Gop decodeGop(int begin, int end);
+  int gopBegin(int idx) const;
+  int gopEnd(int begin) const;
+
+  CameraType type_ = RoadCam;
+  bool decode_ahead_ = false;
+  std::mutex gops_lock_;
+  std::deque<Gop> gops_;
+  std::atomic<size_t> cache_bytes_{0};
 };
 
 
@@ -43,12 +82,16 @@ public:
   ~VideoDecoder();
   bool open(AVCodecParameters *codecpar, bool hw_decoder);
   bool decode(FrameReader *reader, int idx, VisionBuf *buf);
+  // decodes the packets of one GOP in order
+  void decodeGop(const std::vector<AVPacket *> &packets, DecodedFrames &frames);
+  inline bool hwDecoding() const { return hw_pix_fmt != AV_PIX_FMT_NONE; }
   int width = 0, height = 0;
 
 private:
   bool initHardwareDecoder(AVHWDeviceType hw_device_type);
   AVFrame *decodeFrame(AVPacket *pkt);
   bool copyBuffer(AVFrame *f, VisionBuf *buf);
+  void copyBuffer(AVFrame *f, uint8_t *y, uint8_t *uv, int stride);
 
   AVFrame *av_frame_, *hw_frame_;
   AVCodecContext *decoder_ctx = nullptr;
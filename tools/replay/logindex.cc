@@ -0,0 +1,206 @@
+#include "tools/replay/logindex.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include "common/util.h"
+#include "tools/replay/filereader.h"
+
+namespace {
+
+constexpr char INDEX_MAGIC[4] = {'R', 'I', 'D', 'X'};
+constexpr uint32_t INDEX_VERSION = 2;
+
+struct IndexHeader {
+  char magic[4];
+  uint32_t version;
+  // the index is only valid for the exact file it was built from
+  uint64_t log_size;
+  int64_t log_mtime_ns;
+  uint64_t begin_mono_time;
+  uint64_t end_mono_time;
+  uint32_t num_types;
+  uint32_t num_timeline;
+  uint32_t num_can;
+  uint32_t reserved;
+};
+
+struct TypeHeader {
+  uint32_t which;
+  uint32_t count;
+};
+
+// the entries are written as they are in memory, without padding
+static_assert(std::is_trivially_copyable_v<LogIndex::Entry> && std::is_trivially_copyable_v<LogIndex::TimelineEntry> &&
+              std::is_trivially_copyable_v<LogIndex::CanCount>);
+static_assert(sizeof(LogIndex::Entry) == 24 && offsetof(LogIndex::Entry, eidx_segnum) == 20);
+static_assert(sizeof(LogIndex::TimelineEntry) == 24 && offsetof(LogIndex::TimelineEntry, alert_size) == 16 &&
+              offsetof(LogIndex::TimelineEntry, reserved) == 17);
+static_assert(sizeof(LogIndex::CanCount) == 16 && offsetof(LogIndex::CanCount, count) == 8);
+
+bool stat_log(const std::string &log_file, uint64_t &size, int64_t &mtime_ns) {
+  struct stat st = {};
+  if (stat(log_file.c_str(), &st) != 0) return false;
+  size = st.st_size;
+  mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  return true;
+}
+
+uint32_t fnv1a(const char *s, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ (uint8_t)s[i]) * 16777619u;
+  }
+  return hash;
+}
+
+template <class T>
+void append(std::string &out, const T *data, size_t count = 1) {
+  out.append((const char *)data, sizeof(T) * count);
+}
+
+template <class T>
+bool read(const std::string &in, size_t &pos, T *data, size_t count = 1) {
+  const size_t size = sizeof(T) * count;
+  if (pos + size > in.size()) return false;
+  memcpy((void *)data, in.data() + pos, size);
+  pos += size;
+  return true;
+}
+
+}  // namespace
+
+std::string LogIndex::filePath(const std::string &url) {
+  return cacheFilePath(url) + ".idx";
+}
+
+bool LogIndex::load(const std::string &file, const std::string &log_file) {
+  uint64_t log_size = 0;
+  int64_t log_mtime_ns = 0;
+  if (!stat_log(log_file, log_size, log_mtime_ns)) return false;
+
+  const std::string data = util::read_file(file);
+  size_t pos = 0;
+  IndexHeader header = {};
+  if (!read(data, pos, &header) || memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      header.version != INDEX_VERSION || header.log_size != log_size || header.log_mtime_ns != log_mtime_ns) {
+    return false;
+  }
+
+  LogIndex index;
+  index.begin_mono_time = header.begin_mono_time;
+  index.end_mono_time = header.end_mono_time;
+  for (uint32_t i = 0; i < header.num_types; ++i) {
+    TypeHeader type = {};
+    if (!read(data, pos, &type) || type.count > data.size() / sizeof(Entry)) return false;
+    auto &entries = index.offsets[type.which];
+    entries.resize(type.count);
+    if (!read(data, pos, entries.data(), entries.size())) return false;
+    for (const auto &e : entries) {
+      if (e.offset + e.words * sizeof(uint64_t) > log_size) return false;
+    }
+  }
+  index.timeline.resize(header.num_timeline);
+  index.can_histogram.resize(header.num_can);
+  if (!read(data, pos, index.timeline.data(), index.timeline.size()) ||
+      !read(data, pos, index.can_histogram.data(), index.can_histogram.size())) {
+    return false;
+  }
+
+  *this = std::move(index);
+  return true;
+}
+
+bool LogIndex::save(const std::string &file, const std::string &log_file) const {
+  IndexHeader header = {};
+  memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.version = INDEX_VERSION;
+  if (!stat_log(log_file, header.log_size, header.log_mtime_ns)) return false;
+  header.begin_mono_time = begin_mono_time;
+  header.end_mono_time = end_mono_time;
+  header.num_types = offsets.size();
+  header.num_timeline = timeline.size();
+  header.num_can = can_histogram.size();
+
+  std::string out;
+  append(out, &header);
+  for (const auto &[which, entries] : offsets) {
+    TypeHeader type = {which, (uint32_t)entries.size()};
+    append(out, &type);
+    append(out, entries.data(), entries.size());
+  }
+  append(out, timeline.data(), timeline.size());
+  append(out, can_histogram.data(), can_histogram.size());
+
+  // written to a temporary file first, so concurrent readers never see a partial index
+  const std::string tmp_file = file + ".tmp" + std::to_string(getpid());
+  if (util::write_file(tmp_file.c_str(), out.data(), out.size(), O_WRONLY | O_CREAT | O_TRUNC) != 0 || std::rename(tmp_file.c_str(), file.c_str()) != 0) {
+    std::remove(tmp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+void LogIndex::add(cereal::Event::Reader event, uint64_t mono_time) {
+  if (begin_mono_time == 0 || mono_time < begin_mono_time) begin_mono_time = mono_time;
+  end_mono_time = std::max(end_mono_time, mono_time);
+
+  const auto which = event.which();
+  if (which == cereal::Event::Which::CONTROLS_STATE) {
+    auto cs = event.getControlsState();
+    auto alert_type = cs.getAlertType();
+    TimelineEntry entry = {};
+    entry.mono_time = mono_time;
+    entry.alert_type_hash = alert_type.size() > 0 ? fnv1a(alert_type.cStr(), alert_type.size()) : 0;
+    entry.which = (uint16_t)which;
+    entry.enabled = cs.getEnabled();
+    entry.alert_status = (uint8_t)cs.getAlertStatus();
+    entry.alert_size = (uint8_t)cs.getAlertSize();
+    timeline.push_back(entry);
+  } else if (which == cereal::Event::Which::USER_FLAG) {
+    TimelineEntry entry = {};
+    entry.mono_time = mono_time;
+    entry.which = (uint16_t)which;
+    timeline.push_back(entry);
+  }
+}
+
+void LogIndex::addCan(cereal::Event::Reader event) {
+  auto can = event.which() == cereal::Event::Which::CAN ? event.getCan() : event.getSendcan();
+  for (const auto &c : can) {
+    ++can_counts_[{c.getSrc(), c.getAddress()}];
+  }
+}
+
+void LogIndex::finish() {
+  // events are not in mono_time order in the log, the controlsState changes are found once it's sorted
+  std::stable_sort(timeline.begin(), timeline.end(), [](auto &l, auto &r) { return l.mono_time < r.mono_time; });
+  size_t kept = 0, last = timeline.size();  // the last controlsState kept
+  for (size_t i = 0; i < timeline.size(); ++i) {
+    const TimelineEntry &e = timeline[i];
+    if (e.which == (uint16_t)cereal::Event::Which::CONTROLS_STATE) {
+      if (last < kept && timeline[last].enabled == e.enabled && timeline[last].alert_type_hash == e.alert_type_hash &&
+          timeline[last].alert_status == e.alert_status && timeline[last].alert_size == e.alert_size) {
+        continue;
+      }
+      last = kept;
+    }
+    timeline[kept++] = e;
+  }
+  timeline.resize(kept);
+
+  if (!can_counts_.empty()) {
+    can_histogram.clear();
+    for (const auto &[key, count] : can_counts_) {
+      can_histogram.push_back({key.first, key.second, count});
+    }
+    can_counts_.clear();
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+// Sidecar index of a log that is mapped from disk, stored next to the download cache.
+// Reopening the log with a valid index rebuilds its events from the offsets without parsing it,
+// and the timeline and CAN summaries can be read without touching the log at all.
+class LogIndex {
+public:
+  struct Entry {
+    uint64_t mono_time;
+    uint64_t offset;  // in bytes from the start of the decompressed log
+    uint32_t words;
+    int32_t eidx_segnum;
+  };
+
+  // controlsState changes and user flags, Replay derives the timeline spans from these
+  struct TimelineEntry {
+    uint64_t mono_time;
+    uint32_t alert_type_hash;  // 0 without an alert
+    uint16_t which;
+    uint8_t enabled;
+    uint8_t alert_status;
+    uint8_t alert_size;
+    uint8_t reserved[7] = {};  // the entries are written as is, without uninitialized padding
+  };
+
+  struct CanCount {
+    uint32_t src;
+    uint32_t address;
+    uint64_t count;
+  };
+
+  static std::string filePath(const std::string &url);
+  bool load(const std::string &file, const std::string &log_file);
+  bool save(const std::string &file, const std::string &log_file) const;
+  inline bool valid() const { return end_mono_time > 0; }
+
+  // time range and timeline, tracked for every event of the log. the timeline is sorted and only the
+  // controlsState changes are kept by finish()
+  void add(cereal::Event::Reader event, uint64_t mono_time);
+  // only needed to write the sidecar
+  inline void addOffset(cereal::Event::Which which, const Entry &entry) { offsets[(uint16_t)which].push_back(entry); }
+  void addCan(cereal::Event::Reader event);
+  void finish();
+
+  uint64_t begin_mono_time = 0;
+  uint64_t end_mono_time = 0;
+  std::map<uint16_t, std::vector<Entry>> offsets;  // by cereal::Event::Which
+  std::vector<TimelineEntry> timeline;
+  std::vector<CanCount> can_histogram;
+
+private:
+  std::map<std::pair<uint32_t, uint32_t>, uint64_t> can_counts_;
+};
@@ -1,67 +1,352 @@
 #include "tools/replay/logreader.h"
 
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <utility>
 #include "tools/replay/filereader.h"
 #include "tools/replay/util.h"
 #include "common/util.h"
 
+static bool is_bz2(const std::string &url, const std::string &data) {
+  return url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9");
+}
+
+static bool is_zst(const std::string &url, const std::string &data) {
+  return url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD");
+}
+
+// removes the least recently used decompressed logs of the cache directory of keep, until they fit in max_bytes
+static void evictRawCache(const std::string &keep, uint64_t max_bytes) {
+  struct RawFile {
+    std::string path;
+    time_t mtime;
+    uint64_t size;
+  };
+  const std::string dir = keep.substr(0, keep.rfind('/') + 1);
+  std::vector<RawFile> files;
+  uint64_t total = 0;
+  DIR *d = opendir(dir.c_str());
+  if (!d) return;
+  while (struct dirent *de = readdir(d)) {
+    const std::string path = dir + de->d_name;
+    struct stat st;
+    if (util::ends_with(path, ".raw") && stat(path.c_str(), &st) == 0) {
+      files.push_back({path, st.st_mtime, (uint64_t)st.st_size});
+      total += st.st_size;
+    }
+  }
+  closedir(d);
+
+  std::sort(files.begin(), files.end(), [](auto &a, auto &b) { return a.mtime < b.mtime; });
+  for (auto it = files.begin(); it != files.end() && total > max_bytes; ++it) {
+    if (it->path == keep) continue;
+    // readers that still map it keep their pages
+    std::remove(it->path.c_str());
+    std::remove((it->path.substr(0, it->path.size() - 4) + ".idx").c_str());
+    total -= it->size;
+  }
+}
+
 bool LogReader::load(const std::string &url, std::atomic<bool> *abort, bool local_cache, int chunk_size, int retries) {
-  std::string data = FileReader(local_cache, chunk_size, retries).read(url, abort);
-  if (!data.empty()) {
-    if (url.find(".bz2") != std::string::npos || util::starts_with(data, "BZh9")) {
-      data = decompressBZ2(data, abort);
-    } else if (url.find(".zst") != std::string::npos || util::starts_with(data, "\x28\xB5\x2F\xFD")) {
-      data = decompressZST(data, abort);
+  // Uncompressed local logs are mapped directly. With the local cache enabled, compressed remote logs are
+  // decompressed once into a cache file next to the download cache and mapped from there afterwards.
+  // Mapped logs get a sidecar index the first time they are parsed, later loads skip parsing.
+  const bool is_remote = url.find("https://") == 0;
+  const bool is_compressed = is_bz2(url, "") || is_zst(url, "");
+  const bool cache_raw = is_remote && local_cache;
+  const std::string raw_file = !is_remote && !is_compressed ? url : (cache_raw ? cacheFilePath(url) + ".raw" : "");
+  if (!raw_file.empty() && mapFile(raw_file)) {
+    // the mtime orders the cache for eviction
+    if (cache_raw) utimes(raw_file.c_str(), nullptr);
+    if (local_cache && index_.load(LogIndex::filePath(url), raw_file)) {
+      index_loaded_ = true;
+      return loadFromIndex(abort);
     }
+    build_index_ = local_cache;
+    bool success = load(mapped_->data(), mapped_->size(), abort);
+    if (success) saveIndex(url, raw_file);
+    return success;
+  }
+
+  // with the local cache the whole log is decompressed once, otherwise filtered loads of
+  // indexed zstd logs only read the frames they need
+  FileReader reader(local_cache, chunk_size, retries);
+  if (raw_file.empty() && is_zst(url, "") && filtering()) {
+    auto frames = readFrameIndex(url, reader, abort);
+    if (!frames.empty()) return loadFrames(url, frames, reader, abort);
+  }
+
+  std::string data = reader.read(url, abort);
+  if (data.empty()) return false;
+
+  if (is_bz2(url, data) || is_zst(url, data)) {
+    return loadCompressed(url, data, raw_file != url ? raw_file : "", abort);
   }
 
-  bool success = !data.empty() && load(data.data(), data.size(), abort);
-  if (filters_.empty())
+  bool success = load(data.data(), data.size(), abort);
+  if (!filtering())
     raw_ = std::move(data);
   return success;
 }
 
 bool LogReader::load(const char *data, size_t size, std::atomic<bool> *abort) {
+  const bool copy = filtering() && !mapped_;
   try {
     events.reserve(65000);
     kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
     while (words.size() > 0 && !(abort && *abort)) {
-      capnp::FlatArrayMessageReader reader(words);
-      auto event = reader.getRoot<cereal::Event>();
-      auto which = event.which();
-      auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
-      words = kj::arrayPtr(reader.getEnd(), words.end());
-
-      if (!filters_.empty()) {
-        if (which >= filters_.size() || !filters_[which])
-          continue;
-        auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
-        memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
-        event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+      words = words.slice(parseEvent(words, (const char *)words.begin() - data, copy), words.size());
+    }
+  } catch (const kj::Exception &e) {
+    rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
+    build_index_ = false;
+  }
+  return finishLoading(abort);
+}
+
+// Events are parsed while the log is being decompressed. Decompressed blocks are appended to a slab and every
+// complete message in it is parsed right away; a message cut off at the end of a slab is moved to the start
+// of the next one, so parsed events never move. If raw_file is set, the decompressed log is also written to it
+// and the events are rebased onto the mapped file once it is complete.
+bool LogReader::loadCompressed(const std::string &url, const std::string &data, const std::string &raw_file,
+                               std::atomic<bool> *abort) {
+  const std::string tmp_file = raw_file.empty() ? "" : raw_file + ".tmp" + std::to_string(getpid());
+  FILE *cache = tmp_file.empty() ? nullptr : fopen(tmp_file.c_str(), "wb");
+  const bool copy = filtering() && !cache;
+  build_index_ = cache != nullptr;
+
+  kj::Array<capnp::word> slab;
+  size_t slab_offset = 0, end = 0, parsed = 0;  // in bytes
+  std::vector<size_t> offsets;  // offset of each event in the decompressed log
+  bool corrupt = false;
+  events.reserve(65000);
+
+  auto on_block = [&](const char *block, size_t size) -> bool {
+    if (cache && fwrite(block, 1, size, cache) != size) {
+      fclose(cache);
+      cache = nullptr;
+      build_index_ = false;
+    }
+
+    const size_t pending = end - parsed;
+    if (end + size > slab.size() * sizeof(capnp::word)) {
+      if (copy && pending + size <= slab.size() * sizeof(capnp::word)) {
+        // the parsed events were copied out, reuse the slab
+        memmove(slab.begin(), (char *)slab.begin() + parsed, pending);
+      } else {
+        auto next = kj::heapArray<capnp::word>((std::max(DECOMPRESS_BLOCK_SIZE * 8, pending + size) + 7) / sizeof(capnp::word));
+        memcpy(next.begin(), (char *)slab.begin() + parsed, pending);
+        if (!copy && slab.size() > 0) slabs_.push_back(std::move(slab));
+        slab = std::move(next);
       }
+      slab_offset += parsed;
+      end = pending;
+      parsed = 0;
+    }
+    memcpy((char *)slab.begin() + end, block, size);
+    end += size;
+
+    const size_t prev_events = events.size();
+    try {
+      while (true) {
+        kj::ArrayPtr<const capnp::word> words((const capnp::word *)((char *)slab.begin() + parsed), (end - parsed) / sizeof(capnp::word));
+        if (words.size() == 0 || capnp::expectedSizeInWordsFromPrefix(words) > words.size()) break;
 
-      uint64_t mono_time = event.getLogMonoTime();
-      const Event &evt = events.emplace_back(which, mono_time, event_data);
-      // Add encodeIdx packet again as a frame packet for the video stream
-      if (evt.which == cereal::Event::ROAD_ENCODE_IDX ||
-          evt.which == cereal::Event::DRIVER_ENCODE_IDX ||
-          evt.which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
-        auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
-        if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
-          uint64_t sof = idx.getTimestampSof();
-          events.emplace_back(which, sof ? sof : mono_time, event_data, idx.getSegmentNum());
-        }
+        const size_t consumed = parseEvent(words, slab_offset + parsed, copy);
+        if (cache) offsets.resize(events.size(), slab_offset + parsed);
+        parsed += consumed * sizeof(capnp::word);
       }
+    } catch (const kj::Exception &e) {
+      rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
+      corrupt = true;
+    }
+    if (events.size() > prev_events && progress_callback) progress_callback(events.size());
+    return !corrupt && !(abort && *abort);
+  };
+
+  if (is_bz2(url, data)) {
+    decompressBZ2((const std::byte *)data.data(), data.size(), on_block, abort);
+  } else {
+    decompressZST((const std::byte *)data.data(), data.size(), on_block, abort);
+  }
+  if (!copy && slab.size() > 0) slabs_.push_back(std::move(slab));
+  if (!corrupt && end != parsed && !(abort && *abort)) {
+    rWarning("Failed to parse log : truncated message.\nRetrieved %zu events from corrupt log", events.size());
+    corrupt = true;
+  }
+
+  if (cache) {
+    bool complete = !corrupt && !(abort && *abort);
+    if (fclose(cache) == 0 && complete && std::rename(tmp_file.c_str(), raw_file.c_str()) == 0 && mapFile(raw_file)) {
+      for (size_t i = 0; i < events.size(); ++i) {
+        events[i].data = kj::arrayPtr((const capnp::word *)(mapped_->data() + offsets[i]), events[i].data.size());
+      }
+      slabs_.clear();
+      evictRawCache(raw_file, raw_cache_limit_);
+    } else {
+      build_index_ = false;
+    }
+  }
+  if (!tmp_file.empty()) std::remove(tmp_file.c_str());
+
+  if (corrupt) build_index_ = false;
+  bool success = finishLoading(abort);
+  if (success) saveIndex(url, raw_file);
+  return success;
+}
+
+std::vector<LogFrameIndexEntry> LogReader::readFrameIndex(const std::string &url, FileReader &reader, std::atomic<bool> *abort) {
+  // the index of a segment is a few KB, a second read is only needed for very long logs
+  std::vector<LogFrameIndexEntry> frames;
+  size_t required_size = 0;
+  std::string tail = reader.read(url, -16 * 1024, 16 * 1024, abort);
+  if (!parseLogFrameIndex(tail, frames, &required_size) && required_size > tail.size()) {
+    tail = reader.read(url, -(int64_t)required_size, required_size, abort);
+    parseLogFrameIndex(tail, frames);
+  }
+  return frames;
+}
+
+// Reads and decompresses only the frames that have events passing the filters. Frames that are close together
+// are read at once, so a service that is in every other frame doesn't turn into a request per frame.
+bool LogReader::loadFrames(const std::string &url, const std::vector<LogFrameIndexEntry> &frames, FileReader &reader,
+                           std::atomic<bool> *abort) {
+  const size_t max_gap = 256 * 1024;
+  std::vector<const LogFrameIndexEntry *> selected;
+  uint64_t begin_mono_time = UINT64_MAX, end_mono_time = 0;
+  for (const auto &f : frames) {
+    begin_mono_time = std::min(begin_mono_time, f.begin_mono_time);
+    end_mono_time = std::max(end_mono_time, f.end_mono_time);
+    bool needed = f.end_mono_time >= begin_mono_time_ && f.begin_mono_time <= end_mono_time_;
+    if (needed && !filters_.empty()) {
+      needed = false;
+      for (uint16_t w = 0; w < filters_.size() && !needed; ++w) {
+        needed = filters_[w] && f.has(w);
+      }
+    }
+    if (needed) selected.push_back(&f);
+  }
+
+  std::string data;
+  for (size_t i = 0; i < selected.size() && !(abort && *abort);) {
+    size_t j = i + 1;
+    while (j < selected.size() && selected[j]->offset <= selected[j - 1]->offset + selected[j - 1]->compressed_size + max_gap) ++j;
+
+    const uint64_t begin = selected[i]->offset;
+    const uint64_t end = selected[j - 1]->offset + selected[j - 1]->compressed_size;
+    std::string range = reader.read(url, begin, end - begin, abort);
+    if (range.size() != end - begin) return false;
+
+    for (; i < j; ++i) {
+      data.append(range, selected[i]->offset - begin, selected[i]->compressed_size);
+    }
+  }
+  frames_loaded_ = selected.size();
+  frames_total_ = frames.size();
+
+  bool success = data.empty() ? finishLoading(abort) : loadCompressed(url, data, "", abort);
+  index_.begin_mono_time = begin_mono_time;
+  index_.end_mono_time = end_mono_time;
+  return success;
+}
+
+bool LogReader::loadFromIndex(std::atomic<bool> *abort) {
+  events.reserve(65000);
+  for (const auto &[which, entries] : index_.offsets) {
+    if (!filters_.empty() && (which >= filters_.size() || !filters_[which])) continue;
+
+    for (const auto &e : entries) {
+      if (e.mono_time < begin_mono_time_ || e.mono_time > end_mono_time_) continue;
+      auto data = kj::arrayPtr((const capnp::word *)(mapped_->data() + e.offset), e.words);
+      events.emplace_back((cereal::Event::Which)which, e.mono_time, data, e.eidx_segnum);
     }
-  } catch (const kj::Exception &e) {
-    rWarning("Failed to parse log : %s.\nRetrieved %zu events from corrupt log", e.getDescription().cStr(), events.size());
   }
+  index_.offsets.clear();
+  return finishLoading(abort);
+}
 
+size_t LogReader::parseEvent(kj::ArrayPtr<const capnp::word> words, uint64_t offset, bool copy) {
+  capnp::FlatArrayMessageReader reader(words);
+  auto event = reader.getRoot<cereal::Event>();
+  auto which = event.which();
+  auto event_data = kj::arrayPtr(words.begin(), reader.getEnd());
+  const size_t consumed = event_data.size();
+  uint64_t mono_time = event.getLogMonoTime();
+  if (!index_loaded_) index_.add(event, mono_time);
+
+  const bool keep = wanted(which, mono_time);
+  if (!keep && !build_index_) return consumed;
+
+  if (keep && copy) {
+    // keep only the filtered events, the decompressed log is dropped after loading
+    auto buf = buffer_.allocate(event_data.size() * sizeof(capnp::word));
+    memcpy(buf, event_data.begin(), event_data.size() * sizeof(capnp::word));
+    event_data = kj::arrayPtr((const capnp::word *)buf, event_data.size());
+  }
+  auto add_event = [&](uint64_t t, int32_t eidx_segnum) {
+    if (keep) events.emplace_back(which, t, event_data, eidx_segnum);
+    if (build_index_) index_.addOffset(which, {t, offset, (uint32_t)event_data.size(), eidx_segnum});
+  };
+
+  add_event(mono_time, -1);
+  if (build_index_ && (which == cereal::Event::CAN || which == cereal::Event::SENDCAN)) {
+    index_.addCan(event);
+  }
+  // Add encodeIdx packet again as a frame packet for the video stream
+  if (which == cereal::Event::ROAD_ENCODE_IDX ||
+      which == cereal::Event::DRIVER_ENCODE_IDX ||
+      which == cereal::Event::WIDE_ROAD_ENCODE_IDX) {
+    auto idx = capnp::AnyStruct::Reader(event).getPointerSection()[0].getAs<cereal::EncodeIndex>();
+    if (idx.getType() == cereal::EncodeIndex::Type::FULL_H_E_V_C) {
+      uint64_t sof = idx.getTimestampSof();
+      add_event(sof ? sof : mono_time, idx.getSegmentNum());
+    }
+  }
+  return consumed;
+}
+
+bool LogReader::finishLoading(std::atomic<bool> *abort) {
+  if (!index_loaded_) index_.finish();
   if (!events.empty() && !(abort && *abort)) {
     events.shrink_to_fit();
     std::sort(events.begin(), events.end());
+    // only the index stays resident, payloads are paged back in when an event is read
+    if (mapped_) mapped_->release();
     return true;
   }
   return false;
 }
+
+void LogReader::saveIndex(const std::string &url, const std::string &log_file) {
+  if (build_index_ && !index_.save(LogIndex::filePath(url), log_file)) {
+    rWarning("failed to write log index for %s", url.c_str());
+  }
+  build_index_ = false;
+  index_.offsets.clear();
+}
+
+size_t LogReader::memoryUsage() const {
+  size_t bytes = events.capacity() * sizeof(Event) + raw_.capacity() + buffer_.size();
+  for (const auto &slab : slabs_) {
+    bytes += slab.size() * sizeof(capnp::word);
+  }
+  return bytes;
+}
+
+bool LogReader::mapFile(const std::string &file) {
+  auto mapped = std::make_unique<MappedFile>(file);
+  if (!mapped->valid()) return false;
+
+  // local files without an extension may still be compressed
+  std::string magic(mapped->data(), std::min<size_t>(mapped->size(), 4));
+  if (is_bz2("", magic) || is_zst("", magic)) return false;
+
+  mapped_ = std::move(mapped);
+  return true;
+}
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "cereal/gen/cpp/log.capnp.h"
 #include "system/camerad/cameras/camera_common.h"
+#include "system/loggerd/log_frame_index.h"
+#include "tools/replay/filereader.h"
+#include "tools/replay/logindex.h"
 #include "tools/replay/util.h"
 
 const CameraType ALL_CAMERAS[] = {RoadCam, DriverCam, WideRoadCam};
@@ -28,13 +35,58 @@ public:
 class LogReader {
 public:
   LogReader(const std::vector<bool> &filters = {}) { filters_ = filters; }
+  // only events in the range are loaded. like the filters, this lets indexed zstd logs be read in part
+  inline void setTimeRange(uint64_t begin_mono_time, uint64_t end_mono_time) {
+    begin_mono_time_ = begin_mono_time;
+    end_mono_time_ = end_mono_time;
+  }
   bool load(const std::string &url, std::atomic<bool> *abort = nullptr,
             bool local_cache = false, int chunk_size = -1, int retries = 0);
   bool load(const char *data, size_t size, std::atomic<bool> *abort = nullptr);
+  // decompressed remote logs kept in the download cache, the least recently used are removed above this
+  static void setRawCacheLimit(uint64_t bytes) { raw_cache_limit_ = bytes; }
   std::vector<Event> events;
+  // called on the loading thread with the number of events parsed so far while a compressed log
+  // is still being decompressed. events are unsorted until load() returns, so this only reports
+  // progress; replay doesn't publish any event of a segment before its load() returns.
+  std::function<void(size_t)> progress_callback;
+  // time range and timeline of the whole log regardless of the filters, the timeline only covers the frames
+  // that were read from an indexed log. the CAN histogram is only filled in when the local cache is used
+  inline const LogIndex &index() const { return index_; }
+  // heap memory held by the loaded log, mapped files are not counted since their pages can be reclaimed
+  size_t memoryUsage() const;
+  // zstd frames decompressed from an indexed log and the frames in the log, both 0 if the whole log was read
+  inline size_t framesLoaded() const { return frames_loaded_; }
+  inline size_t framesTotal() const { return frames_total_; }
 
 private:
+  bool loadCompressed(const std::string &url, const std::string &data, const std::string &raw_file, std::atomic<bool> *abort);
+  bool loadFromIndex(std::atomic<bool> *abort);
+  std::vector<LogFrameIndexEntry> readFrameIndex(const std::string &url, FileReader &reader, std::atomic<bool> *abort);
+  bool loadFrames(const std::string &url, const std::vector<LogFrameIndexEntry> &frames, FileReader &reader, std::atomic<bool> *abort);
+  inline bool filtering() const { return !filters_.empty() || begin_mono_time_ > 0 || end_mono_time_ < UINT64_MAX; }
+  inline bool wanted(uint16_t which, uint64_t mono_time) const {
+    return (filters_.empty() || (which < filters_.size() && filters_[which])) &&
+           mono_time >= begin_mono_time_ && mono_time <= end_mono_time_;
+  }
+  size_t parseEvent(kj::ArrayPtr<const capnp::word> words, uint64_t offset, bool copy);
+  bool finishLoading(std::atomic<bool> *abort);
+  void saveIndex(const std::string &url, const std::string &log_file);
+  bool mapFile(const std::string &file);
+
+  static inline std::atomic<uint64_t> raw_cache_limit_ = 10ULL * 1024 * 1024 * 1024;
   std::string raw_;
+  // decompressed logs that are not cached on disk, Event::data points into these
+  std::vector<kj::Array<capnp::word>> slabs_;
+  // uncompressed logs are indexed in place, Event::data points into the mapping
+  std::unique_ptr<MappedFile> mapped_;
   std::vector<bool> filters_;
+  uint64_t begin_mono_time_ = 0, end_mono_time_ = UINT64_MAX;
+  size_t frames_loaded_ = 0, frames_total_ = 0;
+  LogIndex index_;
+  // read from a valid sidecar, it's not built again from the events
+  bool index_loaded_ = false;
+  // the sidecar is only written for mapped logs that were parsed completely
+  bool build_index_ = false;
   MonotonicBuffer buffer_{1024 * 1024};
 };
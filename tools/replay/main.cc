@@ -32,6 +32,8 @@ int main(int argc, char *argv[]) {
   parser.addOption({{"a", "allow"}, "whitelist of services to send", "allow"});
   parser.addOption({{"b", "block"}, "blacklist of services to send", "block"});
   parser.addOption({{"c", "cache"}, "cache <n> segments in memory. default is 5", "n"});
+  parser.addOption({"cache-mb", "evict cached segments above <mb> of memory", "mb"});
+  parser.addOption({"lockstep", "publish as fast as consumers ack, e.g. carState:carControl,controlsState", "trigger:acks"});
   parser.addOption({{"s", "start"}, "start from <seconds>", "seconds"});
   parser.addOption({"x", QString("playback <speed>. between %1 - %2")
                         .arg(ConsoleUI::speed_array.front()).arg(ConsoleUI::speed_array.back()), "speed"});
@@ -51,6 +53,11 @@ int main(int argc, char *argv[]) {
   const QString route = args.empty() ? DEMO_ROUTE : args.first();
   QStringList allow = parser.value("allow").isEmpty() ? QStringList{} : parser.value("allow").split(",");
   QStringList block = parser.value("block").isEmpty() ? QStringList{} : parser.value("block").split(",");
+  // the ack services are published by the consumers, not by replay
+  const QStringList lockstep = parser.value("lockstep").split(":");
+  QStringList acks = lockstep.value(1).split(",");
+  acks.removeAll("");
+  block << acks;
 
   uint32_t replay_flags = REPLAY_FLAG_NONE;
   for (const auto &[name, flag, _] : flags) {
@@ -69,6 +76,16 @@ int main(int argc, char *argv[]) {
   if (!parser.value("c").isEmpty()) {
     replay->setSegmentCacheLimit(parser.value("c").toInt());
   }
+  if (!parser.value("cache-mb").isEmpty()) {
+    replay->setMemoryLimit(parser.value("cache-mb").toULongLong() * 1024 * 1024);
+  }
+  if (!parser.value("lockstep").isEmpty()) {
+    std::vector<std::string> ack_services;
+    for (const auto &ack : acks) ack_services.push_back(ack.toStdString());
+    if (!replay->setLockstep(lockstep.value(0).toStdString(), ack_services)) {
+      return 0;
+    }
+  }
   if (!parser.value("x").isEmpty()) {
     replay->setSpeed(std::clamp(parser.value("x").toFloat(),
                                 ConsoleUI::speed_array.front(), ConsoleUI::speed_array.back()));
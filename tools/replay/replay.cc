@@ -3,6 +3,7 @@
 #include <QDebug>
 #include <QtConcurrent>
 #include <capnp/dynamic.h>
+#include <cinttypes>
 #include <csignal>
 #include "cereal/services.h"
 #include "common/params.h"
@@ -156,7 +157,7 @@ void Replay::buildTimeline() {
   auto alert_status = cereal::ControlsState::AlertStatus::NORMAL;
   auto alert_size = cereal::ControlsState::AlertSize::NONE;
   uint64_t alert_begin = 0;
-  std::string alert_type;
+  uint32_t alert_type = 0;
 
   const TimelineType timeline_types[] = {
     [(int)cereal::ControlsState::AlertStatus::NORMAL] = TimelineType::AlertInfo,
@@ -169,32 +170,30 @@ void Replay::buildTimeline() {
     std::shared_ptr<LogReader> log(new LogReader());
     if (!log->load(it->second.qlog.toStdString(), &exit_, !hasFlag(REPLAY_FLAG_NO_FILE_CACHE), 0, 3) || log->events.empty()) continue;
 
+    // the changes come from the sidecar index when the qlog was opened before
     std::vector<std::tuple<double, double, TimelineType>> timeline;
-    for (const Event &e : log->events) {
-      if (e.which == cereal::Event::Which::CONTROLS_STATE) {
-        capnp::FlatArrayMessageReader reader(e.data);
-        auto event = reader.getRoot<cereal::Event>();
-        auto cs = event.getControlsState();
-
-        if (engaged != cs.getEnabled()) {
+    for (const auto &entry : log->index().timeline) {
+      if (entry.which == cereal::Event::Which::CONTROLS_STATE) {
+        if (engaged != (bool)entry.enabled) {
           if (engaged) {
-            timeline.push_back({toSeconds(engaged_begin), toSeconds(e.mono_time), TimelineType::Engaged});
+            timeline.push_back({toSeconds(engaged_begin), toSeconds(entry.mono_time), TimelineType::Engaged});
           }
-          engaged_begin = e.mono_time;
-          engaged = cs.getEnabled();
+          engaged_begin = entry.mono_time;
+          engaged = entry.enabled;
         }
 
-        if (alert_type != cs.getAlertType().cStr() || alert_status != cs.getAlertStatus()) {
-          if (!alert_type.empty() && alert_size != cereal::ControlsState::AlertSize::NONE) {
-            timeline.push_back({toSeconds(alert_begin), toSeconds(e.mono_time), timeline_types[(int)alert_status]});
+        auto status = (cereal::ControlsState::AlertStatus)entry.alert_status;
+        if (alert_type != entry.alert_type_hash || alert_status != status) {
+          if (alert_type != 0 && alert_size != cereal::ControlsState::AlertSize::NONE) {
+            timeline.push_back({toSeconds(alert_begin), toSeconds(entry.mono_time), timeline_types[(int)alert_status]});
           }
-          alert_begin = e.mono_time;
-          alert_type = cs.getAlertType().cStr();
-          alert_size = cs.getAlertSize();
-          alert_status = cs.getAlertStatus();
+          alert_begin = entry.mono_time;
+          alert_type = entry.alert_type_hash;
+          alert_size = (cereal::ControlsState::AlertSize)entry.alert_size;
+          alert_status = status;
         }
-      } else if (e.which == cereal::Event::Which::USER_FLAG) {
-        timeline.push_back({toSeconds(e.mono_time), toSeconds(e.mono_time), TimelineType::UserFlag});
+      } else if (entry.which == cereal::Event::Which::USER_FLAG) {
+        timeline.push_back({toSeconds(entry.mono_time), toSeconds(entry.mono_time), TimelineType::UserFlag});
       }
     }
 
@@ -202,7 +201,7 @@ void Replay::buildTimeline() {
       if (engaged) {
         timeline.push_back({toSeconds(engaged_begin), toSeconds(log->events.back().mono_time), TimelineType::Engaged});
       }
-      if (!alert_type.empty() && alert_size != cereal::ControlsState::AlertSize::NONE) {
+      if (alert_type != 0 && alert_size != cereal::ControlsState::AlertSize::NONE) {
         timeline.push_back({toSeconds(alert_begin), toSeconds(log->events.back().mono_time), timeline_types[(int)alert_status]});
       }
 
@@ -218,6 +217,90 @@ void Replay::buildTimeline() {
   }
 }
 
+bool Replay::setLockstep(const std::string &trigger, const std::vector<std::string> &acks) {
+  auto event_struct = capnp::Schema::from<cereal::Event>().asStruct();
+  auto which = [&](const std::string &name) -> int {
+    return services.count(name) ? event_struct.getFieldByName(name).getProto().getDiscriminantValue() : -1;
+  };
+  if (which(trigger) < 0 || !sockets_[which(trigger)] || acks.empty() || sm != nullptr) {
+    rWarning("lockstep needs a published trigger service and at least one ack service");
+    return false;
+  }
+  std::vector<const char *> ack_services;
+  for (const auto &name : acks) {
+    if (which(name) < 0 || sockets_[which(name)]) {
+      rWarning("lockstep ack service %s is unknown or published by replay", name.c_str());
+      return false;
+    }
+    ack_services.push_back(services.at(name).name.c_str());
+  }
+
+  ack_sm_ = std::make_unique<SubMaster>(ack_services);
+  ack_handles_.clear();
+  ack_names_.clear();
+  for (auto name : ack_services) {
+    ack_handles_.push_back(ack_sm_->handle(name));
+    ack_names_.push_back(name);
+  }
+  lockstep_trigger_ = (cereal::Event::Which)which(trigger);
+  rInfo("lockstep on %s, waiting for %zu ack services", trigger.c_str(), acks.size());
+  return true;
+}
+
+void Replay::waitForAcks() {
+  std::vector<bool> acked(ack_handles_.size(), false);
+  const double deadline = millis_since_boot() + LOCKSTEP_ACK_TIMEOUT_MS;
+  while (!paused_ && !exit_) {
+    ack_sm_->update(10);
+    for (int i = 0; i < ack_handles_.size(); ++i) {
+      // an ack sent before the trigger was published is a late ack of an earlier one
+      acked[i] = acked[i] || (ack_sm_->updated(ack_handles_[i]) && (*ack_sm_)[ack_handles_[i]].getLogMonoTime() >= trigger_sent_ns_);
+    }
+    if (std::all_of(acked.begin(), acked.end(), [](bool a) { return a; })) return;
+
+    if (millis_since_boot() > deadline) {
+      // stop waiting for the services that didn't ack, instead of timing out on every trigger
+      for (int i = ack_handles_.size() - 1; i >= 0; --i) {
+        if (acked[i]) continue;
+        rWarning("lockstep: no ack from %s in %d ms, no longer waiting for it", ack_names_[i].c_str(), LOCKSTEP_ACK_TIMEOUT_MS);
+        ack_handles_.erase(ack_handles_.begin() + i);
+        ack_names_.erase(ack_names_.begin() + i);
+        ++lockstep_dropped_;
+      }
+      if (ack_handles_.empty()) {
+        rError("lockstep: no ack services left, publishing without waiting");
+      }
+      return;
+    }
+  }
+}
+
+void Replay::reportLockstep() {
+  const double now = millis_since_boot();
+  const double wall_seconds = (now - lockstep_start_ms_) / 1000.0;
+  const double log_seconds = (cur_mono_time_ - lockstep_start_ts_) / 1e9;
+  if (wall_seconds > 0) {
+    lockstep_speed_ = log_seconds / wall_seconds;
+    rInfo("lockstep: %" PRIu64 " events, %.0f events/s, %.1fx real time, %d ack services dropped", lockstep_events_,
+          lockstep_events_ / wall_seconds, log_seconds / wall_seconds, lockstep_dropped_);
+  }
+  lockstep_report_ms_ = now;
+}
+
+PrefetchStats Replay::prefetchStats() const {
+  PrefetchStats stats;
+  stats.stalls = stalls_;
+  stats.stall_seconds = stall_seconds_;
+  const uint64_t end_ts = buffered_end_ts_, cur_ts = cur_mono_time_;
+  stats.buffered_seconds = end_ts > cur_ts ? (end_ts - cur_ts) / 1e9 : 0;
+  stats.target_seconds = target_buffer_seconds_;
+  stats.memory_bytes = memory_bytes_;
+  stats.merges = merges_;
+  stats.avg_merge_ms = merges_ > 0 ? merge_ms_ / merges_ : 0;
+  stats.max_merge_ms = max_merge_ms_;
+  return stats;
+}
+
 std::optional<uint64_t> Replay::find(FindFlag flag) {
   int cur_ts = currentSeconds();
   for (auto [start_ts, end_ts, type] : getTimeline()) {
@@ -260,13 +343,18 @@ void Replay::pauseStreamThread() {
 }
 
 void Replay::segmentLoadFinished(bool success) {
+  Segment *seg = qobject_cast<Segment *>(sender());
   if (!success) {
-    Segment *seg = qobject_cast<Segment *>(sender());
     rWarning("failed to load segment %d, removing it from current replay list", seg->seg_num);
     updateEvents([&]() {
       segments_.erase(seg->seg_num);
       return !segments_.empty();
     });
+  } else {
+    const double load_seconds = seg->loadSeconds();
+    const size_t bytes = seg->memoryUsage();
+    avg_load_seconds_ = avg_load_seconds_ == 0 ? load_seconds : avg_load_seconds_ * 0.7 + load_seconds * 0.3;
+    avg_segment_bytes_ = avg_segment_bytes_ == 0 ? bytes : size_t(avg_segment_bytes_ * 0.7 + bytes * 0.3);
   }
   updateSegmentsCache();
 }
@@ -275,17 +363,49 @@ void Replay::updateSegmentsCache() {
   auto cur = segments_.lower_bound(current_segment_.load());
   if (cur == segments_.end()) return;
 
+  // Buffer enough playback to cover loading the next segments at the current speed
+  const double speed = lockstep_trigger_ ? lockstep_speed_.load() : speed_.load();
+  const double target = std::max(MIN_BUFFER_SECONDS, 2 * avg_load_seconds_ * speed);
+  target_buffer_seconds_ = target;
+
   // Calculate the range of segments to load
-  auto begin = std::prev(cur, std::min<int>(segment_cache_limit / 2, std::distance(segments_.begin(), cur)));
-  auto end = std::next(begin, std::min<int>(segment_cache_limit, std::distance(begin, segments_.end())));
-  begin = std::prev(end, std::min<int>(segment_cache_limit, std::distance(segments_.begin(), end)));
+  const int behind = segment_cache_limit / 2;
+  const int window = std::max<int>(segment_cache_limit, behind + 1 + std::ceil(target / 60.0));
+  auto begin = std::prev(cur, std::min<int>(behind, std::distance(segments_.begin(), cur)));
+  auto end = std::next(begin, std::min<int>(window, std::distance(begin, segments_.end())));
+  begin = std::prev(end, std::min<int>(window, std::distance(segments_.begin(), end)));
+
+  if (memory_limit_ > 0) {
+    // segments that are not loaded yet are expected to use as much as the loaded ones
+    auto segment_bytes = [this](const auto &it) {
+      return it.second && it.second->isLoaded() ? it.second->memoryUsage() : avg_segment_bytes_;
+    };
+    size_t total = 0;
+    std::for_each(begin, end, [&](const auto &it) { total += segment_bytes(it); });
+    // drop the segments furthest behind first, then the ones furthest ahead
+    for (; total > memory_limit_ && begin != cur; ++begin) {
+      total -= segment_bytes(*begin);
+    }
+    while (total > memory_limit_ && std::next(cur) != end) {
+      total -= segment_bytes(*(--end));
+    }
+  }
 
   loadSegmentInRange(begin, cur, end);
   mergeSegments(begin, end);
 
   // free segments out of current semgnt window.
-  std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(nullptr); });
-  std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(nullptr); });
+  std::for_each(segments_.begin(), begin, [](auto &e) { e.second.reset(); });
+  std::for_each(end, segments_.end(), [](auto &e) { e.second.reset(); });
+
+  size_t memory = 0;
+  std::for_each(begin, end, [&](const auto &it) { memory += it.second ? it.second->memoryUsage() : 0; });
+  memory_bytes_ = memory;
+
+  // the buffer ends with the last merged segment that directly follows the current one
+  auto last = cur;
+  while (last != end && isSegmentMerged(last->first)) ++last;
+  buffered_end_ts_ = last != cur ? std::prev(last)->second->log->events.back().mono_time : 0;
 
   // start stream thread
   const auto &cur_segment = cur->second;
@@ -295,60 +415,66 @@ void Replay::updateSegmentsCache() {
 }
 
 void Replay::loadSegmentInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end) {
-  auto loadNextSegment = [this](auto first, auto last) {
-    auto it = std::find_if(first, last, [](const auto &seg_it) { return !seg_it.second || !seg_it.second->isLoaded(); });
-    if (it != last && !it->second) {
-      rDebug("loading segment %d...", it->first);
-      it->second = std::make_unique<Segment>(it->first, route_->at(it->first), flags_, filters_);
-      QObject::connect(it->second.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
-      return true;
+  // load more than one segment at a time while the buffer ahead is short
+  const int max_loading = prefetchStats().buffered_seconds < target_buffer_seconds_ ? MAX_PREFETCH_LOADS : 1;
+  int loading = std::count_if(begin, end, [](const auto &it) { return it.second && !it.second->isLoaded(); });
+
+  auto loadSegments = [&](auto first, auto last) {
+    for (auto it = first; it != last && loading < max_loading; ++it) {
+      if (!it->second) {
+        rDebug("loading segment %d...", it->first);
+        it->second = std::make_shared<Segment>(it->first, route_->at(it->first), flags_, filters_);
+        QObject::connect(it->second.get(), &Segment::loadFinished, this, &Replay::segmentLoadFinished);
+        ++loading;
+      }
     }
-    return false;
   };
 
   // Try loading forward segments, then reverse segments
-  if (!loadNextSegment(cur, end)) {
-    loadNextSegment(std::make_reverse_iterator(cur), std::make_reverse_iterator(begin));
-  }
+  loadSegments(cur, end);
+  loadSegments(std::make_reverse_iterator(cur), std::make_reverse_iterator(begin));
 }
 
 void Replay::mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end) {
-  std::set<int> segments_to_merge;
-  size_t new_events_size = 0;
+  std::vector<int> segments_to_merge;
+  std::vector<EventTimeline::Span> spans;
   for (auto it = begin; it != end; ++it) {
     if (it->second && it->second->isLoaded()) {
-      segments_to_merge.insert(it->first);
-      new_events_size += it->second->log->events.size();
+      segments_to_merge.push_back(it->first);
+      spans.push_back({it->first, it->second, &it->second->log->events});
     }
   }
 
-  if (segments_to_merge == merged_segments_) return;
+  auto current = events();
+  if (current ? current->sameSegments(segments_to_merge) : segments_to_merge.empty()) return;
 
   rDebug("merge segments %s", std::accumulate(segments_to_merge.begin(), segments_to_merge.end(), std::string{},
     [](auto & a, int b) { return a + (a.empty() ? "" : ", ") + std::to_string(b); }).c_str());
 
-  std::vector<Event> new_events;
-  new_events.reserve(new_events_size);
-
-  // Merge events from segments_to_merge into new_events
-  for (int n : segments_to_merge) {
-    size_t size = new_events.size();
-    const auto &events = segments_.at(n)->log->events;
-    std::copy_if(events.begin(), events.end(), std::back_inserter(new_events),
-                  [this](const Event &e) { return e.which < sockets_.size() && sockets_[e.which] != nullptr; });
-    std::inplace_merge(new_events.begin(), new_events.begin() + size, new_events.end());
+  // the segments are shared with the new timeline instead of copying their events, so the stream thread only
+  // has to pick up the new snapshot. segments it still plays from stay alive until it lets go of its snapshot.
+  const double start_ms = millis_since_boot();
+  std::vector<bool> allowed(sockets_.size());
+  for (int i = 0; i < sockets_.size(); ++i) allowed[i] = sockets_[i] != nullptr;
+  auto merged = std::make_shared<const EventTimeline>(std::move(spans), std::move(allowed));
+  {
+    std::lock_guard lk(events_lock_);
+    events_ = merged;
   }
+  ++events_version_;
+  const double merge_ms = millis_since_boot() - start_ms;
+  merge_ms_ = merge_ms_ + merge_ms;
+  max_merge_ms_ = std::max<double>(max_merge_ms_, merge_ms);
+  ++merges_;
 
   if (stream_thread_) {
     emit segmentsMerged();
   }
 
-  updateEvents([&]() {
-    events_.swap(new_events);
-    merged_segments_ = segments_to_merge;
-    // Wake up the stream thread if the current segment is loaded or invalid.
-    return !seeking_to_ && (isSegmentMerged(current_segment_) || (segments_.count(current_segment_) == 0));
-  });
+  // Wake up the stream thread if it ran out of events and the current segment is loaded or invalid.
+  if (waiting_for_events_ && !seeking_to_ && (merged->contains(current_segment_) || segments_.count(current_segment_) == 0)) {
+    updateEvents([]() { return true; });
+  }
   checkSeekProgress();
 }
 
@@ -424,7 +550,7 @@ void Replay::publishMessage(const Event *e) {
   }
 }
 
-void Replay::publishFrame(const Event *e) {
+void Replay::publishFrame(const Event *e, const EventTimeline &events) {
   CameraType cam;
   switch (e->which) {
     case cereal::Event::ROAD_ENCODE_IDX: cam = RoadCam; break;
@@ -436,8 +562,7 @@ void Replay::publishFrame(const Event *e) {
   if ((cam == DriverCam && !hasFlag(REPLAY_FLAG_DCAM)) || (cam == WideRoadCam && !hasFlag(REPLAY_FLAG_ECAM)))
     return;  // Camera isdisabled
 
-  if (isSegmentMerged(e->eidx_segnum)) {
-    auto &segment = segments_.at(e->eidx_segnum);
+  if (auto segment = events.segment(e->eidx_segnum)) {
     if (auto &frame = segment->frames[cam]; frame) {
       camera_server_->pushFrame(cam, frame.get(), e);
     }
@@ -447,48 +572,90 @@ void Replay::publishFrame(const Event *e) {
 void Replay::streamThread() {
   stream_thread_id = pthread_self();
   cereal::Event::Which cur_which = cereal::Event::Which::INIT_DATA;
+  std::shared_ptr<const EventTimeline> events;
   std::unique_lock lk(stream_lock_);
 
   while (true) {
     stream_cv_.wait(lk, [=]() { return exit_ || ( events_ready_ && !paused_); });
     if (exit_) break;
 
-    Event event(cur_which, cur_mono_time_, {});
-    auto first = std::upper_bound(events_.cbegin(), events_.cend(), event);
-    if (first == events_.cend()) {
+    waiting_for_events_ = false;
+    const uint64_t version = events_version_;
+    releaseEvents(events, this->events());
+    EventTimeline::Iterator it(*events, Event(cur_which, cur_mono_time_, {}));
+    if (!it.get()) {
+      // set before checking for a merge, so the main thread either sees it or this thread sees the merge
+      waiting_for_events_ = true;
+      if (events_version_ != version) continue;
+
       rInfo("waiting for events...");
       events_ready_ = false;
+      if (!isSegmentMerged(segments_.rbegin()->first)) {
+        ++stalls_;
+        stall_begin_ms_ = millis_since_boot();
+      }
       continue;
     }
+    if (stall_begin_ms_ > 0) {
+      stall_seconds_ = stall_seconds_ + (millis_since_boot() - stall_begin_ms_) / 1000.0;
+      stall_begin_ms_ = 0;
+    }
 
-    auto it = publishEvents(first, events_.cend());
+    const Event *next = publishEvents(events, it);
 
     // Ensure frames are sent before unlocking to prevent race conditions
     if (camera_server_) {
       camera_server_->waitForSent();
     }
 
-    if (it != events_.cend()) {
-      cur_which = it->which;
-    } else if (!hasFlag(REPLAY_FLAG_NO_LOOP)) {
+    if (next) {
+      cur_which = next->which;
+    } else {
       // Check for loop end and restart if necessary
       int last_segment = segments_.rbegin()->first;
-      if (current_segment_ >= last_segment && isSegmentMerged(last_segment)) {
-        rInfo("reaches the end of route, restart from beginning");
-        QMetaObject::invokeMethod(this, std::bind(&Replay::seekTo, this, minSeconds(), false), Qt::QueuedConnection);
+      if (current_segment_ >= last_segment && events->contains(last_segment)) {
+        if (lockstep_trigger_) reportLockstep();
+        if (!hasFlag(REPLAY_FLAG_NO_LOOP)) {
+          rInfo("reaches the end of route, restart from beginning");
+          QMetaObject::invokeMethod(this, std::bind(&Replay::seekTo, this, minSeconds(), false), Qt::QueuedConnection);
+        }
       }
     }
   }
+  releaseEvents(events, nullptr);
 }
 
-std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::const_iterator first,
-                                                         std::vector<Event>::const_iterator last) {
+// Frames still queued from the old snapshot are sent before it is dropped, and its segments are
+// destroyed in the main thread where they were created.
+void Replay::releaseEvents(std::shared_ptr<const EventTimeline> &events, std::shared_ptr<const EventTimeline> next) {
+  if (events == next) return;
+
+  if (camera_server_) {
+    camera_server_->waitForSent();
+  }
+  if (events) {
+    QMetaObject::invokeMethod(this, [old = std::move(events)]() {}, Qt::QueuedConnection);
+  }
+  events = std::move(next);
+}
+
+const Event *Replay::publishEvents(std::shared_ptr<const EventTimeline> &events, EventTimeline::Iterator &it) {
   uint64_t evt_start_ts = cur_mono_time_;
   uint64_t loop_start_ts = nanos_since_boot();
   double prev_replay_speed = speed_;
 
-  for (; !paused_ && first != last; ++first) {
-    const Event &evt = *first;
+  uint64_t version = events_version_;
+  for (; !paused_ && it.get(); it.next()) {
+    if (events_version_ != version) {
+      // segments were merged or evicted, continue at the same position in the new snapshot
+      version = events_version_;
+      auto next_events = this->events();
+      it = EventTimeline::Iterator(*next_events, it);
+      releaseEvents(events, std::move(next_events));
+      if (!it.get()) break;
+    }
+
+    const Event &evt = *it.get();
     int segment = toSeconds(evt.mono_time) / 60;
 
     if (current_segment_ != segment) {
@@ -500,31 +667,54 @@ std::vector<Event>::const_iterator Replay::publishEvents(std::vector<Event>::con
     if (!sockets_[evt.which]) continue;
 
     cur_mono_time_ = evt.mono_time;
-    const uint64_t current_nanos = nanos_since_boot();
-    const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
-
-    // Reset timestamps for potential synchronization issues:
-    // - A negative time_diff may indicate slow execution or system wake-up,
-    // - A time_diff exceeding 1 second suggests a skipped segment.
-    if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
-      evt_start_ts = evt.mono_time;
-      loop_start_ts = current_nanos;
-      prev_replay_speed = speed_;
-    } else if (time_diff > 0) {
-      precise_nano_sleep(time_diff, paused_);
+    if (lockstep_trigger_) {
+      // no pacing, the consumers set the pace with their acks
+      if (lockstep_start_ms_ == 0) {
+        lockstep_start_ms_ = lockstep_report_ms_ = millis_since_boot();
+        lockstep_start_ts_ = evt.mono_time;
+      }
+    } else {
+      const uint64_t current_nanos = nanos_since_boot();
+      const int64_t time_diff = (evt.mono_time - evt_start_ts) / speed_ - (current_nanos - loop_start_ts);
+
+      // Reset timestamps for potential synchronization issues:
+      // - A negative time_diff may indicate slow execution or system wake-up,
+      // - A time_diff exceeding 1 second suggests a skipped segment.
+      if ((time_diff < -1e9 || time_diff >= 1e9) || speed_ != prev_replay_speed) {
+        evt_start_ts = evt.mono_time;
+        loop_start_ts = current_nanos;
+        prev_replay_speed = speed_;
+      } else if (time_diff > 0) {
+        precise_nano_sleep(time_diff, paused_);
+      }
     }
 
     if (paused_) break;
 
     if (evt.eidx_segnum == -1) {
+      if (lockstep_trigger_ && evt.which == *lockstep_trigger_) {
+        // acks still queued from the previous trigger don't count for this one
+        ack_sm_->update(0);
+        trigger_sent_ns_ = nanos_since_boot();
+      }
       publishMessage(&evt);
     } else if (camera_server_) {
-      if (speed_ > 1.0) {
+      if (speed_ > 1.0 || lockstep_trigger_) {
         camera_server_->waitForSent();
       }
-      publishFrame(&evt);
+      publishFrame(&evt, *events);
+    }
+
+    if (lockstep_trigger_) {
+      ++lockstep_events_;
+      if (evt.which == *lockstep_trigger_ && evt.eidx_segnum == -1) {
+        waitForAcks();
+      }
+      if (millis_since_boot() - lockstep_report_ms_ > 10000) {
+        reportLockstep();
+      }
     }
   }
 
-  return first;
+  return it.get();
 }
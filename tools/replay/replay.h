@@ -4,7 +4,6 @@
 #include <map>
 #include <memory>
 #include <optional>
-#include <set>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -13,12 +12,19 @@
 #include <QThread>
 
 #include "tools/replay/camera.h"
+#include "tools/replay/eventtimeline.h"
 #include "tools/replay/route.h"
 
 const QString DEMO_ROUTE = "a2a0ccea32023010|2023-07-27--13-01-19";
 
-// one segment uses about 100M of memory
+// one segment uses about 100M of memory unless its log can be mapped from disk
 constexpr int MIN_SEGMENTS_CACHE = 5;
+// segments are prefetched far enough ahead to keep at least this much playback buffered
+constexpr double MIN_BUFFER_SECONDS = 30;
+// segments loaded at the same time while the buffer is below its target
+constexpr int MAX_PREFETCH_LOADS = 2;
+// lockstep stops waiting for an ack service that hasn't acked for this long, so a stuck consumer can't hang replay
+constexpr int LOCKSTEP_ACK_TIMEOUT_MS = 5000;
 
 enum REPLAY_FLAGS {
   REPLAY_FLAG_NONE = 0x0000,
@@ -43,12 +49,26 @@ enum class FindFlag {
 
 enum class TimelineType { None, Engaged, AlertInfo, AlertWarning, AlertCritical, UserFlag };
 typedef bool (*replayEventFilter)(const Event *, void *);
+
+struct PrefetchStats {
+  int stalls = 0;                 // playback ran out of loaded events before the end of the route
+  double stall_seconds = 0;       // time spent waiting in those stalls
+  double buffered_seconds = 0;    // loaded playback time ahead of the current position
+  double target_seconds = 0;      // buffer the prefetcher aims for at the current speed
+  size_t memory_bytes = 0;        // held by the cached segments
+  int merges = 0;                 // segment boundaries merged into the events
+  double avg_merge_ms = 0;        // main thread time per merge, the stream thread keeps running
+  double max_merge_ms = 0;
+};
+
 Q_DECLARE_METATYPE(std::shared_ptr<LogReader>);
 
 class Replay : public QObject {
   Q_OBJECT
 
 public:
+  typedef std::map<int, std::shared_ptr<Segment>> SegmentMap;
+
   Replay(QString route, QStringList allow, QStringList block, SubMaster *sm = nullptr,
          uint32_t flags = REPLAY_FLAG_NONE, QString data_dir = "", QObject *parent = 0);
   ~Replay();
@@ -69,6 +89,15 @@ public:
   }
   inline int segmentCacheLimit() const { return segment_cache_limit; }
   inline void setSegmentCacheLimit(int n) { segment_cache_limit = std::max(MIN_SEGMENTS_CACHE, n); }
+  // evict cached segments once they use more than this, 0 only limits the segment count
+  inline void setMemoryLimit(size_t bytes) { memory_limit_ = bytes; }
+  inline size_t memoryLimit() const { return memory_limit_; }
+  PrefetchStats prefetchStats() const;
+  // Lockstep: publish without pacing, but after each message of the trigger service wait until every ack
+  // service has published once. The ack services must be blocked so replay doesn't publish them itself.
+  // Only acks sent after the trigger was published count. An ack service that doesn't ack within
+  // LOCKSTEP_ACK_TIMEOUT_MS is no longer waited for.
+  bool setLockstep(const std::string &trigger, const std::vector<std::string> &acks);
   inline bool hasFlag(REPLAY_FLAGS flag) const { return flags_ & flag; }
   inline void addFlag(REPLAY_FLAGS flag) { flags_ |= flag; }
   inline void removeFlag(REPLAY_FLAGS flag) { flags_ &= ~flag; }
@@ -82,8 +111,12 @@ public:
   inline double maxSeconds() const { return max_seconds_; }
   inline void setSpeed(float speed) { speed_ = speed; }
   inline float getSpeed() const { return speed_; }
-  inline const std::vector<Event> *events() const { return &events_; }
-  inline const std::map<int, std::unique_ptr<Segment>> &segments() const { return segments_; }
+  // snapshot of the merged events, it stays valid while segments are merged or evicted
+  inline std::shared_ptr<const EventTimeline> events() const {
+    std::lock_guard lk(events_lock_);
+    return events_;
+  }
+  inline const SegmentMap &segments() const { return segments_; }
   inline const std::string &carFingerprint() const { return car_fingerprint_; }
   inline const std::vector<std::tuple<double, double, TimelineType>> getTimeline() {
     std::lock_guard lk(timeline_lock);
@@ -102,7 +135,6 @@ protected slots:
   void segmentLoadFinished(bool success);
 
 protected:
-  typedef std::map<int, std::unique_ptr<Segment>> SegmentMap;
   std::optional<uint64_t> find(FindFlag flag);
   void pauseStreamThread();
   void startStream(const Segment *cur_segment);
@@ -111,13 +143,18 @@ protected:
   void loadSegmentInRange(SegmentMap::iterator begin, SegmentMap::iterator cur, SegmentMap::iterator end);
   void mergeSegments(const SegmentMap::iterator &begin, const SegmentMap::iterator &end);
   void updateEvents(const std::function<bool()>& update_events_function);
-  std::vector<Event>::const_iterator publishEvents(std::vector<Event>::const_iterator first,
-                                                   std::vector<Event>::const_iterator last);
+  const Event *publishEvents(std::shared_ptr<const EventTimeline> &events, EventTimeline::Iterator &it);
+  void releaseEvents(std::shared_ptr<const EventTimeline> &events, std::shared_ptr<const EventTimeline> next);
   void publishMessage(const Event *e);
-  void publishFrame(const Event *e);
+  void publishFrame(const Event *e, const EventTimeline &events);
   void buildTimeline();
+  void waitForAcks();
+  void reportLockstep();
   void checkSeekProgress();
-  inline bool isSegmentMerged(int n) const { return merged_segments_.count(n) > 0; }
+  inline bool isSegmentMerged(int n) const {
+    auto e = events();
+    return e && e->contains(n);
+  }
 
   pthread_t stream_thread_id = 0;
   QThread *stream_thread_ = nullptr;
@@ -135,8 +172,14 @@ protected:
   uint64_t route_start_ts_ = 0;
   std::atomic<uint64_t> cur_mono_time_ = 0;
   std::atomic<double> max_seconds_ = 0;
-  std::vector<Event> events_;
-  std::set<int> merged_segments_;
+
+  // merged events, swapped by the main thread without stopping the stream thread
+  mutable std::mutex events_lock_;
+  std::shared_ptr<const EventTimeline> events_;
+  std::atomic<uint64_t> events_version_ = 0;
+  std::atomic<bool> waiting_for_events_ = false;
+  std::atomic<int> merges_ = 0;
+  std::atomic<double> merge_ms_ = 0, max_merge_ms_ = 0;
 
   // messaging
   SubMaster *sm = nullptr;
@@ -155,4 +198,27 @@ protected:
   replayEventFilter event_filter = nullptr;
   void *filter_opaque = nullptr;
   int segment_cache_limit = MIN_SEGMENTS_CACHE;
+
+  // prefetching, the averages are only used in the main thread
+  std::atomic<size_t> memory_limit_ = 0;
+  double avg_load_seconds_ = 0;
+  size_t avg_segment_bytes_ = 0;
+  std::atomic<double> target_buffer_seconds_ = MIN_BUFFER_SECONDS;
+  std::atomic<uint64_t> buffered_end_ts_ = 0;
+  std::atomic<size_t> memory_bytes_ = 0;
+  std::atomic<int> stalls_ = 0;
+  std::atomic<double> stall_seconds_ = 0;
+  double stall_begin_ms_ = 0;
+
+  // lockstep, used in the stream thread after setup
+  std::optional<cereal::Event::Which> lockstep_trigger_;
+  std::unique_ptr<SubMaster> ack_sm_;
+  std::vector<SubMaster::Handle> ack_handles_;
+  std::vector<std::string> ack_names_;
+  uint64_t trigger_sent_ns_ = 0;
+  uint64_t lockstep_events_ = 0;
+  int lockstep_dropped_ = 0;  // ack services that timed out
+  double lockstep_start_ms_ = 0, lockstep_report_ms_ = 0;
+  uint64_t lockstep_start_ts_ = 0;
+  std::atomic<double> lockstep_speed_ = 1.0;  // achieved speed-up, drives prefetching
 };
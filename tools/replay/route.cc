@@ -8,6 +8,7 @@
 #include <QtConcurrent>
 #include <array>
 
+#include "common/timing.h"
 #include "selfdrive/ui/qt/api.h"
 #include "system/hardware/hw.h"
 #include "tools/replay/replay.h"
@@ -140,7 +141,7 @@ void Route::addFileToSegment(int n, const QString &file) {
 // class Segment
 
 Segment::Segment(int n, const SegmentFile &files, uint32_t flags, const std::vector<bool> &filters)
-    : seg_num(n), flags(flags), filters_(filters) {
+    : seg_num(n), flags(flags), filters_(filters), load_start_ms_(millis_since_boot()) {
   // [RoadCam, DriverCam, WideRoadCam, log]. fallback to qcamera/qlog
   const std::array file_list = {
       (flags & REPLAY_FLAG_QCAMERA) || files.road_cam.isEmpty() ? files.qcamera : files.road_cam,
@@ -180,6 +181,17 @@ void Segment::loadFile(int id, const std::string file) {
   }
 
   if (--loading_ == 0) {
+    load_seconds_ = (millis_since_boot() - load_start_ms_) / 1000.0;
     emit loadFinished(!abort_);
   }
 }
+
+size_t Segment::memoryUsage() const {
+  if (!isLoaded()) return 0;
+
+  size_t bytes = log ? log->memoryUsage() : 0;
+  for (const auto &f : frames) {
+    if (f) bytes += f->getFrameCount() * sizeof(FrameReader::PacketInfo) + f->memoryUsage();
+  }
+  return bytes;
+}
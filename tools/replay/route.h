@@ -69,6 +69,9 @@ public:
   Segment(int n, const SegmentFile &files, uint32_t flags, const std::vector<bool> &filters = {});
   ~Segment();
   inline bool isLoaded() const { return !loading_ && !abort_; }
+  size_t memoryUsage() const;
+  // wall time from construction until the last file finished loading
+  inline double loadSeconds() const { return load_seconds_; }
 
   const int seg_num = 0;
   std::unique_ptr<LogReader> log;
@@ -82,7 +85,9 @@ protected:
 
   std::atomic<bool> abort_ = false;
   std::atomic<int> loading_ = 0;
+  std::atomic<double> load_seconds_ = 0;
   QFutureSynchronizer<void> synchronizer_;
   uint32_t flags;
   std::vector<bool> filters_;
+  const double load_start_ms_;
 };
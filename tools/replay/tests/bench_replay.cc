@@ -0,0 +1,299 @@
+// Benchmarks for tools/replay over a local route, no network access is needed.
+//
+// usage: bench_replay <benchmark> <route> <data_dir>
+//   e.g. bench_replay index "a2a0ccea32023010|2023-07-27--13-01-19" /data/media/0/realdata
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QTimer>
+#include <capnp/schema.h>
+
+#include "common/timing.h"
+#include "common/util.h"
+#include "tools/replay/camera.h"
+#include "tools/replay/extractor.h"
+#include "tools/replay/filereader.h"
+#include "tools/replay/logreader.h"
+#include "tools/replay/replay.h"
+#include "tools/replay/route.h"
+
+static size_t rss_bytes() {
+  size_t pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    fscanf(f, "%zu %zu", &pages, &resident);
+    fclose(f);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static std::vector<std::string> route_logs(Route &route) {
+  std::vector<std::string> logs;
+  for (auto &[n, f] : route.segments()) {
+    auto log = f.rlog.isEmpty() ? f.qlog : f.rlog;
+    if (!log.isEmpty()) logs.push_back(log.toStdString());
+  }
+  return logs;
+}
+
+// load every segment of the route and keep them all, the way replay keeps its segment cache
+static void bench_logreader(Route &route) {
+  const auto logs = route_logs(route);
+  for (auto &log : logs) std::remove((cacheFilePath(log) + ".raw").c_str());
+
+  const std::pair<const char *, bool> modes[] = {{"in memory", false}, {"mapped (cold cache)", true}, {"mapped (warm cache)", true}};
+  for (auto &[name, local_cache] : modes) {
+    size_t rss = rss_bytes();
+    double start = millis_since_boot();
+    std::vector<std::unique_ptr<LogReader>> readers;
+    size_t events = 0;
+    for (auto &log : logs) {
+      auto &reader = readers.emplace_back(std::make_unique<LogReader>());
+      reader->load(log, nullptr, local_cache, 0, 0);
+      events += reader->events.size();
+    }
+    double ms = millis_since_boot() - start;
+    printf("%-24s %8.1f ms/segment  %8.1f MB resident/segment  %zu events\n", name, ms / logs.size(),
+           (rss_bytes() - rss) / (1024.0 * 1024.0) / logs.size(), events);
+  }
+}
+
+// open every segment the way a route is reopened: nothing cached, only the decompressed logs, logs and sidecar index
+static void bench_index(Route &route) {
+  const auto logs = route_logs(route);
+  auto remove_files = [&](bool raw, bool index) {
+    for (auto &log : logs) {
+      if (raw) std::remove((cacheFilePath(log) + ".raw").c_str());
+      if (index) std::remove(LogIndex::filePath(log).c_str());
+    }
+  };
+  auto open_route = [&](const char *name) {
+    double start = millis_since_boot();
+    size_t events = 0;
+    for (auto &log : logs) {
+      LogReader reader;
+      reader.load(log, nullptr, true, 0, 0);
+      events += reader.events.size();
+    }
+    double ms = millis_since_boot() - start;
+    printf("%-24s %8.1f ms total  %8.1f ms/segment  %zu events\n", name, ms, ms / logs.size(), events);
+  };
+
+  remove_files(true, true);
+  open_route("cold");
+  remove_files(false, true);
+  open_route("warm (no index)");
+  open_route("warm (index)");
+}
+
+// play the route at increasing speeds through a throttled FileReader without the local cache.
+// THROTTLE_MBPS sets the read rate, CACHE_MB the memory limit of the segment cache.
+static void bench_prefetch(Route &route) {
+  FileReader::setRateLimit((size_t)util::getenv("THROTTLE_MBPS", 8) * 1024 * 1024);
+  const size_t memory_limit = (size_t)util::getenv("CACHE_MB", 512) * 1024 * 1024;
+  const int play_seconds = 30;
+
+  for (float speed : {1.0f, 4.0f, 10.0f, 20.0f}) {
+    Replay replay(route.name(), {"carState", "can"}, {}, nullptr, REPLAY_FLAG_NO_VIPC | REPLAY_FLAG_NO_FILE_CACHE | REPLAY_FLAG_NO_LOOP, route.dir());
+    replay.setMemoryLimit(memory_limit);
+    if (!replay.load()) return;
+    replay.setSpeed(speed);
+    replay.start();
+
+    double buffered_sum = 0, peak_memory = 0;
+    int samples = 0;
+    QEventLoop loop;
+    QTimer timer;
+    QObject::connect(&timer, &QTimer::timeout, [&]() {
+      auto stats = replay.prefetchStats();
+      buffered_sum += stats.buffered_seconds;
+      peak_memory = std::max<double>(peak_memory, stats.memory_bytes);
+      if (++samples >= play_seconds * 10) loop.quit();
+    });
+    timer.start(100);
+    loop.exec();
+
+    auto stats = replay.prefetchStats();
+    printf("speed %5.1fx  %3d stalls  %6.1f s stalled  %6.1f s buffered (avg)  %6.1f s target  %7.1f MB peak  %6.2f ms/merge\n", speed,
+           stats.stalls, stats.stall_seconds, buffered_sum / samples, stats.target_seconds, peak_memory / (1024.0 * 1024.0),
+           stats.avg_merge_ms);
+  }
+  FileReader::setRateLimit(0);
+}
+
+// play the cameras of the first segment in real time at 2x in software, one thread per camera like CameraServer.
+// a frame is dropped if it is decoded after the next one is due.
+static void bench_framereader(Route &route) {
+  const auto &files = route.segments().begin()->second;
+  const QString cam_files[] = {files.road_cam, files.driver_cam, files.wide_road_cam};
+  const double speed = 2.0, frame_ms = 50.0 / speed;
+
+  for (bool decode_ahead : {false, true}) {
+    std::vector<std::unique_ptr<FrameReader>> readers;
+    for (int i = 0; i < MAX_CAMERAS; ++i) {
+      if (cam_files[i].isEmpty()) continue;
+      auto &fr = readers.emplace_back(std::make_unique<FrameReader>(decode_ahead));
+      if (!fr->load(ALL_CAMERAS[i], cam_files[i].toStdString(), true, nullptr, true)) readers.pop_back();
+    }
+
+    std::atomic<size_t> frames = 0, dropped = 0;
+    double start = millis_since_boot();
+    std::vector<std::thread> threads;
+    for (auto &fr : readers) {
+      threads.emplace_back([&, fr = fr.get()]() {
+        auto [nv12_width, nv12_height, nv12_buffer_size] = get_nv12_info(fr->width, fr->height);
+        VisionBuf buf;
+        buf.allocate(nv12_buffer_size);
+        buf.init_yuv(fr->width, fr->height, nv12_width, nv12_width * nv12_height);
+        for (int i = 0; i < fr->getFrameCount(); ++i) {
+          double due = start + i * frame_ms;
+          if (double now = millis_since_boot(); now < due) util::sleep_for(due - now);
+          fr->get(i, &buf);
+          ++frames;
+          if (millis_since_boot() > due + frame_ms) ++dropped;
+        }
+        buf.free();
+      });
+    }
+    for (auto &t : threads) t.join();
+
+    double seconds = (millis_since_boot() - start) / 1000.0;
+    printf("%-14s %zu cameras at %.0fx  %8.1f fps decoded  %zu/%zu frames dropped\n", decode_ahead ? "decode ahead" : "serial",
+           readers.size(), speed, frames / seconds, (size_t)dropped, (size_t)frames);
+  }
+}
+
+// decompress and parse every segment without the local cache, the way a remote route is loaded.
+// the time to first event is when LogReader parsed it, replay itself waits for the whole segment
+static void bench_decompress(Route &route) {
+  const auto logs = route_logs(route);
+  double first_event_ms = 0;
+  double start = millis_since_boot();
+  size_t events = 0;
+  for (auto &log : logs) {
+    LogReader reader;
+    double segment_start = millis_since_boot();
+    bool first = true;
+    reader.progress_callback = [&](size_t) {
+      if (first) first_event_ms += millis_since_boot() - segment_start;
+      first = false;
+    };
+    reader.load(log, nullptr, false, 0, 0);
+    events += reader.events.size();
+  }
+  double seconds = (millis_since_boot() - start) / 1000.0;
+  printf("time to first event %8.1f ms/segment  %8.2f segments/s  %zu events\n", first_event_ms / logs.size(),
+         logs.size() / seconds, events);
+}
+
+// slide a window of segments over the route the way the segment cache does and time each boundary.
+// a full rebuild copies and merges the events of the whole window while the stream thread waits,
+// the timeline only builds its spans and the stream thread repositions its iterator.
+static void bench_merge(Route &route) {
+  const auto logs = route_logs(route);
+  std::vector<std::unique_ptr<LogReader>> readers;
+  for (auto &log : logs) {
+    auto &reader = readers.emplace_back(std::make_unique<LogReader>());
+    reader->load(log, nullptr, true, 0, 0);
+  }
+  const int window = std::min<int>(MIN_SEGMENTS_CACHE, readers.size());
+  const std::vector<bool> allowed(capnp::Schema::from<cereal::Event>().asStruct().getUnionFields().size(), true);
+
+  auto run = [&](const char *name, std::function<void(int, int)> merge) {
+    double total = 0, max_ms = 0;
+    int boundaries = 0;
+    for (int begin = 0; begin + window <= readers.size(); ++begin, ++boundaries) {
+      double start = millis_since_boot();
+      merge(begin, begin + window);
+      double ms = millis_since_boot() - start;
+      total += ms;
+      max_ms = std::max(max_ms, ms);
+    }
+    printf("%-16s %3d boundaries  %8.2f ms/boundary (avg)  %8.2f ms (max)\n", name, boundaries,
+           boundaries ? total / boundaries : 0, max_ms);
+  };
+
+  run("full rebuild", [&](int begin, int end) {
+    std::vector<Event> events;
+    for (int i = begin; i < end; ++i) {
+      size_t size = events.size();
+      events.insert(events.end(), readers[i]->events.begin(), readers[i]->events.end());
+      std::inplace_merge(events.begin(), events.begin() + size, events.end());
+    }
+  });
+  run("timeline", [&](int begin, int end) {
+    std::vector<EventTimeline::Span> spans;
+    for (int i = begin; i < end; ++i) {
+      spans.push_back({i, nullptr, &readers[i]->events});
+    }
+    EventTimeline timeline(std::move(spans), allowed);
+    // the stream thread continues from the first event of the newest segment
+    EventTimeline::Iterator it(timeline, readers[end - 1]->events.front(), true);
+  });
+}
+
+// extract from the logs of the route, repeated to keep every thread busy, with an increasing number of threads
+static void bench_extract(Route &route) {
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> logs;
+  for (const auto &route_logs = ::route_logs(route); logs.size() < max_threads * 4;) {
+    logs.insert(logs.end(), route_logs.begin(), route_logs.end());
+  }
+  char tmp_path[] = "/tmp/extract_XXXXXX";
+  const std::string out_dir = mkdtemp(tmp_path);
+
+  double single_thread = 0;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    LogExtractor extractor;
+    extractor.addService("carState:vEgo,aEgo,cruiseState.speed");
+    extractor.addService("can:address,src,dat");
+    extractor.run(logs, out_dir, LogExtractor::Format::Binary, threads);
+    const auto &stats = extractor.stats();
+    const double rate = stats.logs / stats.seconds;
+    if (threads == 1) single_thread = rate;
+    printf("%3d threads  %8.2f segments/s  %5.2fx  %zu rows\n", threads, rate, rate / single_thread, stats.rows);
+  }
+  for (auto file : {"carState.bin", "can.bin"}) std::remove((out_dir + "/" + file).c_str());
+  rmdir(out_dir.c_str());
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+
+  const std::map<std::string, std::function<void(Route &)>> benchmarks = {
+    {"decompress", bench_decompress},
+    {"extract", bench_extract},
+    {"framereader", bench_framereader},
+    {"index", bench_index},
+    {"logreader", bench_logreader},
+    {"merge", bench_merge},
+    {"prefetch", bench_prefetch},
+  };
+
+  if (argc < 4 || benchmarks.count(argv[1]) == 0) {
+    fprintf(stderr, "usage: %s <benchmark> <route> <data_dir>\nbenchmarks:", argv[0]);
+    for (auto &[name, _] : benchmarks) fprintf(stderr, " %s", name.c_str());
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  Route route(argv[2], argv[3]);
+  if (!route.load()) {
+    fprintf(stderr, "failed to load route %s from %s\n", argv[2], argv[3]);
+    return 1;
+  }
+  printf("%s: %zu segments\n", argv[2], route.segments().size());
+  benchmarks.at(argv[1])(route);
+  return 0;
+}
@@ -2,9 +2,11 @@
 #include <thread>
 
 #include <QEventLoop>
+#include <zstd.h>
 
 #include "catch2/catch.hpp"
 #include "common/util.h"
+#include "tools/replay/extractor.h"
 #include "tools/replay/replay.h"
 #include "tools/replay/util.h"
 
@@ -69,6 +71,133 @@ TEST_CASE("LogReader") {
     REQUIRE(log.load(corrupt_content.data(), corrupt_content.size()));
     REQUIRE(log.events.size() > 0);
   }
+  SECTION("sidecar index") {
+    const std::string raw_file = cacheFilePath(TEST_RLOG_URL) + ".raw";
+    const std::string index_file = LogIndex::filePath(TEST_RLOG_URL);
+    std::remove(raw_file.c_str());
+    std::remove(index_file.c_str());
+
+    LogReader parsed;
+    REQUIRE(parsed.load(TEST_RLOG_URL, nullptr, true));
+    REQUIRE(util::file_exists(index_file));
+
+    std::vector<bool> filters(cereal::Event::Which::SENDCAN + 1, false);
+    filters[cereal::Event::Which::CAN] = true;
+    LogReader indexed(filters);
+    REQUIRE(indexed.load(TEST_RLOG_URL, nullptr, true));
+    REQUIRE(indexed.index().begin_mono_time == parsed.index().begin_mono_time);
+    REQUIRE(indexed.index().end_mono_time == parsed.index().end_mono_time);
+    REQUIRE(indexed.index().timeline.size() == parsed.index().timeline.size());
+    REQUIRE(indexed.index().can_histogram.size() > 0);
+
+    std::vector<Event> can_events;
+    std::copy_if(parsed.events.begin(), parsed.events.end(), std::back_inserter(can_events),
+                 [](auto &e) { return e.which == cereal::Event::Which::CAN; });
+    REQUIRE(indexed.events.size() == can_events.size());
+    for (size_t i = 0; i < can_events.size(); ++i) {
+      REQUIRE(indexed.events[i].mono_time == can_events[i].mono_time);
+      REQUIRE(indexed.events[i].data.asBytes() == can_events[i].data.asBytes());
+    }
+  }
+  SECTION("raw cache") {
+    // local compressed logs are not decompressed into the cache
+    const std::string local_file = "/tmp/test_raw_cache_rlog.bz2";
+    const std::string compressed = FileReader(true).read(TEST_RLOG_URL);
+    REQUIRE(util::write_file(local_file.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    LogReader local;
+    REQUIRE(local.load(local_file, nullptr, true));
+    REQUIRE(!util::file_exists(cacheFilePath(local_file) + ".raw"));
+
+    // over the limit, the least recently used remote logs are removed
+    const std::string stale_file = cacheFilePath("https://example.com/stale/rlog.bz2") + ".raw";
+    REQUIRE(util::write_file(stale_file.c_str(), compressed.data(), compressed.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+    const std::string raw_file = cacheFilePath(TEST_RLOG_URL) + ".raw";
+    std::remove(raw_file.c_str());
+    LogReader::setRawCacheLimit(1);
+    LogReader remote;
+    REQUIRE(remote.load(TEST_RLOG_URL, nullptr, true));
+    LogReader::setRawCacheLimit(10ULL * 1024 * 1024 * 1024);
+    REQUIRE(util::file_exists(raw_file));
+    REQUIRE(!util::file_exists(stale_file));
+  }
+  SECTION("frame index") {
+    // recompress the log into frames of a second with an index, like loggerd writes it
+    const std::string log = decompressBZ2(FileReader(true).read(TEST_RLOG_URL));
+    std::string file;
+    std::vector<LogFrameIndexEntry> frames;
+    kj::ArrayPtr<const capnp::word> words((const capnp::word *)log.data(), log.size() / sizeof(capnp::word));
+    while (words.size() > 0) {
+      LogFrameIndexEntry frame = {};
+      const char *begin = (const char *)words.begin();
+      while (words.size() > 0) {
+        capnp::FlatArrayMessageReader reader(words);
+        auto event = reader.getRoot<cereal::Event>();
+        const uint64_t mono_time = event.getLogMonoTime();
+        if (frame.uncompressed_size > 0 && mono_time >= frame.begin_mono_time + 1e9) break;
+
+        frame.begin_mono_time = frame.uncompressed_size > 0 ? std::min(frame.begin_mono_time, mono_time) : mono_time;
+        frame.end_mono_time = std::max(frame.end_mono_time, mono_time);
+        frame.add(event.which());
+        frame.uncompressed_size += (reader.getEnd() - words.begin()) * sizeof(capnp::word);
+        words = kj::arrayPtr(reader.getEnd(), words.end());
+      }
+      std::string compressed(ZSTD_compressBound(frame.uncompressed_size), '\0');
+      frame.compressed_size = ZSTD_compress(compressed.data(), compressed.size(), begin, frame.uncompressed_size, 1);
+      frame.offset = file.size();
+      file.append(compressed.data(), frame.compressed_size);
+      frames.push_back(frame);
+    }
+    const LogFrameIndexFooter footer = {(uint32_t)frames.size(), sizeof(LogFrameIndexEntry), LOG_FRAME_INDEX_VERSION, LOG_FRAME_INDEX_MAGIC};
+    const uint32_t header[] = {LOG_FRAME_INDEX_SKIPPABLE_MAGIC, (uint32_t)(frames.size() * sizeof(LogFrameIndexEntry) + sizeof(footer))};
+    file.append((const char *)header, sizeof(header));
+    file.append((const char *)frames.data(), frames.size() * sizeof(LogFrameIndexEntry));
+    file.append((const char *)&footer, sizeof(footer));
+    const std::string log_file = "/tmp/test_frame_index_rlog.zst";
+    REQUIRE(util::write_file(log_file.c_str(), file.data(), file.size(), O_WRONLY | O_CREAT | O_TRUNC) == 0);
+
+    LogReader parsed;
+    REQUIRE(parsed.load(log.data(), log.size()));
+    auto select = [](const std::vector<Event> &events, std::function<bool(const Event &)> pred) {
+      std::vector<Event> selected;
+      std::copy_if(events.begin(), events.end(), std::back_inserter(selected), pred);
+      return selected;
+    };
+    auto require_events = [](const std::vector<Event> &events, const std::vector<Event> &expected) {
+      REQUIRE(events.size() == expected.size());
+      for (size_t i = 0; i < events.size(); ++i) {
+        REQUIRE(events[i].mono_time == expected[i].mono_time);
+        REQUIRE(events[i].data.asBytes() == expected[i].data.asBytes());
+      }
+    };
+
+    // the whole log is still readable by decoders that don't know the index
+    LogReader full;
+    REQUIRE(full.load(log_file));
+    REQUIRE(full.framesLoaded() == 0);
+    require_events(full.events, parsed.events);
+
+    // initData is only in the first frame
+    std::vector<bool> filters(cereal::Event::Which::INIT_DATA + 1, false);
+    filters[cereal::Event::Which::INIT_DATA] = true;
+    LogReader filtered(filters);
+    REQUIRE(filtered.load(log_file));
+    REQUIRE(filtered.framesLoaded() == 1);
+    REQUIRE(filtered.framesTotal() == frames.size());
+    REQUIRE(filtered.index().begin_mono_time == parsed.index().begin_mono_time);
+    REQUIRE(filtered.index().end_mono_time == parsed.index().end_mono_time);
+    require_events(filtered.events, select(parsed.events, [](auto &e) { return e.which == cereal::Event::Which::INIT_DATA; }));
+
+    // a seek only decompresses the frames around it
+    const uint64_t begin = parsed.index().begin_mono_time + 10e9, end = begin + 5e9;
+    LogReader seek;
+    seek.setTimeRange(begin, end);
+    REQUIRE(seek.load(log_file));
+    INFO("loaded " << seek.framesLoaded() << " of " << seek.framesTotal() << " frames");
+    REQUIRE(seek.framesLoaded() < seek.framesTotal() / 4);
+    // the frame packets of encodeIdx have the time of the frame
+    auto in_range = [&](auto &e) { return e.eidx_segnum == -1 && e.mono_time >= begin && e.mono_time <= end; };
+    require_events(select(seek.events, in_range), select(parsed.events, in_range));
+  }
 }
 
 void read_segment(int n, const SegmentFile &segment_file, uint32_t flags) {
@@ -135,6 +264,123 @@ std::string download_demo_route() {
 }
 
 
+TEST_CASE("decompressZST") {
+  // independent frames with checksums, so one can be corrupted without changing the frame sizes
+  std::string raw, compressed;
+  std::vector<size_t> frame_ends;
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+  for (int i = 0; i < 16; ++i) {
+    std::string frame(256 * 1024, '\0');
+    for (size_t j = 0; j < frame.size(); ++j) frame[j] = (j * (i + 1)) % 251;
+    std::string out(ZSTD_compressBound(frame.size()), '\0');
+    const size_t size = ZSTD_compress2(cctx, out.data(), out.size(), frame.data(), frame.size());
+    REQUIRE(!ZSTD_isError(size));
+    raw += frame;
+    compressed.append(out.data(), size);
+    frame_ends.push_back(compressed.size());
+  }
+  ZSTD_freeCCtx(cctx);
+  REQUIRE(decompressZST(compressed) == raw);
+
+  // the frames before the corrupt one are handed over, then it fails
+  std::string corrupt = compressed;
+  corrupt[frame_ends[8] - 1] ^= 0xff;
+  size_t decompressed = 0;
+  bool ret = decompressZST((const std::byte *)corrupt.data(), corrupt.size(), [&](const char *data, size_t size) {
+    REQUIRE(raw.compare(decompressed, size, data, size) == 0);
+    decompressed += size;
+    return true;
+  });
+  REQUIRE(!ret);
+  REQUIRE(decompressed >= 8 * 256 * 1024);
+  REQUIRE(decompressed < raw.size());
+  REQUIRE(decompressZST(corrupt).empty());
+}
+
+TEST_CASE("EventTimeline") {
+  // adjacent segments overlap at the boundary, and CAN is not allowed
+  auto make_events = [](std::vector<uint64_t> times) {
+    std::vector<Event> events;
+    for (auto t : times) {
+      events.emplace_back(t % 2 ? cereal::Event::Which::CAN : cereal::Event::Which::CAR_STATE, t, kj::ArrayPtr<const capnp::word>{});
+    }
+    return events;
+  };
+  const auto seg0 = make_events({2, 4, 5, 6, 10, 12});
+  const auto seg1 = make_events({8, 11, 14, 16, 17});
+  std::vector<bool> allowed(std::max(cereal::Event::Which::CAN, cereal::Event::Which::CAR_STATE) + 1, false);
+  allowed[cereal::Event::Which::CAR_STATE] = true;
+  EventTimeline timeline({{0, nullptr, &seg0}, {1, nullptr, &seg1}}, allowed);
+
+  REQUIRE(timeline.size() == seg0.size() + seg1.size());
+  REQUIRE(timeline.contains(1));
+  REQUIRE(!timeline.contains(2));
+  REQUIRE(timeline.sameSegments({0, 1}));
+  REQUIRE(timeline.back()->mono_time == 16);
+
+  auto merged = [&](uint64_t from, bool inclusive) {
+    std::vector<uint64_t> times;
+    for (EventTimeline::Iterator it(timeline, Event(cereal::Event::Which::CAR_STATE, from, {}), inclusive); it.get(); it.next()) {
+      times.push_back(it.get()->mono_time);
+    }
+    return times;
+  };
+  REQUIRE(merged(0, false) == std::vector<uint64_t>{2, 4, 6, 8, 10, 12, 14, 16});
+  REQUIRE(merged(8, false) == std::vector<uint64_t>{10, 12, 14, 16});
+  REQUIRE(merged(8, true) == std::vector<uint64_t>{8, 10, 12, 14, 16});
+  REQUIRE(merged(16, false).empty());
+
+  // resuming in another snapshot doesn't repeat the equal events that were passed
+  const auto dup0 = make_events({2, 4, 4, 6});
+  const auto dup1 = make_events({4, 8});
+  EventTimeline before({{0, nullptr, &dup0}, {1, nullptr, &dup1}}, allowed);
+  EventTimeline::Iterator it(before, Event(cereal::Event::Which::CAR_STATE, 2, {}), true);
+  for (int i = 0; i < 3; ++i) it.next();
+  REQUIRE(it.get()->mono_time == 4);
+
+  auto resumed = [&](const EventTimeline &after) {
+    std::vector<const Event *> events;
+    for (EventTimeline::Iterator r(after, it); r.get(); r.next()) {
+      events.push_back(r.get());
+    }
+    return events;
+  };
+  auto remaining = resumed(before);
+  REQUIRE(remaining.size() == 3);
+  REQUIRE(remaining[0]->mono_time == 4);
+  REQUIRE(remaining[1]->mono_time == 6);
+  REQUIRE(remaining[2]->mono_time == 8);
+  // one of the equal events was evicted
+  remaining = resumed(EventTimeline({{0, nullptr, &dup0}}, allowed));
+  REQUIRE(remaining.size() == 1);
+  REQUIRE(remaining[0]->mono_time == 6);
+}
+
+TEST_CASE("LogExtractor::sortBySegment") {
+  std::vector<std::string> logs = {
+    "/data/b--0000000b--10/rlog.zst",
+    "/data/a--0000000a--10/rlog.zst",
+    "/data/a--0000000a--2/rlog.zst",
+    "/data/b--0000000b--2/rlog.zst",
+    "/data/c/10/rlog.bz2",
+    "/data/c/2/rlog.bz2",
+    "/data/a--0000000a--2/qlog.zst",
+    "rlog",
+  };
+  LogExtractor::sortBySegment(logs);
+  REQUIRE(logs == std::vector<std::string>{
+    "rlog",
+    "/data/a--0000000a--2/qlog.zst",
+    "/data/a--0000000a--2/rlog.zst",
+    "/data/a--0000000a--10/rlog.zst",
+    "/data/b--0000000b--2/rlog.zst",
+    "/data/b--0000000b--10/rlog.zst",
+    "/data/c/2/rlog.bz2",
+    "/data/c/10/rlog.bz2",
+  });
+}
+
 TEST_CASE("Local route") {
   std::string data_dir = download_demo_route();
 
@@ -2,7 +2,10 @@
 
 #include <bzlib.h>
 #include <curl/curl.h>
+#include <fcntl.h>
 #include <openssl/sha.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <cassert>
 #include <algorithm>
@@ -10,11 +13,14 @@
 #include <cstdarg>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <map>
 #include <mutex>
 #include <numeric>
+#include <thread>
 #include <utility>
+#include <vector>
 #include <zstd.h>
 
 #include "common/timing.h"
@@ -269,6 +275,54 @@ std::string httpGet(const std::string &url, size_t chunk_size, std::atomic<bool>
   return httpDownload(url, result, chunk_size, size, abort) ? result : "";
 }
 
+std::string httpGetRange(const std::string &url, int64_t offset, size_t size, std::atomic<bool> *abort) {
+  if (size == 0) return {};
+
+  std::string result(size, '\0');
+  size_t written = 0;
+  MultiPartWriter<std::string> writer = {.buf = &result, .total_written = &written, .offset = 0, .end = size};
+  const std::string range = offset < 0 ? util::string_format("-%zu", size)
+                                       : util::string_format("%lld-%lld", (long long)offset, (long long)(offset + size - 1));
+  CURL *curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb<std::string>);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&writer);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+
+  CURLM *cm = curl_multi_init();
+  curl_multi_add_handle(cm, curl);
+  int still_running = 1;
+  while (still_running > 0 && !(abort && *abort)) {
+    CURLMcode mc = curl_multi_perform(cm, &still_running);
+    if (mc != CURLM_OK) break;
+    if (still_running > 0) {
+      curl_multi_wait(cm, nullptr, 0, 1000, nullptr);
+    }
+  }
+
+  // a server that ignores the range sends the whole file, the writer stops it at the end of the buffer
+  bool success = false;
+  CURLMsg *msg;
+  int msgs_left = -1;
+  while ((msg = curl_multi_info_read(cm, &msgs_left))) {
+    if (msg->msg == CURLMSG_DONE && msg->data.result == CURLE_OK) {
+      long res_status = 0;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &res_status);
+      success = res_status == 206;
+    }
+  }
+  curl_multi_remove_handle(cm, curl);
+  curl_easy_cleanup(curl);
+  curl_multi_cleanup(cm);
+
+  if (!success || (abort && *abort)) return {};
+  result.resize(written);
+  return result;
+}
+
 bool httpDownload(const std::string &url, const std::string &file, size_t chunk_size, std::atomic<bool> *abort) {
   size_t size = getRemoteFileSize(url, abort);
   if (size == 0) return false;
@@ -283,7 +337,17 @@ std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort) {
 }
 
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort) {
-  if (in_size == 0) return {};
+  std::string out;
+  out.reserve(in_size * 5);
+  bool ret = decompressBZ2(in, in_size, [&out](const char *data, size_t size) {
+    out.append(data, size);
+    return true;
+  }, abort);
+  return ret ? out : "";
+}
+
+bool decompressBZ2(const std::byte *in, size_t in_size, const DecompressCallback &callback, std::atomic<bool> *abort) {
+  if (in_size == 0) return false;
 
   bz_stream strm = {};
   int bzerror = BZ2_bzDecompressInit(&strm, 0, 0);
@@ -291,32 +355,27 @@ std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool>
 
   strm.next_in = (char *)in;
   strm.avail_in = in_size;
-  std::string out(in_size * 5, '\0');
+  std::string block(DECOMPRESS_BLOCK_SIZE, '\0');
+  bool stopped = false;
   do {
-    strm.next_out = (char *)(&out[strm.total_out_lo32]);
-    strm.avail_out = out.size() - strm.total_out_lo32;
+    strm.next_out = block.data();
+    strm.avail_out = block.size();
 
-    const char *prev_write_pos = strm.next_out;
     bzerror = BZ2_bzDecompress(&strm);
-    if (bzerror == BZ_OK && prev_write_pos == strm.next_out) {
+    size_t decompressed = block.size() - strm.avail_out;
+    if (bzerror == BZ_OK && decompressed == 0) {
       // content is corrupt
       bzerror = BZ_STREAM_END;
       rWarning("decompressBZ2 error: content is corrupt");
       break;
     }
-
-    if (bzerror == BZ_OK && strm.avail_in > 0 && strm.avail_out == 0) {
-      out.resize(out.size() * 2);
+    if ((bzerror == BZ_OK || bzerror == BZ_STREAM_END) && decompressed > 0) {
+      stopped = !callback(block.data(), decompressed);
     }
-  } while (bzerror == BZ_OK && !(abort && *abort));
+  } while (bzerror == BZ_OK && !stopped && !(abort && *abort));
 
   BZ2_bzDecompressEnd(&strm);
-  if (bzerror == BZ_STREAM_END && !(abort && *abort)) {
-    out.resize(strm.total_out_lo32);
-    out.shrink_to_fit();
-    return out;
-  }
-  return {};
+  return bzerror == BZ_STREAM_END && !stopped && !(abort && *abort);
 }
 
 std::string decompressZST(const std::string &in, std::atomic<bool> *abort) {
@@ -324,33 +383,111 @@ std::string decompressZST(const std::string &in, std::atomic<bool> *abort) {
 }
 
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort) {
+  std::string out;
+  bool ret = decompressZST(in, in_size, [&out](const char *data, size_t size) {
+    out.append(data, size);
+    return true;
+  }, abort);
+  if (ret) {
+    out.shrink_to_fit();
+    return out;
+  }
+  return {};
+}
+
+static bool decompressZSTStream(const std::byte *in, size_t in_size, const DecompressCallback &callback, std::atomic<bool> *abort) {
   ZSTD_DCtx *dctx = ZSTD_createDCtx();
   assert(dctx != nullptr);
 
-  // Initialize input and output buffers
   ZSTD_inBuffer input = {in, in_size, 0};
-  std::string decompressedData;
   const size_t bufferSize = ZSTD_DStreamOutSize();  // recommended output buffer size
   std::string outputBuffer(bufferSize, '\0');
+  bool stopped = false, corrupt = false;
 
-  while (input.pos < input.size && !(abort && *abort)) {
+  while (input.pos < input.size && !stopped && !(abort && *abort)) {
     ZSTD_outBuffer output = {outputBuffer.data(), bufferSize, 0};
 
     size_t result = ZSTD_decompressStream(dctx, &output, &input);
     if (ZSTD_isError(result)) {
       rWarning("decompressZST error: content is corrupt");
+      corrupt = true;
       break;
     }
-
-    decompressedData.append(outputBuffer.data(), output.pos);
+    if (output.pos > 0) {
+      stopped = !callback(outputBuffer.data(), output.pos);
+    }
   }
 
   ZSTD_freeDCtx(dctx);
-  if (!(abort && *abort)) {
-    decompressedData.shrink_to_fit();
-    return decompressedData;
+  return !corrupt && !stopped && !(abort && *abort);
+}
+
+// frames decompressed on worker threads at once, shared by all calls so concurrent loads don't multiply the threads
+static std::atomic<int> zst_workers = 0;
+
+static bool acquireZSTWorker() {
+  const int max_workers = std::max(2u, std::thread::hardware_concurrency());
+  int n = zst_workers;
+  while (n < max_workers) {
+    if (zst_workers.compare_exchange_weak(n, n + 1)) return true;
   }
-  return {};
+  return false;
+}
+
+bool decompressZST(const std::byte *in, size_t in_size, const DecompressCallback &callback, std::atomic<bool> *abort) {
+  // independent frames can be decompressed in parallel, otherwise stream through the data once
+  std::vector<std::pair<const std::byte *, size_t>> frames;
+  for (size_t pos = 0; pos < in_size;) {
+    size_t frame_size = ZSTD_findFrameCompressedSize(in + pos, in_size - pos);
+    if (ZSTD_isError(frame_size)) {
+      frames.clear();
+      break;
+    }
+    frames.push_back({in + pos, frame_size});
+    pos += frame_size;
+  }
+  if (frames.size() <= 1) {
+    return decompressZSTStream(in, in_size, callback, abort);
+  }
+
+  // keep the cores busy, but hand the frames to the callback in order. a frame that fails ends the
+  // decompression after its partial output is handed over, like the stream does
+  using FrameResult = std::pair<bool, std::string>;
+  auto decompress_frame = [abort](std::pair<const std::byte *, size_t> frame) {
+    FrameResult result;
+    result.first = decompressZSTStream(frame.first, frame.second, [&out = result.second](const char *data, size_t size) {
+      out.append(data, size);
+      return true;
+    }, abort);
+    return result;
+  };
+  const size_t max_pending = std::max(2u, std::thread::hardware_concurrency());
+  std::deque<std::future<FrameResult>> pending;
+  size_t next = 0;
+  bool stopped = false, failed = false;
+  while ((next < frames.size() || !pending.empty()) && !stopped && !failed && !(abort && *abort)) {
+    for (; next < frames.size() && pending.size() < max_pending && acquireZSTWorker(); ++next) {
+      pending.push_back(std::async(std::launch::async, [frame = frames[next], &decompress_frame]() {
+        FrameResult result = decompress_frame(frame);
+        --zst_workers;
+        return result;
+      }));
+    }
+
+    FrameResult result;
+    if (pending.empty()) {
+      // every worker is busy with other calls, decompress the next frame here
+      result = decompress_frame(frames[next++]);
+    } else {
+      result = pending.front().get();
+      pending.pop_front();
+    }
+    if (!result.second.empty()) {
+      stopped = !callback(result.second.data(), result.second.size());
+    }
+    failed = !result.first;
+  }
+  return !failed && !stopped && !(abort && *abort);
 }
 
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &should_exit) {
@@ -389,6 +526,7 @@ void *MonotonicBuffer::allocate(size_t bytes, size_t alignment) {
   if (p == nullptr) {
     available = next_buffer_size = std::max(next_buffer_size, bytes);
     current_buf = buffers.emplace_back(std::aligned_alloc(alignment, next_buffer_size));
+    total_size += next_buffer_size;
     next_buffer_size *= growth_factor;
     p = current_buf;
   }
@@ -403,3 +541,29 @@ MonotonicBuffer::~MonotonicBuffer() {
     free(buf);
   }
 }
+
+// MappedFile
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+
+  struct stat st = {};
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      data_ = (char *)p;
+      size_ = st.st_size;
+    }
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) munmap(data_, size_);
+}
+
+void MappedFile::release() {
+  // clean file-backed pages, they are read back from the page cache on the next access
+  if (data_) madvise(data_, size_, MADV_DONTNEED);
+}
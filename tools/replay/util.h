@@ -27,8 +27,10 @@ public:
   ~MonotonicBuffer();
   void *allocate(size_t bytes, size_t alignment = 16ul);
   void deallocate(void *p) {}
+  inline size_t size() const { return total_size; }
 
 private:
+  size_t total_size = 0;
   void *current_buf = nullptr;
   size_t next_buffer_size = 0;
   size_t available = 0;
@@ -36,15 +38,39 @@ private:
   static constexpr float growth_factor = 1.5;
 };
 
+// Read-only mapping of a whole file. Pages are faulted in on access and can be dropped again with release().
+class MappedFile {
+public:
+  MappedFile(const std::string &path);
+  ~MappedFile();
+  inline bool valid() const { return data_ != nullptr; }
+  inline const char *data() const { return data_; }
+  inline size_t size() const { return size_; }
+  void release();
+
+private:
+  char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
 std::string sha256(const std::string &str);
 void precise_nano_sleep(int64_t nanoseconds, std::atomic<bool> &should_exit);
 std::string decompressBZ2(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressBZ2(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::string &in, std::atomic<bool> *abort = nullptr);
 std::string decompressZST(const std::byte *in, size_t in_size, std::atomic<bool> *abort = nullptr);
+
+// Streaming variants, the callback receives decompressed data in order as soon as each block is ready
+// and can return false to stop. Independent zstd frames are decompressed in parallel.
+typedef std::function<bool(const char *data, size_t size)> DecompressCallback;
+constexpr size_t DECOMPRESS_BLOCK_SIZE = 1024 * 1024;
+bool decompressBZ2(const std::byte *in, size_t in_size, const DecompressCallback &callback, std::atomic<bool> *abort = nullptr);
+bool decompressZST(const std::byte *in, size_t in_size, const DecompressCallback &callback, std::atomic<bool> *abort = nullptr);
 std::string getUrlWithoutQuery(const std::string &url);
 size_t getRemoteFileSize(const std::string &url, std::atomic<bool> *abort = nullptr);
 std::string httpGet(const std::string &url, size_t chunk_size = 0, std::atomic<bool> *abort = nullptr);
+// a byte range of a remote file, a negative offset counts from the end. the result is shorter if the file is
+std::string httpGetRange(const std::string &url, int64_t offset, size_t size, std::atomic<bool> *abort = nullptr);
 
 typedef std::function<void(uint64_t cur, uint64_t total, bool success)> DownloadProgressHandler;
 void installDownloadProgressHandler(DownloadProgressHandler);